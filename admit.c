@@ -0,0 +1,266 @@
+/*
+
+   nsjail - weighted fair admission of connections
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "admit.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "net.h"
+#include "subproc.h"
+#include "util.h"
+
+/* Virtual time of the scheduler: the start tag of the most recently admitted connection */
+static double admitVtime = 0.0;
+
+/*
+ * Format: NAME=PREFIX[/LEN][:WEIGHT[:MAX_CONNS]], e.g. 'acme=10.1.0.0/16:4:20'. IPv4
+ * prefixes are converted to IPv4-mapped IPv6 ones, as the listening socket is AF_INET6
+ */
+bool admitAddTenant(struct nsjconf_t * nsjconf, const char *spec)
+{
+	char *str = utilMalloc(strlen(spec) + 1);
+	memcpy(str, spec, strlen(spec) + 1);
+	char *eq = strchr(str, '=');
+	if (eq == NULL || eq == str) {
+		LOG_E("Tenant '%s' must be in the NAME=PREFIX[/LEN][:WEIGHT[:MAX_CONNS]] format",
+		      spec);
+		return false;
+	}
+	*eq = '\0';
+
+	struct tenant_t *t = utilMalloc(sizeof(struct tenant_t));
+	memset(t, '\0', sizeof(*t));
+	t->name = str;
+	t->weight = 1;
+	t->max_conns = 0;
+	TAILQ_INIT(&t->conns);
+
+	char *prefix = eq + 1;
+	char *colon = strchr(prefix, ':');
+	/* IPv6 prefixes contain colons, the optional fields start after the '/LEN' part */
+	char *slash = strchr(prefix, '/');
+	if (slash != NULL) {
+		colon = strchr(slash, ':');
+	} else if (strchr(prefix, '.') == NULL) {
+		colon = NULL;
+	}
+	if (colon != NULL) {
+		*colon = '\0';
+		char *weight = colon + 1;
+		char *max = strchr(weight, ':');
+		if (max != NULL) {
+			*max = '\0';
+			t->max_conns = (unsigned int)strtoul(max + 1, NULL, 0);
+		}
+		t->weight = (unsigned int)strtoul(weight, NULL, 0);
+		if (t->weight == 0) {
+			LOG_E("Tenant '%s': weight must be > 0", spec);
+			return false;
+		}
+	}
+
+	unsigned int max_len = 128;
+	if (slash != NULL) {
+		*slash = '\0';
+	}
+	struct in_addr in4;
+	if (inet_pton(AF_INET, prefix, &in4) == 1) {
+		memset(&t->prefix, '\0', sizeof(t->prefix));
+		t->prefix.s6_addr[10] = 0xff;
+		t->prefix.s6_addr[11] = 0xff;
+		memcpy(&t->prefix.s6_addr[12], &in4, sizeof(in4));
+		max_len = 32;
+	} else if (inet_pton(AF_INET6, prefix, &t->prefix) != 1) {
+		LOG_E("Tenant '%s': couldn't parse the address prefix '%s'", spec, prefix);
+		return false;
+	}
+	t->prefix_len = max_len;
+	if (slash != NULL) {
+		t->prefix_len = (unsigned int)strtoul(slash + 1, NULL, 10);
+		if (t->prefix_len > max_len) {
+			LOG_E("Tenant '%s': prefix length %u > %u", spec, t->prefix_len, max_len);
+			return false;
+		}
+	}
+	t->prefix_len += (128 - max_len);
+
+	TAILQ_INSERT_TAIL(&nsjconf->tenants, t, pointers);
+	return true;
+}
+
+static bool admitPrefixMatch(const struct tenant_t *t, const struct in6_addr *addr)
+{
+	unsigned int bytes = t->prefix_len / 8;
+	unsigned int bits = t->prefix_len % 8;
+	if (memcmp(t->prefix.s6_addr, addr->s6_addr, bytes) != 0) {
+		return false;
+	}
+	if (bits == 0) {
+		return true;
+	}
+	uint8_t mask = (uint8_t) (0xff << (8 - bits));
+	return ((t->prefix.s6_addr[bytes] & mask) == (addr->s6_addr[bytes] & mask));
+}
+
+/* The last tenant (added in cmdlineParse()) matches everything */
+static struct tenant_t *admitClassify(struct nsjconf_t *nsjconf, int connfd)
+{
+	struct sockaddr_in6 addr;
+	socklen_t addrlen = sizeof(addr);
+	if (getpeername(connfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+		PLOG_W("getpeername(%d)", connfd);
+		return TAILQ_LAST(&nsjconf->tenants, tenantlist);
+	}
+	struct tenant_t *t;
+	TAILQ_FOREACH(t, &nsjconf->tenants, pointers) {
+		if (admitPrefixMatch(t, &addr.sin6_addr)) {
+			return t;
+		}
+	}
+	return TAILQ_LAST(&nsjconf->tenants, tenantlist);
+}
+
+static unsigned int admitRunning(struct nsjconf_t *nsjconf, struct tenant_t *t)
+{
+	unsigned int cnt = 0;
+	struct pids_t *p;
+	TAILQ_FOREACH(p, &nsjconf->pids, pointers) {
+		if (p->tenant == t) {
+			cnt++;
+		}
+	}
+	return cnt;
+}
+
+/* Takes ownership of connfd */
+void admitEnqueue(struct nsjconf_t *nsjconf, int connfd)
+{
+	struct tenant_t *t = admitClassify(nsjconf, connfd);
+	if (t->queued >= nsjconf->max_queued) {
+		LOG_W("Rejecting connection for tenant '%s': %u connections already queued",
+		      t->name, t->queued);
+		t->dropped++;
+		close(connfd);
+		return;
+	}
+	struct admitconn_t *c = utilMalloc(sizeof(struct admitconn_t));
+	c->fd = connfd;
+	clock_gettime(CLOCK_MONOTONIC, &c->queued);
+	TAILQ_INSERT_TAIL(&t->conns, c, pointers);
+	t->queued++;
+	LOG_D("Connection queued for tenant '%s' (queued: %u)", t->name, t->queued);
+}
+
+static void admitRecordWait(struct tenant_t *t, const struct timespec *queued)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (now.tv_sec - queued->tv_sec) * 1000L + (now.tv_nsec - queued->tv_nsec) / 1000000L;
+	unsigned int b = 0;
+	while (ms > 0 && b < ADMIT_HIST_BUCKETS - 1) {
+		ms >>= 1;
+		b++;
+	}
+	t->wait_hist[b]++;
+}
+
+/*
+ * Start-time fair queueing: a backlogged tenant's next connection gets the start tag
+ * max(vtime, its last finish tag) and the finish tag start + 1/weight, and the connection
+ * with the smallest finish tag among tenants below their max_conns is admitted first
+ */
+void admitDispatch(struct nsjconf_t *nsjconf)
+{
+	for (;;) {
+		if (nsjconf->max_conns != 0
+		    && (unsigned int)subprocCount(nsjconf) >= nsjconf->max_conns) {
+			return;
+		}
+
+		struct tenant_t *best = NULL;
+		double best_start = 0.0;
+		struct tenant_t *t;
+		TAILQ_FOREACH(t, &nsjconf->tenants, pointers) {
+			if (t->queued == 0) {
+				continue;
+			}
+			if (t->max_conns != 0 && admitRunning(nsjconf, t) >= t->max_conns) {
+				continue;
+			}
+			double start = (t->vfinish > admitVtime) ? t->vfinish : admitVtime;
+			if (best == NULL
+			    || start + 1.0 / t->weight < best_start + 1.0 / best->weight) {
+				best = t;
+				best_start = start;
+			}
+		}
+		if (best == NULL) {
+			return;
+		}
+
+		struct admitconn_t *c = TAILQ_FIRST(&best->conns);
+		TAILQ_REMOVE(&best->conns, c, pointers);
+		best->queued--;
+		best->admitted++;
+		best->vfinish = best_start + 1.0 / best->weight;
+		admitVtime = best_start;
+		admitRecordWait(best, &c->queued);
+
+		nsjconf->tenant_cur = best;
+		subprocRunChild(nsjconf, c->fd, c->fd, c->fd);
+		nsjconf->tenant_cur = NULL;
+		close(c->fd);
+		free(c);
+	}
+}
+
+void admitDisplay(struct nsjconf_t *nsjconf)
+{
+	struct tenant_t *t;
+	TAILQ_FOREACH(t, &nsjconf->tenants, pointers) {
+		char hist[1024] = "";
+		size_t off = 0;
+		for (unsigned int i = 0; i < ADMIT_HIST_BUCKETS; i++) {
+			if (t->wait_hist[i] == 0) {
+				continue;
+			}
+			if (i == ADMIT_HIST_BUCKETS - 1) {
+				off += snprintf(&hist[off], sizeof(hist) - off, " >=%lums:%" PRIu64,
+						1UL << (i - 1), t->wait_hist[i]);
+			} else {
+				off += snprintf(&hist[off], sizeof(hist) - off, " <%lums:%" PRIu64,
+						1UL << i, t->wait_hist[i]);
+			}
+		}
+		LOG_I("Tenant '%s': weight: %u, max_conns: %u, running: %u, queued: %u, "
+		      "admitted: %" PRIu64 ", dropped: %" PRIu64 ", queue wait:%s", t->name,
+		      t->weight, t->max_conns, admitRunning(nsjconf, t), t->queued, t->admitted,
+		      t->dropped, hist[0] ? hist : " none");
+	}
+}
@@ -0,0 +1,505 @@
+/*
+
+   nsjail - memoization of results of deterministic jobs
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cache.h"
+
+#include "log.h"
+
+#if defined(NSJAIL_WITH_OPENSSL)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/*
+ * Layout of --cache_dir:
+ *   objects/<sha256>/{stdout,stderr,meta}  - results, 'meta' is '<status> <cpu_usec>'
+ *   tmp/job.XXXXXX/                        - the job being recorded
+ *   stats                                  - '<hits> <misses> <saved_cpu_usec>'
+ *   lock                                   - flock() for 'stats' and the eviction
+ */
+
+static bool cacheRecording = false;
+static char cacheKey[EVP_MAX_MD_SIZE * 2 + 1];
+static char cacheTmpDir[PATH_MAX];
+static int cacheInFd = -1;
+static int cacheOutFd = -1;
+static int cacheErrFd = -1;
+
+bool cacheInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->cache_dir == NULL) {
+		return true;
+	}
+	const char *subdirs[] = { "objects", "tmp" };
+	for (size_t i = 0; i < ARRAYSIZE(subdirs); i++) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", nsjconf->cache_dir, subdirs[i]);
+		if (utilCreateDirRecursively(path) == false
+		    || (mkdir(path, 0700) == -1 && errno != EEXIST)) {
+			PLOG_E("Couldn't create '%s'", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool cacheCopy(int from, int to)
+{
+	if (lseek(from, 0, SEEK_SET) == (off_t) - 1) {
+		PLOG_E("lseek(%d, 0, SEEK_SET)", from);
+		return false;
+	}
+	char buf[1024 * 64];
+	for (;;) {
+		ssize_t sz = read(from, buf, sizeof(buf));
+		if (sz < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sz < 0) {
+			PLOG_E("read(%d)", from);
+			return false;
+		}
+		if (sz == 0) {
+			return true;
+		}
+		if (utilWriteToFd(to, buf, sz) == false) {
+			return false;
+		}
+	}
+}
+
+static void cacheRemoveDir(const char *dir)
+{
+	const char *files[] = { "stdin", "stdout", "stderr", "meta" };
+	for (size_t i = 0; i < ARRAYSIZE(files); i++) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		unlink(path);
+	}
+	if (rmdir(dir) == -1) {
+		PLOG_W("rmdir('%s')", dir);
+	}
+}
+
+static int cacheLock(struct nsjconf_t *nsjconf)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/lock", nsjconf->cache_dir);
+	int fd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+	if (fd == -1) {
+		PLOG_W("open('%s')", path);
+		return -1;
+	}
+	if (TEMP_FAILURE_RETRY(flock(fd, LOCK_EX)) == -1) {
+		PLOG_W("flock('%s', LOCK_EX)", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void cacheUpdateStats(struct nsjconf_t *nsjconf, bool hit, uint64_t saved_usec)
+{
+	int lockfd = cacheLock(nsjconf);
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/stats", nsjconf->cache_dir);
+
+	uint64_t hits = 0, misses = 0, saved = 0;
+	char buf[256];
+	int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+	if (fd != -1) {
+		ssize_t sz = utilReadFromFd(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (sz > 0) {
+			buf[sz] = '\0';
+			sscanf(buf, "%" SCNu64 " %" SCNu64 " %" SCNu64, &hits, &misses, &saved);
+		}
+	}
+	if (hit) {
+		hits++;
+		saved += saved_usec;
+	} else {
+		misses++;
+	}
+	snprintf(buf, sizeof(buf), "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", hits, misses, saved);
+	utilWriteBufToFile(path, buf, strlen(buf), O_WRONLY | O_CREAT | O_TRUNC);
+	if (lockfd != -1) {
+		close(lockfd);
+	}
+
+	LOG_I("Cache %s (%s), hits: %" PRIu64 ", misses: %" PRIu64 ", hit rate: %.1f%%, CPU time "
+	      "saved: %" PRIu64 ".%03" PRIu64 " s", hit ? "hit" : "miss", cacheKey, hits, misses,
+	      100.0 * hits / (hits + misses), saved / 1000000, (saved / 1000) % 1000);
+}
+
+struct cacheentry_t {
+	char name[EVP_MAX_MD_SIZE * 2 + 1];
+	time_t mtime;
+	uint64_t size;
+};
+
+static int cacheEntryCmp(const void *a, const void *b)
+{
+	const struct cacheentry_t *ea = a, *eb = b;
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/* Least recently used entries go first, hits update the mtime of the entry's directory */
+static void cacheEvict(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->cache_max_bytes == 0) {
+		return;
+	}
+	int lockfd = cacheLock(nsjconf);
+
+	char objdir[PATH_MAX];
+	snprintf(objdir, sizeof(objdir), "%s/objects", nsjconf->cache_dir);
+	DIR *dir = opendir(objdir);
+	if (dir == NULL) {
+		PLOG_W("opendir('%s')", objdir);
+		if (lockfd != -1) {
+			close(lockfd);
+		}
+		return;
+	}
+
+	struct cacheentry_t *entries = NULL;
+	size_t cnt = 0;
+	uint64_t total = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' || strlen(de->d_name) >= sizeof(entries->name)) {
+			continue;
+		}
+		char path[PATH_MAX];
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/%s", objdir, de->d_name);
+		if (stat(path, &st) == -1) {
+			continue;
+		}
+		struct cacheentry_t e = {.mtime = st.st_mtime,.size = 0 };
+		snprintf(e.name, sizeof(e.name), "%s", de->d_name);
+		const char *files[] = { "stdout", "stderr", "meta" };
+		for (size_t i = 0; i < ARRAYSIZE(files); i++) {
+			snprintf(path, sizeof(path), "%s/%s/%s", objdir, de->d_name, files[i]);
+			if (stat(path, &st) == 0) {
+				e.size += st.st_size;
+			}
+		}
+		entries = realloc(entries, sizeof(struct cacheentry_t) * (cnt + 1));
+		if (entries == NULL) {
+			LOG_F("realloc(%zu) failed", sizeof(struct cacheentry_t) * (cnt + 1));
+		}
+		entries[cnt++] = e;
+		total += e.size;
+	}
+	closedir(dir);
+
+	qsort(entries, cnt, sizeof(struct cacheentry_t), cacheEntryCmp);
+	for (size_t i = 0; i < cnt && total > nsjconf->cache_max_bytes; i++) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", objdir, entries[i].name);
+		LOG_D("Evicting cache entry '%s' (%" PRIu64 " bytes)", entries[i].name,
+		      entries[i].size);
+		cacheRemoveDir(path);
+		total -= entries[i].size;
+	}
+	free(entries);
+	if (lockfd != -1) {
+		close(lockfd);
+	}
+}
+
+static bool cacheHashBinary(struct nsjconf_t *nsjconf, EVP_MD_CTX * ctx)
+{
+	char path[PATH_MAX];
+	if (nsjconf->argv[0][0] == '/') {
+		snprintf(path, sizeof(path), "%s%s", nsjconf->chroot ? nsjconf->chroot : "",
+			 nsjconf->argv[0]);
+	} else {
+		snprintf(path, sizeof(path), "%s%s/%s", nsjconf->chroot ? nsjconf->chroot : "",
+			 nsjconf->cwd, nsjconf->argv[0]);
+	}
+	struct stat st;
+	if (stat(path, &st) == -1) {
+		PLOG_W("stat('%s')", path);
+		return false;
+	}
+	/* Any modification of the file changes its ctime */
+	uint64_t id[] = {
+		st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		st.st_ctim.tv_sec, st.st_ctim.tv_nsec,
+	};
+	EVP_DigestUpdate(ctx, id, sizeof(id));
+	return true;
+}
+
+static void cacheHashStrings(EVP_MD_CTX * ctx, char *const *strs)
+{
+	for (size_t i = 0; strs[i]; i++) {
+		EVP_DigestUpdate(ctx, strs[i], strlen(strs[i]) + 1);
+	}
+	EVP_DigestUpdate(ctx, "", 1);
+}
+
+/* Copies stdin to the job's directory, as the jail must get the very same payload */
+static bool cacheHashStdin(EVP_MD_CTX * ctx)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/stdin", cacheTmpDir);
+	cacheInFd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+	if (cacheInFd == -1) {
+		PLOG_E("open('%s')", path);
+		return false;
+	}
+	unlink(path);
+
+	char buf[1024 * 64];
+	for (;;) {
+		ssize_t sz = read(STDIN_FILENO, buf, sizeof(buf));
+		if (sz < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sz < 0) {
+			PLOG_E("read(STDIN_FILENO)");
+			return false;
+		}
+		if (sz == 0) {
+			break;
+		}
+		EVP_DigestUpdate(ctx, buf, sz);
+		if (utilWriteToFd(cacheInFd, buf, sz) == false) {
+			return false;
+		}
+	}
+	if (lseek(cacheInFd, 0, SEEK_SET) == (off_t) - 1) {
+		PLOG_E("lseek('%s', 0, SEEK_SET)", path);
+		return false;
+	}
+	return true;
+}
+
+static bool cacheComputeKey(struct nsjconf_t *nsjconf)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	if (ctx == NULL || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+		LOG_E("Couldn't initialize SHA-256");
+		EVP_MD_CTX_free(ctx);
+		return false;
+	}
+	/* The whole nsjail command-line, as the jail's setup can change the results too */
+	cacheHashStrings(ctx, nsjconf->cmdline_argv);
+	/* The per-jail variables (e.g. JAIL_ID) aren't set yet */
+	cacheHashStrings(ctx, nsjconf->env_prebuilt);
+	if (cacheHashBinary(nsjconf, ctx) == false || cacheHashStdin(ctx) == false) {
+		EVP_MD_CTX_free(ctx);
+		return false;
+	}
+
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int mdlen = 0;
+	EVP_DigestFinal_ex(ctx, md, &mdlen);
+	EVP_MD_CTX_free(ctx);
+	for (unsigned int i = 0; i < mdlen; i++) {
+		snprintf(&cacheKey[i * 2], 3, "%02x", md[i]);
+	}
+	return true;
+}
+
+static int cacheOpenOutput(const char *name)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", cacheTmpDir, name);
+	int fd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+	if (fd == -1) {
+		PLOG_E("open('%s')", path);
+	}
+	return fd;
+}
+
+static bool cacheReplay(struct nsjconf_t *nsjconf, int *status)
+{
+	char dir[PATH_MAX], path[PATH_MAX], buf[256];
+	snprintf(dir, sizeof(dir), "%s/objects/%s", nsjconf->cache_dir, cacheKey);
+	snprintf(path, sizeof(path), "%s/meta", dir);
+	int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+	if (fd == -1) {
+		return false;
+	}
+	ssize_t sz = utilReadFromFd(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	uint64_t cpu_usec = 0;
+	if (sz <= 0) {
+		return false;
+	}
+	buf[sz] = '\0';
+	if (sscanf(buf, "%d %" SCNu64, status, &cpu_usec) != 2) {
+		LOG_W("Malformed cache entry '%s'", path);
+		return false;
+	}
+
+	const char *files[] = { "stdout", "stderr" };
+	const int fds[] = { STDOUT_FILENO, STDERR_FILENO };
+	for (size_t i = 0; i < ARRAYSIZE(files); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+		if (fd == -1) {
+			PLOG_W("open('%s')", path);
+			return false;
+		}
+		bool ret = cacheCopy(fd, fds[i]);
+		close(fd);
+		if (ret == false) {
+			return false;
+		}
+	}
+	if (utimensat(AT_FDCWD, dir, NULL, 0) == -1) {
+		PLOG_W("utimensat('%s')", dir);
+	}
+	cacheUpdateStats(nsjconf, true, cpu_usec);
+	return true;
+}
+
+/*
+ * Returns true (and the recorded exit status) if the result was found in the cache and
+ * replayed. Otherwise, the job is recorded: fd_in gets the spooled stdin, and fd_out/fd_err
+ * the files which cacheStore() copies to the console and stores
+ */
+bool cacheLookup(struct nsjconf_t * nsjconf, int *fd_in, int *fd_out, int *fd_err, int *status)
+{
+	if (nsjconf->cache_dir == NULL) {
+		return false;
+	}
+	if (isatty(STDIN_FILENO)) {
+		LOG_W("stdin is a terminal, not using the cache");
+		return false;
+	}
+	snprintf(cacheTmpDir, sizeof(cacheTmpDir), "%s/tmp/job.XXXXXX", nsjconf->cache_dir);
+	if (mkdtemp(cacheTmpDir) == NULL) {
+		PLOG_E("mkdtemp('%s')", cacheTmpDir);
+		return false;
+	}
+	if (cacheComputeKey(nsjconf) == false) {
+		LOG_W("Not using the cache for this job");
+		if (cacheInFd != -1) {
+			*fd_in = cacheInFd;
+		}
+		cacheRemoveDir(cacheTmpDir);
+		return false;
+	}
+	if (cacheReplay(nsjconf, status) == true) {
+		close(cacheInFd);
+		cacheRemoveDir(cacheTmpDir);
+		return true;
+	}
+
+	cacheOutFd = cacheOpenOutput("stdout");
+	cacheErrFd = cacheOpenOutput("stderr");
+	*fd_in = cacheInFd;
+	if (cacheOutFd == -1 || cacheErrFd == -1) {
+		cacheRemoveDir(cacheTmpDir);
+		return false;
+	}
+	*fd_out = cacheOutFd;
+	*fd_err = cacheErrFd;
+	cacheRecording = true;
+	return false;
+}
+
+/* Only results of processes which exited (i.e. weren't killed, status < 100) are stored */
+void cacheStore(struct nsjconf_t *nsjconf, int status)
+{
+	if (cacheRecording == false) {
+		return;
+	}
+	cacheRecording = false;
+	cacheCopy(cacheOutFd, STDOUT_FILENO);
+	cacheCopy(cacheErrFd, STDERR_FILENO);
+	close(cacheOutFd);
+	close(cacheErrFd);
+	close(cacheInFd);
+
+	if (status >= 100) {
+		LOG_I("Not caching the result, the process was killed with signal %d", status - 100);
+		cacheRemoveDir(cacheTmpDir);
+		return;
+	}
+
+	struct rusage ru;
+	uint64_t cpu_usec = 0;
+	if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+		cpu_usec = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+		    ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+	}
+	char path[PATH_MAX], buf[256];
+	snprintf(path, sizeof(path), "%s/meta", cacheTmpDir);
+	snprintf(buf, sizeof(buf), "%d %" PRIu64 "\n", status, cpu_usec);
+	if (utilWriteBufToFile(path, buf, strlen(buf), O_WRONLY | O_CREAT | O_TRUNC) == false) {
+		cacheRemoveDir(cacheTmpDir);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/objects/%s", nsjconf->cache_dir, cacheKey);
+	if (rename(cacheTmpDir, path) == -1) {
+		/* Stored by a concurrent run of the same job */
+		PLOG_D("rename('%s', '%s')", cacheTmpDir, path);
+		cacheRemoveDir(cacheTmpDir);
+	}
+	cacheUpdateStats(nsjconf, false, 0);
+	cacheEvict(nsjconf);
+}
+
+#else				/* defined(NSJAIL_WITH_OPENSSL) */
+
+bool cacheInit(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->cache_dir == NULL) {
+		return true;
+	}
+	LOG_E("nsjail was compiled without result caching support (OpenSSL headers were not "
+	      "found)");
+	return false;
+}
+
+bool cacheLookup(struct nsjconf_t *nsjconf __attribute__ ((unused)),
+		 int *fd_in __attribute__ ((unused)), int *fd_out __attribute__ ((unused)),
+		 int *fd_err __attribute__ ((unused)), int *status __attribute__ ((unused)))
+{
+	return false;
+}
+
+void cacheStore(struct nsjconf_t *nsjconf __attribute__ ((unused)),
+		int status __attribute__ ((unused)))
+{
+}
+
+#endif				/* defined(NSJAIL_WITH_OPENSSL) */
@@ -0,0 +1,33 @@
+/*
+
+   nsjail - memoization of results of deterministic jobs
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_CACHE_H
+#define NS_CACHE_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+bool cacheInit(struct nsjconf_t *nsjconf);
+bool cacheLookup(struct nsjconf_t *nsjconf, int *fd_in, int *fd_out, int *fd_err, int *status);
+void cacheStore(struct nsjconf_t *nsjconf, int status);
+
+#endif				/* NS_CACHE_H */
@@ -23,8 +23,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
@@ -36,9 +39,23 @@
 #include "log.h"
 #include "util.h"
 
-bool cgroupInitNsFromParent(struct nsjconf_t *nsjconf, pid_t pid)
+static bool cgroupMemEnabled(struct nsjconf_t *nsjconf)
 {
-	if (nsjconf->cgroup_mem_max == (size_t) 0) {
+	return (nsjconf->cgroup_mem_max != (size_t) 0 || nsjconf->cgroup_mem_soft != (size_t) 0);
+}
+
+/* Set by cgroupInit(): the kill/CPU cgroup is in the cgroup v2 (unified) hierarchy */
+static bool cgroupKillV2 = false;
+static bool cgroupCpuV2 = false;
+
+static bool cgroupCpuEnabled(struct nsjconf_t *nsjconf)
+{
+	return (nsjconf->cgroup_cpu_ms_max != 0);
+}
+
+static bool cgroupInitNsFromParentMem(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (cgroupMemEnabled(nsjconf) == false) {
 		return true;
 	}
 
@@ -63,6 +80,34 @@ bool cgroupInitNsFromParent(struct nsjconf_t *nsjconf, pid_t pid)
 		}
 	}
 
+	/*
+	 * memory.memsw.limit_in_bytes limits memory+swap, and must be set after (and be no smaller
+	 * than) memory.limit_in_bytes. It's only present with swap accounting enabled
+	 */
+	if (nsjconf->cgroup_mem_swap_max != (size_t) 0) {
+		char memsw_max_str[512];
+		snprintf(memsw_max_str, sizeof(memsw_max_str), "%zu",
+			 nsjconf->cgroup_mem_max + nsjconf->cgroup_mem_swap_max);
+		snprintf(fname, sizeof(fname), "%s/memory.memsw.limit_in_bytes", mem_cgroup_path);
+		LOG_D("Setting '%s' to '%s'", fname, memsw_max_str);
+		if (utilWriteBufToFile(fname, memsw_max_str, strlen(memsw_max_str), O_WRONLY) ==
+		    false) {
+			LOG_E("Could not update memory+swap cgroup max limit");
+			return false;
+		}
+	}
+
+	if (nsjconf->cgroup_mem_soft != (size_t) 0) {
+		char mem_soft_str[512];
+		snprintf(mem_soft_str, sizeof(mem_soft_str), "%zu", nsjconf->cgroup_mem_soft);
+		snprintf(fname, sizeof(fname), "%s/memory.soft_limit_in_bytes", mem_cgroup_path);
+		LOG_D("Setting '%s' to '%s'", fname, mem_soft_str);
+		if (utilWriteBufToFile(fname, mem_soft_str, strlen(mem_soft_str), O_WRONLY) == false) {
+			LOG_E("Could not update memory cgroup soft limit");
+			return false;
+		}
+	}
+
 	/*
 	 * Use OOM-killer instead of making processes hang/sleep
 	 */
@@ -85,15 +130,314 @@ bool cgroupInitNsFromParent(struct nsjconf_t *nsjconf, pid_t pid)
 	return true;
 }
 
-void cgroupFinishFromParent(struct nsjconf_t *nsjconf, pid_t pid)
+/* Creates (if needed) the cgroup of the jail, and moves the jail's process to it */
+static bool cgroupJoin(const char *cgroup_path, pid_t pid, const char *what)
+{
+	LOG_D("Create '%s' for PID=%d", cgroup_path, (int)pid);
+	if (mkdir(cgroup_path, 0700) == -1 && errno != EEXIST) {
+		PLOG_E("mkdir('%s', 0700) failed", cgroup_path);
+		return false;
+	}
+
+	char fname[PATH_MAX];
+	char pid_str[512];
+	snprintf(pid_str, sizeof(pid_str), "%d", (int)pid);
+	snprintf(fname, sizeof(fname), "%s/cgroup.procs", cgroup_path);
+	LOG_D("Adding PID='%s' to '%s'", pid_str, fname);
+	if (utilWriteBufToFile(fname, pid_str, strlen(pid_str), O_WRONLY) == false) {
+		LOG_E("Could not update %s cgroup process list", what);
+		return false;
+	}
+
+	return true;
+}
+
+static void cgroupKillPath(struct nsjconf_t *nsjconf, pid_t pid, char *path, size_t len)
+{
+	snprintf(path, len, "%s/%s/NSJAIL.%d", nsjconf->cgroup_kill_mount,
+		 nsjconf->cgroup_kill_parent, (int)pid);
+}
+
+/*
+ * Every jail gets its own cgroup, which tracks all of its processes, including those which
+ * called setsid() or escaped the PID namespace (or with --disable_clone_newpid)
+ */
+static bool cgroupInitNsFromParentKill(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (nsjconf->cgroup_kill == false) {
+		return true;
+	}
+
+	char kill_cgroup_path[PATH_MAX];
+	cgroupKillPath(nsjconf, pid, kill_cgroup_path, sizeof(kill_cgroup_path));
+	return cgroupJoin(kill_cgroup_path, pid, "kill");
+}
+
+static void cgroupCpuPath(struct nsjconf_t *nsjconf, pid_t pid, char *path, size_t len)
+{
+	snprintf(path, len, "%s/%s/NSJAIL.%d", nsjconf->cgroup_cpu_mount,
+		 nsjconf->cgroup_cpu_parent, (int)pid);
+}
+
+/*
+ * In cgroup v2 with --cgroup_kill this is the same cgroup as the kill one (cgroupInit() makes
+ * sure of it), as both are created with the same name, and the PID is simply moved to it again
+ */
+static bool cgroupInitNsFromParentCpu(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (cgroupCpuEnabled(nsjconf) == false) {
+		return true;
+	}
+
+	char cpu_cgroup_path[PATH_MAX];
+	cgroupCpuPath(nsjconf, pid, cpu_cgroup_path, sizeof(cpu_cgroup_path));
+	return cgroupJoin(cpu_cgroup_path, pid, "CPU accounting");
+}
+
+bool cgroupInitNsFromParent(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (cgroupInitNsFromParentMem(nsjconf, pid) == false) {
+		return false;
+	}
+	if (cgroupInitNsFromParentKill(nsjconf, pid) == false) {
+		return false;
+	}
+	return cgroupInitNsFromParentCpu(nsjconf, pid);
+}
+
+static bool cgroupRenamePath(const char *from, const char *to)
+{
+	LOG_D("Renaming '%s' to '%s'", from, to);
+	if (rename(from, to) == -1) {
+		/* Already renamed, if it's the same cgroup as the previous one (cgroup v2) */
+		if (errno == ENOENT && access(to, F_OK) == 0) {
+			return true;
+		}
+		PLOG_E("rename('%s', '%s')", from, to);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * The cgroups of a jail are named after its PID. A jail restored by CRIU starts in the cgroups
+ * of the CRIU process (to which the restored processes belong from the start), which are then
+ * renamed after the restored PID
+ */
+bool cgroupRename(struct nsjconf_t *nsjconf, pid_t from, pid_t to)
+{
+	char from_path[PATH_MAX];
+	char to_path[PATH_MAX];
+	if (cgroupMemEnabled(nsjconf)) {
+		snprintf(from_path, sizeof(from_path), "%s/%s/NSJAIL.%d",
+			 nsjconf->cgroup_mem_mount, nsjconf->cgroup_mem_parent, (int)from);
+		snprintf(to_path, sizeof(to_path), "%s/%s/NSJAIL.%d", nsjconf->cgroup_mem_mount,
+			 nsjconf->cgroup_mem_parent, (int)to);
+		if (cgroupRenamePath(from_path, to_path) == false) {
+			return false;
+		}
+	}
+	if (nsjconf->cgroup_kill) {
+		cgroupKillPath(nsjconf, from, from_path, sizeof(from_path));
+		cgroupKillPath(nsjconf, to, to_path, sizeof(to_path));
+		if (cgroupRenamePath(from_path, to_path) == false) {
+			return false;
+		}
+	}
+	if (cgroupCpuEnabled(nsjconf)) {
+		cgroupCpuPath(nsjconf, from, from_path, sizeof(from_path));
+		cgroupCpuPath(nsjconf, to, to_path, sizeof(to_path));
+		if (cgroupRenamePath(from_path, to_path) == false) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * CPU time (user + system) used by all processes of the jail so far, from cpu.stat in cgroup
+ * v2 (present even without the cpu controller), and cpuacct.usage in cgroup v1
+ */
+bool cgroupCpuUsage(struct nsjconf_t * nsjconf, pid_t pid, uint64_t * usec)
+{
+	if (cgroupCpuEnabled(nsjconf) == false) {
+		return false;
+	}
+
+	char cpu_cgroup_path[PATH_MAX];
+	cgroupCpuPath(nsjconf, pid, cpu_cgroup_path, sizeof(cpu_cgroup_path));
+
+	char fname[PATH_MAX];
+	char buf[1024];
+	snprintf(fname, sizeof(fname), "%s/%s", cpu_cgroup_path,
+		 cgroupCpuV2 ? "cpu.stat" : "cpuacct.usage");
+	ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+	if (sz <= 0) {
+		return false;
+	}
+	buf[sz] = '\0';
+
+	if (cgroupCpuV2 == false) {
+		*usec = strtoull(buf, NULL, 10) / 1000ULL;
+		return true;
+	}
+	const char *s = strstr(buf, "usage_usec ");
+	if (s == NULL) {
+		return false;
+	}
+	*usec = strtoull(s + strlen("usage_usec "), NULL, 10);
+	return true;
+}
+
+static bool cgroupSetFrozen(const char *kill_cgroup_path, bool frozen)
+{
+	char fname[PATH_MAX];
+	if (cgroupKillV2) {
+		snprintf(fname, sizeof(fname), "%s/cgroup.freeze", kill_cgroup_path);
+		const char *val = frozen ? "1" : "0";
+		return utilWriteBufToFile(fname, val, strlen(val), O_WRONLY);
+	}
+	snprintf(fname, sizeof(fname), "%s/freezer.state", kill_cgroup_path);
+	const char *val = frozen ? "FROZEN" : "THAWED";
+	return utilWriteBufToFile(fname, val, strlen(val), O_WRONLY);
+}
+
+/* Returns the number of processes which got the signal */
+static size_t cgroupKillProcs(const char *kill_cgroup_path)
+{
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s/cgroup.procs", kill_cgroup_path);
+	FILE *f = fopen(fname, "re");
+	if (f == NULL) {
+		PLOG_W("fopen('%s')", fname);
+		return 0;
+	}
+	size_t cnt = 0;
+	int pid;
+	while (fscanf(f, "%d", &pid) == 1) {
+		if (kill(pid, SIGKILL) == 0) {
+			cnt++;
+		}
+	}
+	fclose(f);
+	return cnt;
+}
+
+/*
+ * Kills all processes of the cgroup at once: with cgroup.kill (Linux >= 5.14) in cgroup v2, or
+ * by freezing the cgroup first in cgroup v1. Freezing is asynchronous there, and it isn't
+ * waited for: a process which forked before it got frozen can leave a child behind, which is
+ * killed on a later reap pass, as the jail isn't finished while its cgroup isn't empty
+ */
+static bool cgroupKillPathProcs(const char *kill_cgroup_path)
+{
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s/cgroup.kill", kill_cgroup_path);
+	if (cgroupKillV2 && access(fname, W_OK) == 0) {
+		LOG_D("Writting '1' to '%s'", fname);
+		return utilWriteBufToFile(fname, "1", strlen("1"), O_WRONLY);
+	}
+
+	bool frozen = cgroupSetFrozen(kill_cgroup_path, true);
+	size_t cnt = cgroupKillProcs(kill_cgroup_path);
+	if (frozen) {
+		cgroupSetFrozen(kill_cgroup_path, false);
+	}
+	LOG_D("Sent SIGKILL to %zu process(es) of '%s'", cnt, kill_cgroup_path);
+	return true;
+}
+
+bool cgroupKill(struct nsjconf_t * nsjconf, pid_t pid)
+{
+	if (nsjconf->cgroup_kill == false) {
+		return false;
+	}
+
+	char kill_cgroup_path[PATH_MAX];
+	cgroupKillPath(nsjconf, pid, kill_cgroup_path, sizeof(kill_cgroup_path));
+	return cgroupKillPathProcs(kill_cgroup_path);
+}
+
+/* From cgroup.events in cgroup v2, and cgroup.procs (which doesn't list zombies) in cgroup v1 */
+static bool cgroupPopulated(const char *kill_cgroup_path)
+{
+	char fname[PATH_MAX];
+	char buf[4096];
+	snprintf(fname, sizeof(fname), "%s/%s", kill_cgroup_path,
+		 cgroupKillV2 ? "cgroup.events" : "cgroup.procs");
+	ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+	if (sz < 0) {
+		return false;
+	}
+	buf[sz] = '\0';
+	if (cgroupKillV2 == false) {
+		return (sz > 0);
+	}
+	return (strstr(buf, "populated 1") != NULL);
+}
+
+/*
+ * Returns whether the kill cgroup of the jail is empty. If it isn't, the processes left in it
+ * get SIGKILL (again), and the caller checks it again later, without waiting for them
+ */
+bool cgroupDrain(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (nsjconf->cgroup_kill == false) {
+		return true;
+	}
+
+	char kill_cgroup_path[PATH_MAX];
+	cgroupKillPath(nsjconf, pid, kill_cgroup_path, sizeof(kill_cgroup_path));
+	if (cgroupPopulated(kill_cgroup_path) == false) {
+		return true;
+	}
+	cgroupKillPathProcs(kill_cgroup_path);
+	return false;
+}
+
+static void cgroupFinishFromParentKill(struct nsjconf_t *nsjconf, pid_t pid)
 {
-	if (nsjconf->cgroup_mem_max == (size_t) 0) {
+	if (nsjconf->cgroup_kill == false) {
+		return;
+	}
+
+	char kill_cgroup_path[PATH_MAX];
+	cgroupKillPath(nsjconf, pid, kill_cgroup_path, sizeof(kill_cgroup_path));
+
+	LOG_D("Remove '%s'", kill_cgroup_path);
+	if (rmdir(kill_cgroup_path) == 0 || errno == ENOENT) {
+		return;
+	}
+	if (errno != EBUSY) {
+		PLOG_W("rmdir('%s') failed", kill_cgroup_path);
+		return;
+	}
+	/* Only after a failed setup (subprocAbort()), reaped jails have been drained */
+	cgroupKillPathProcs(kill_cgroup_path);
+	LOG_W("Processes of PID: %d are still alive, its kill cgroup '%s' is left behind",
+	      (int)pid, kill_cgroup_path);
+}
+
+static void cgroupFinishFromParentMem(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (cgroupMemEnabled(nsjconf) == false) {
 		return;
 	}
 
 	char mem_cgroup_path[PATH_MAX];
 	snprintf(mem_cgroup_path, sizeof(mem_cgroup_path), "%s/%s/NSJAIL.%d",
 		 nsjconf->cgroup_mem_mount, nsjconf->cgroup_mem_parent, (int)pid);
+
+	char fname[PATH_MAX];
+	char buf[64];
+	snprintf(fname, sizeof(fname), "%s/memory.max_usage_in_bytes", mem_cgroup_path);
+	ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+	if (sz > 0) {
+		buf[sz] = '\0';
+		LOG_I("PID: %d memory cgroup usage peak: %zu bytes", (int)pid,
+		      (size_t) strtoull(buf, NULL, 10));
+	}
+
 	LOG_D("Remove '%s'", mem_cgroup_path);
 	if (rmdir(mem_cgroup_path) == -1) {
 		PLOG_W("rmdir('%s') failed", mem_cgroup_path);
@@ -101,6 +445,121 @@ void cgroupFinishFromParent(struct nsjconf_t *nsjconf, pid_t pid)
 	return;
 }
 
+static void cgroupFinishFromParentCpu(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	if (cgroupCpuEnabled(nsjconf) == false) {
+		return;
+	}
+
+	char cpu_cgroup_path[PATH_MAX];
+	cgroupCpuPath(nsjconf, pid, cpu_cgroup_path, sizeof(cpu_cgroup_path));
+
+	LOG_D("Remove '%s'", cpu_cgroup_path);
+	if (rmdir(cpu_cgroup_path) == -1 && errno != ENOENT) {
+		PLOG_W("rmdir('%s') failed", cpu_cgroup_path);
+	}
+}
+
+void cgroupFinishFromParent(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	uint64_t usec;
+	if (cgroupCpuUsage(nsjconf, pid, &usec) == true) {
+		LOG_I("PID: %d cgroup CPU time: %" PRIu64 ".%03" PRIu64 " s", (int)pid,
+		      usec / 1000000, (usec / 1000) % 1000);
+	}
+	cgroupFinishFromParentKill(nsjconf, pid);
+	cgroupFinishFromParentCpu(nsjconf, pid);
+	cgroupFinishFromParentMem(nsjconf, pid);
+}
+
+static bool cgroupInitCpu(struct nsjconf_t *nsjconf)
+{
+	if (cgroupCpuEnabled(nsjconf) == false) {
+		return true;
+	}
+	if (nsjconf->cgroup_cpu_mount == NULL) {
+		nsjconf->cgroup_cpu_mount = (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+		    ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpuacct";
+	}
+
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s/cgroup.controllers", nsjconf->cgroup_cpu_mount);
+	cgroupCpuV2 = (access(fname, F_OK) == 0);
+
+	char parent[PATH_MAX];
+	snprintf(parent, sizeof(parent), "%s/%s", nsjconf->cgroup_cpu_mount,
+		 nsjconf->cgroup_cpu_parent);
+	snprintf(fname, sizeof(fname), "%s/%s", parent,
+		 cgroupCpuV2 ? "cpu.stat" : "cpuacct.usage");
+	if (access(fname, R_OK) == -1) {
+		PLOG_E("'%s' is not readable, is '%s' an existing %s cgroup?", fname, parent,
+		       cgroupCpuV2 ? "v2" : "cpuacct");
+		return false;
+	}
+	return true;
+}
+
+bool cgroupInit(struct nsjconf_t * nsjconf)
+{
+	if (cgroupInitCpu(nsjconf) == false) {
+		return false;
+	}
+	if (nsjconf->cgroup_kill == false) {
+		return true;
+	}
+	if (nsjconf->cgroup_kill_mount == NULL) {
+		nsjconf->cgroup_kill_mount = (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+		    ? "/sys/fs/cgroup" : "/sys/fs/cgroup/freezer";
+	}
+
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s/cgroup.controllers", nsjconf->cgroup_kill_mount);
+	cgroupKillV2 = (access(fname, F_OK) == 0);
+
+	char parent[PATH_MAX];
+	snprintf(parent, sizeof(parent), "%s/%s", nsjconf->cgroup_kill_mount,
+		 nsjconf->cgroup_kill_parent);
+	if (access(parent, W_OK) == -1) {
+		PLOG_E("The kill cgroup parent '%s' must exist and be writable", parent);
+		return false;
+	}
+	if (cgroupKillV2) {
+		snprintf(fname, sizeof(fname), "%s/cgroup.kill", parent);
+		if (access(fname, F_OK) == -1) {
+			LOG_W("'%s' is missing (Linux < 5.14), jails will be frozen and killed process "
+			      "by process", fname);
+		}
+	} else {
+		snprintf(fname, sizeof(fname), "%s/freezer.state", parent);
+		if (access(fname, F_OK) == -1) {
+			LOG_W("'%s' is not a freezer cgroup, jails will be killed process by process "
+			      "without freezing them first", parent);
+		}
+	}
+	LOG_D("Jails will be tracked in cgroup %s '%s'", cgroupKillV2 ? "v2" : "v1", parent);
+
+	/*
+	 * A process belongs to a single cgroup in cgroup v2, moving the jail to a CPU accounting
+	 * cgroup elsewhere would take it out of its kill cgroup
+	 */
+	if (cgroupCpuEnabled(nsjconf) && cgroupKillV2 && cgroupCpuV2) {
+		char cpu_parent[PATH_MAX];
+		snprintf(cpu_parent, sizeof(cpu_parent), "%s/%s", nsjconf->cgroup_cpu_mount,
+			 nsjconf->cgroup_cpu_parent);
+		char kill_real[PATH_MAX];
+		char cpu_real[PATH_MAX];
+		if (realpath(parent, kill_real) == NULL || realpath(cpu_parent, cpu_real) == NULL
+		    || strcmp(kill_real, cpu_real) != 0) {
+			LOG_E("In cgroup v2, the CPU accounting cgroup parent '%s' "
+			      "(--cgroup_cpu_mount/--cgroup_cpu_parent) must be the same as the kill "
+			      "cgroup parent '%s' (--cgroup_kill_mount/--cgroup_kill_parent)",
+			      cpu_parent, parent);
+			return false;
+		}
+	}
+	return true;
+}
+
 bool cgroupInitNs(void)
 {
 	return true;
@@ -24,11 +24,17 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "common.h"
 
 bool cgroupInitNsFromParent(struct nsjconf_t * nsjconf, pid_t pid);
+bool cgroupInit(struct nsjconf_t *nsjconf);
 bool cgroupInitNs(void);
+bool cgroupKill(struct nsjconf_t *nsjconf, pid_t pid);
+bool cgroupRename(struct nsjconf_t *nsjconf, pid_t from, pid_t to);
+bool cgroupCpuUsage(struct nsjconf_t *nsjconf, pid_t pid, uint64_t * usec);
 void cgroupFinishFromParent(struct nsjconf_t *nsjconf, pid_t pid);
+bool cgroupDrain(struct nsjconf_t *nsjconf, pid_t pid);
 
 #endif				/* _CGROUP_H */
@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <grp.h>
+#include <linux/mempolicy.h>
 #include <limits.h>
 #include <pwd.h>
 #include <stdbool.h>
@@ -41,6 +42,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "admit.h"
+#include "cpu.h"
 #include "log.h"
 #include "util.h"
 
@@ -104,7 +107,7 @@ void cmdlineLogParams(struct nsjconf_t *nsjconf)
 	     "max_conns_per_ip:%u, uid:(ns:%u, global:%u), gid:(ns:%u, global:%u), time_limit:%ld, personality:%#lx, daemonize:%s, "
 	     "clone_newnet:%s, clone_newuser:%s, clone_newns:%s, clone_newpid:%s, "
 	     "clone_newipc:%s, clonew_newuts:%s, clone_newcgroup:%s, apply_sandbox:%s, keep_caps:%s, disable_no_new_privs:%s,"
-	     "tmpfs_size:%zu, pivot_root_only:%s",
+	     "tmpfs_size:%zu, pivot_root_only:%s, landlock:%s",
 	     nsjconf->hostname, nsjconf->chroot, nsjconf->argv[0], nsjconf->bindhost, nsjconf->port,
 	     nsjconf->max_conns_per_ip, nsjconf->inside_uid, nsjconf->outside_uid,
 	     nsjconf->inside_gid, nsjconf->outside_gid, nsjconf->tlimit, nsjconf->personality,
@@ -114,7 +117,7 @@ void cmdlineLogParams(struct nsjconf_t *nsjconf)
 	     logYesNo(nsjconf->clone_newuts), logYesNo(nsjconf->clone_newcgroup),
 	     logYesNo(nsjconf->apply_sandbox), logYesNo(nsjconf->keep_caps),
 	     logYesNo(nsjconf->disable_no_new_privs), nsjconf->tmpfs_size,
-	     logYesNo(nsjconf->pivot_root_only));
+	     logYesNo(nsjconf->pivot_root_only), logYesNo(nsjconf->landlock));
 
 	{
 		struct mounts_t *p;
@@ -266,6 +269,67 @@ static bool cmdlineParseGid(struct nsjconf_t *nsjconf, char *str)
 	return true;
 }
 
+static bool cmdlineParseNumaPolicy(struct nsjconf_t *nsjconf, const char *str)
+{
+	const struct {
+		const char *name;
+		int mode;
+	} policies[] = {
+		{"default", MPOL_DEFAULT},
+		{"bind", MPOL_BIND},
+		{"interleave", MPOL_INTERLEAVE},
+		{"preferred", MPOL_PREFERRED},
+		{"local", MPOL_LOCAL},
+	};
+	for (size_t i = 0; i < ARRAYSIZE(policies); i++) {
+		if (strcasecmp(str, policies[i].name) == 0) {
+			nsjconf->numa_policy = policies[i].mode;
+			return true;
+		}
+	}
+	LOG_E("Unknown NUMA policy '%s'", str);
+	return false;
+}
+
+/* Parses node lists in the format used by /sys/devices/system/node/online, e.g. '0-3,5' */
+static bool cmdlineParseNumaNodes(struct nsjconf_t *nsjconf, const char *str)
+{
+	const size_t max_node = sizeof(nsjconf->numa_nodes) * CHAR_BIT;
+	const size_t bits = sizeof(nsjconf->numa_nodes[0]) * CHAR_BIT;
+	memset(nsjconf->numa_nodes, '\0', sizeof(nsjconf->numa_nodes));
+
+	for (const char *s = str; *s;) {
+		char *end;
+		unsigned long lo = strtoul(s, &end, 10);
+		unsigned long hi = lo;
+		if (end == s) {
+			LOG_E("Invalid NUMA node list: '%s'", str);
+			return false;
+		}
+		if (*end == '-') {
+			s = end + 1;
+			hi = strtoul(s, &end, 10);
+			if (end == s) {
+				LOG_E("Invalid NUMA node list: '%s'", str);
+				return false;
+			}
+		}
+		if (hi < lo || hi >= max_node) {
+			LOG_E("Invalid NUMA node range %lu-%lu in '%s'", lo, hi, str);
+			return false;
+		}
+		for (unsigned long n = lo; n <= hi; n++) {
+			nsjconf->numa_nodes[n / bits] |= (1UL << (n % bits));
+		}
+		s = (*end == ',') ? end + 1 : end;
+		if (*end != ',' && *end != '\0') {
+			LOG_E("Invalid NUMA node list: '%s'", str);
+			return false;
+		}
+	}
+	return true;
+}
+
 bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 {
 	/*  *INDENT-OFF* */
@@ -279,8 +343,13 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		.daemonize = false,
 		.tlimit = 0,
 		.apply_sandbox = true,
+		.seccomp_policy = NULL,
+		.seccomp_prog = NULL,
+		.seccomp_learn = NULL,
 		.pivot_root_only = false,
 		.verbose = false,
+		.log_rate = 0,
+		.log_burst = 200,
 		.keep_caps = false,
 		.disable_no_new_privs = false,
 		.rl_as = 512 * (1024 * 1024),
@@ -298,25 +367,73 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		.clone_newipc = true,
 		.clone_newuts = true,
 		.clone_newcgroup = false,
+		.landlock = false,
+		.landlock_fd = -1,
 		.mode = MODE_STANDALONE_ONCE,
 		.is_root_rw = false,
 		.is_silent = false,
 		.skip_setsid = false,
+		.pty = false,
+		.session_grace = 0,
 		.inside_uid = getuid(),
 		.inside_gid = getgid(),
 		.outside_uid = getuid(),
 		.outside_gid = getgid(),
 		.max_conns_per_ip = 0,
+		.max_conns = 0,
+		.max_queued = 64,
+		.tenant_cur = NULL,
+		.envp = NULL,
+		.env_prebuilt = NULL,
+		.exit_cb = NULL,
+		.exit_cb_arg = NULL,
+		.cache_dir = NULL,
+		.cache_max_bytes = 256 * 1024 * 1024,
+		.warmup_wait = false,
+		.warmup_mlock_cnt = 0,
 		.tmpfs_size = 4 * (1024 * 1024),
 		.mount_proc = true,
+		.scratch_dir = NULL,
+		.scratch_mount = "/scratch",
+		.scratch_pool = 8,
+		.scratch_rm_rate = 0,
+		.scratch_quota_bytes = 0,
+		.scratch_quota_inodes = 0,
+		.scratch_quota_projid = 1000000,
 		.cgroup_mem_mount = "/sys/fs/cgroup/memory",
 		.cgroup_mem_parent = "NSJAIL",
 		.cgroup_mem_max = (size_t)0,
+		.cgroup_mem_soft = (size_t)0,
+		.cgroup_mem_swap_max = (size_t)0,
+		.cgroup_kill = false,
+		.cgroup_kill_mount = NULL,
+		.cgroup_kill_parent = "NSJAIL",
+		.cgroup_cpu_ms_max = 0,
+		.cgroup_cpu_mount = NULL,
+		.cgroup_cpu_parent = "NSJAIL",
+		.reap_interval_ms = 1000,
+		.perf = false,
+		.perf_ipc_min = 0.0,
+		.perf_ipc_max = 0.0,
+		.criu_dir = NULL,
+		.criu_bin = "criu",
+		.criu_ready_timeout = 60,
+		.disable_thp = false,
+		.numa_policy = -1,
+		.ksm = false,
+		.ksm_pages_to_scan = 0,
+		.ksm_sleep_ms = 0,
 		.iface_no_lo = false,
 		.iface = NULL,
 		.iface_vs_ip = "0.0.0.0",
 		.iface_vs_nm = "255.255.255.0",
 		.iface_vs_gw = "0.0.0.0",
+		.tls_cert = NULL,
+		.tls_key = NULL,
+		.tls_handshake_timeout = 5,
+		.reuseport = 0,
+		.cpu_locality = CPU_LOCALITY_NONE,
+		.tls_ctx = NULL,
 	};
 	/*  *INDENT-OFF* */
 
@@ -326,6 +443,9 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 	TAILQ_INIT(&nsjconf->open_fds);
 	TAILQ_INIT(&nsjconf->uid_mappings);
 	TAILQ_INIT(&nsjconf->gid_mappings);
+	TAILQ_INIT(&nsjconf->tenants);
+	TAILQ_INIT(&nsjconf->warmup);
+	TAILQ_INIT(&nsjconf->sysctls);
 
 	char *user = NULL;
 	char *group = NULL;
@@ -360,16 +480,30 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		{{"port", required_argument, NULL, 'p'}, "TCP port to bind to (enables MODE_LISTEN_TCP) (default: 0)"},
 		{{"bindhost", required_argument, NULL, 0x604}, "IP address port to bind to (only in [MODE_LISTEN_TCP]), '::ffff:127.0.0.1' for locahost (default: '::')"},
 		{{"max_conns_per_ip", required_argument, NULL, 'i'}, "Maximum number of connections per one IP (default: 0 (unlimited))"},
-		{{"log", required_argument, NULL, 'l'}, "Log file (default: /proc/self/fd/2)"},
+		{{"max_conns", required_argument, NULL, 0x0a01}, "Maximum number of jails running at once (only in [MODE_LISTEN_TCP]). Connections above it wait in per-tenant queues, and are admitted with weighted fair queueing (default: 0 (unlimited))"},
+		{{"max_queued", required_argument, NULL, 0x0a02}, "Maximum number of connections waiting for admission, per tenant (default: 64)"},
+		{{"warmup", required_argument, NULL, 0x0c01}, "File or directory (inside --chroot) whose files are read into the page cache by a background process at startup, and on SIGHUP in [MODE_LISTEN_TCP]. Can be specified multiple times"},
+		{{"warmup_mlock", required_argument, NULL, 0x0c02}, "Like --warmup, but the files are also mmap()ed and mlock()ed for as long as nsjail runs. Can be specified multiple times"},
+		{{"warmup_wait", no_argument, NULL, 0x0c03}, "Don't start new jails until the warmup is finished. In [MODE_LISTEN_TCP] connections are accepted and queued in the meantime"},
+		{{"cache_dir", required_argument, NULL, 0x0b01}, "Memoize results of deterministic jobs in this directory (only in [MODE_STANDALONE_ONCE]). The result (stdout, stderr, exit status) is keyed by a hash of the nsjail command-line, the environment, the binary's inode/size/timestamps and the stdin payload, and is replayed without spawning a jail on a hit. Output is written to the console once the job finishes (default: none)"},
+		{{"cache_max_bytes", required_argument, NULL, 0x0b02}, "Maximum size of --cache_dir, least recently used results are evicted above it (default: 268435456, 0 - unlimited)"},
+		{{"tenant", required_argument, NULL, 0x0a03}, "Tenant for admission, in the NAME=PREFIX[/LEN][:WEIGHT[:MAX_CONNS]] format, e.g. 'acme=10.1.0.0/16:4:20'. Connections are assigned to the first tenant whose prefix matches the remote address, or to the 'default' tenant (weight: 1, max_conns: unlimited). Can be specified multiple times"},
+		{{"log", required_argument, NULL, 'l'}, "Log file, or 'journald[:SOCKET]' (the journald native protocol, default socket: '/run/systemd/journal/socket') or 'syslog[:SOCKET]' (RFC 5424, default socket: '/dev/log'), where messages are sent in batches, without blocking nsjail (those which don't fit into the socket's queue are dropped), with the jail ID, PID, remote address and phase as structured fields (default: /proc/self/fd/2)"},
 		{{"time_limit", required_argument, NULL, 't'}, "Maximum time that a jail can exist, in seconds (default: 600)"},
 		{{"daemon", no_argument, NULL, 'd'}, "Daemonize after start"},
 		{{"verbose", no_argument, NULL, 'v'}, "Verbose output"},
+		{{"log_rate", required_argument, NULL, 0x0508}, "Maximum number of messages per second logged from each place in the code, above it messages are dropped and counted (see SIGUSR1). Identical consecutive messages are always logged once, with a 'repeated N times' summary (default: 0 - unlimited). The exit and accounting messages of jails are never dropped"},
+		{{"log_burst", required_argument, NULL, 0x0509}, "Number of messages which can be logged at once from each place in the code, before --log_rate applies (default: 200)"},
 		{{"keep_env", no_argument, NULL, 'e'}, "Should all environment variables be passed to the child?"},
-		{{"env", required_argument, NULL, 'E'}, "Environment variable (can be used multiple times)"},
+		{{"env", required_argument, NULL, 'E'}, "Environment variable (can be used multiple times). JAIL_ID, and for connections REMOTE_ADDR, REMOTE_PORT and LOCAL_PORT, are always set"},
 		{{"keep_caps", no_argument, NULL, 0x0501}, "Don't drop capabilities (DANGEROUS)"},
 		{{"silent", no_argument, NULL, 0x0502}, "Redirect child's fd:0/1/2 to /dev/null"},
 		{{"disable_sandbox", no_argument, NULL, 0x0503}, "Don't enable the seccomp-bpf sandboxing"},
+		{{"seccomp_policy", required_argument, NULL, 0x050a}, "Text file with the seccomp-bpf policy, used instead of the built-in one, with rules like 'ALLOW read, write', 'ERRNO(1) socket if arg0 == 16' and 'DEFAULT KILL' (see policy.c) (default: none)"},
+		{{"seccomp_learn", required_argument, NULL, 0x050b}, "Learning mode: record the syscalls made by jails (through a seccomp user-notification filter which allows everything), accumulated across runs in this file, and write a minimal policy for --seccomp_policy to FILE.policy after every run (default: none)"},
 		{{"skip_setsid", no_argument, NULL, 0x0504}, "Don't call setsid(), allows for terminal signal handling in the sandboxed process"},
+		{{"session_grace", required_argument, NULL, 0x050d}, "[MODE_LISTEN_TCP] Resumable sessions: the jail talks to a relay in nsjail instead of to the connection, the client gets a session token, and can resume the session with it on a new connection for this many seconds after the previous one is gone (default: 0, disabled). See README.md for the protocol"},
+		{{"pty", no_argument, NULL, 0x050c}, "Give the jail a pseudo-terminal (in a new devpts instance, mounted at /dev/pts) as its fd:0/1/2 and controlling terminal, relayed by nsjail to the connection (or to nsjail's own fd:0/1)"},
 		{{"pass_fd", required_argument, NULL, 0x0505}, "Don't close this FD before executing child (can be specified multiple times), by default: 0/1/2 are kept open"},
 		{{"pivot_root_only", no_argument, NULL, 0x0506}, "Only perform pivot_root, no chroot. This will enable nested namespaces"},
 		{{"disable_no_new_privs", no_argument, NULL, 0x0507}, "Don't set the prctl(NO_NEW_PRIVS, 1) (DANGEROUS)"},
@@ -392,6 +526,7 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		{{"disable_clone_newipc", no_argument, NULL, 0x0405}, "Don't use CLONE_NEWIPC"},
 		{{"disable_clone_newuts", no_argument, NULL, 0x0406}, "Don't use CLONE_NEWUTS"},
 		{{"enable_clone_newcgroup", no_argument, NULL, 0x0407}, "Use CLONE_NEWCGROUP"},
+		{{"sysctl", required_argument, NULL, 0x0408}, "Set a sysctl in the jail's new namespaces, in the 'name=value' form (e.g. 'net.core.somaxconn=1024'). Only namespaced ones are supported: net.* (requires CLONE_NEWNET), and kernel.shm*, kernel.msg*, kernel.sem, fs.mqueue.* (require CLONE_NEWIPC). Can be specified multiple times"},
 		{{"uid_mapping", required_argument, NULL, 'U'}, "Add a custom uid mapping of the form inside_uid:outside_uid:count. Setting this requires newuidmap to be present"},
 		{{"gid_mapping", required_argument, NULL, 'G'}, "Add a custom gid mapping of the form inside_gid:outside_gid:count. Setting this requires newuidmap to be present"},
 		{{"bindmount_ro", required_argument, NULL, 'R'}, "List of mountpoints to be mounted --bind (ro) inside the container. Can be specified multiple times. Supports 'source' syntax, or 'source:dest'"},
@@ -399,14 +534,47 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		{{"tmpfsmount", required_argument, NULL, 'T'}, "List of mountpoints to be mounted as RW/tmpfs inside the container. Can be specified multiple times. Supports 'dest' syntax"},
 		{{"tmpfs_size", required_argument, NULL, 0x0602}, "Number of bytes to allocate for tmpfsmounts (default: 4194304)"},
 		{{"disable_proc", no_argument, NULL, 0x0603}, "Disable mounting /proc in the jail"},
+		{{"scratch_dir", required_argument, NULL, 0x0606}, "Directory in which per-jail scratch directories are managed. Every jail gets a fresh, empty directory bind-mounted (RW) at --scratch_mount, which is removed in the background after the jail exits (default: none)"},
+		{{"scratch_mount", required_argument, NULL, 0x0607}, "Where to mount the scratch directory inside the jail (default: '/scratch')"},
+		{{"scratch_pool", required_argument, NULL, 0x0608}, "Number of pre-made scratch directories to keep ready (default: 8)"},
+		{{"scratch_rm_rate", required_argument, NULL, 0x0609}, "Maximum number of files per second removed from finished jails' scratch directories (default: 0 - unlimited)"},
+		{{"scratch_quota_bytes", required_argument, NULL, 0x060a}, "Project quota (in bytes) for each scratch directory. Requires a file-system mounted with 'prjquota' (default: 0 - disabled)"},
+		{{"scratch_quota_inodes", required_argument, NULL, 0x060b}, "Project quota (number of inodes) for each scratch directory (default: 0 - disabled)"},
+		{{"scratch_quota_projid", required_argument, NULL, 0x060c}, "First project ID to use for scratch directory quotas. IDs are assigned sequentially from a range of 2^20 (default: 1000000)"},
+		{{"landlock", no_argument, NULL, 0x0605}, "Don't use CLONE_NEWNS, confine the file-system access with a Landlock ruleset built from --bindmount/--bindmount_ro instead. Paths are not remapped ('source' syntax only), and --chroot/--tmpfsmount are not supported"},
 		{{"cgroup_mem_max", required_argument, NULL, 0x0801}, "Maximum number of bytes to use in the group (default: '0' - disabled)"},
 		{{"cgroup_mem_mount", required_argument, NULL, 0x0802}, "Location of memory cgroup FS (default: '/sys/fs/cgroup/memory')"},
 		{{"cgroup_mem_parent", required_argument, NULL, 0x0803}, "Which pre-existing memory cgroup to use as a parent (default: 'NSJAIL')"},
+		{{"ksm", no_argument, NULL, 0x0901}, "Make jails' memory eligible for kernel same-page merging (PR_SET_MEMORY_MERGE). Requires Linux >= 6.7 and CAP_SYS_RESOURCE"},
+		{{"ksm_pages_to_scan", required_argument, NULL, 0x0902}, "Set /sys/kernel/mm/ksm/pages_to_scan, and start KSM (default: 0 - don't change)"},
+		{{"ksm_sleep_ms", required_argument, NULL, 0x0903}, "Set /sys/kernel/mm/ksm/sleep_millisecs, and start KSM (default: 0 - don't change)"},
+		{{"cgroup_mem_soft", required_argument, NULL, 0x0804}, "Soft limit (memory.soft_limit_in_bytes) of the memory group, the group is reclaimed down to it under memory pressure (default: '0' - disabled)"},
+		{{"cgroup_mem_swap_max", required_argument, NULL, 0x0805}, "Maximum number of bytes of swap to use in the group, on top of --cgroup_mem_max (default: '0' - don't change)"},
+		{{"cgroup_kill", no_argument, NULL, 0x0806}, "Put every jail in its own cgroup, and kill all of its processes (also those which left its process group or PID namespace) when the jail is killed or its main process exits. Uses cgroup.kill in cgroup v2, or the freezer in cgroup v1"},
+		{{"cgroup_kill_mount", required_argument, NULL, 0x0807}, "Location of the cgroup FS for --cgroup_kill (default: '/sys/fs/cgroup' if it's cgroup v2, otherwise '/sys/fs/cgroup/freezer')"},
+		{{"cgroup_kill_parent", required_argument, NULL, 0x0808}, "Which pre-existing cgroup to use as a parent for --cgroup_kill (default: 'NSJAIL')"},
+		{{"cgroup_cpu_ms_max", required_argument, NULL, 0x0809}, "CPU time (user + system, in milliseconds) which all processes of a jail can use together, measured with cgroup CPU accounting. Unlike --rlimit_cpu, it can't be evaded by forking. The jail is killed once it's exceeded, and nsjail reports it with the exit status of 100 + SIGXCPU (default: '0' - disabled)"},
+		{{"cgroup_cpu_mount", required_argument, NULL, 0x080a}, "Location of the cgroup FS for --cgroup_cpu_ms_max (default: '/sys/fs/cgroup' if it's cgroup v2, otherwise '/sys/fs/cgroup/cpuacct')"},
+		{{"cgroup_cpu_parent", required_argument, NULL, 0x080b}, "Which pre-existing cgroup to use as a parent for --cgroup_cpu_ms_max. In cgroup v2 with --cgroup_kill, it must be the same as the --cgroup_kill one (default: 'NSJAIL')"},
+		{{"perf", no_argument, NULL, 0x0d01}, "Count instructions, cycles, cache misses and context switches of every jail (one perf_event group, inherited by all processes of the jail), and add them to its exit record. Falls back to software counters if there's no hardware PMU. Requires CAP_PERFMON or kernel.perf_event_paranoid <= 1"},
+		{{"perf_ipc_min", required_argument, NULL, 0x0d02}, "With --perf, warn about jails whose instructions per cycle over a sampling interval drop below this, e.g. memory thrashers (default: 0 - disabled)"},
+		{{"perf_ipc_max", required_argument, NULL, 0x0d03}, "With --perf, warn about jails whose instructions per cycle over a sampling interval exceed this, e.g. tight compute loops (default: 0 - disabled)"},
+		{{"criu_dir", required_argument, NULL, 0x0e01}, "Warm start: checkpoint a template jail with CRIU once it has signaled readiness (by writing a byte to, or closing, the fd in $NSJAIL_READY_FD), keeping the image in this directory (preferably on tmpfs), and restore all later jails from it instead of executing the command (default: none)"},
+		{{"criu_bin", required_argument, NULL, 0x0e02}, "Path to the CRIU binary (default: 'criu')"},
+		{{"criu_ready_timeout", required_argument, NULL, 0x0e03}, "How long the template jail can take to signal readiness, in seconds (default: 60)"},
+		{{"disable_thp", no_argument, NULL, 0x0904}, "Disable transparent huge pages for the jail (PR_SET_THP_DISABLE)"},
+		{{"numa_policy", required_argument, NULL, 0x0905}, "NUMA memory policy of the jail: 'default', 'bind', 'interleave', 'preferred' or 'local' (default: inherited)"},
+		{{"numa_nodes", required_argument, NULL, 0x0906}, "List of NUMA nodes for --numa_policy, e.g. '0-1,3' (required with 'bind', 'interleave' and 'preferred', and only used with them)"},
 		{{"iface_no_lo", no_argument, NULL, 0x700}, "Don't bring up the 'lo' interface"},
 		{{"iface", required_argument, NULL, 'I'}, "Interface which will be cloned (MACVLAN) and put inside the subprocess' namespace as 'vs'"},
 		{{"iface_vs_ip", required_argument, NULL, 0x701}, "IP of the 'vs' interface"},
 		{{"iface_vs_nm", required_argument, NULL, 0x702}, "Netmask of the 'vs' interface"},
 		{{"iface_vs_gw", required_argument, NULL, 0x703}, "Default GW for the 'vs' interface"},
+		{{"tls_cert", required_argument, NULL, 0x0704}, "Terminate TLS in the supervisor (only in [MODE_LISTEN_TCP]), with this PEM certificate chain. The handshake is done outside of the jail, and the jail gets the connection with kernel TLS (kTLS) enabled, so it reads/writes plaintext. Requires OpenSSL at build time and the 'tls' kernel module (default: none)"},
+		{{"tls_key", required_argument, NULL, 0x0705}, "PEM private key for --tls_cert (default: same file as --tls_cert)"},
+		{{"tls_handshake_timeout", required_argument, NULL, 0x0706}, "Maximum time (in seconds) the supervisor waits for a TLS handshake to complete (default: 5)"},
+		{{"reuseport", required_argument, NULL, 0x0707}, "Bind the listening socket with SO_REUSEPORT, so this many nsjail instances can share --port. With a value > 1, connections are steered (with a cBPF program) to the instance with index (receiving CPU %% value), where the index is the order in which instances were started. Pin each instance to its CPUs to keep connections on the CPU that received them (default: 0 (disabled))"},
+		{{"cpu_locality", required_argument, NULL, 0x0708}, "Set the CPU affinity of new jails to CPUs close to the one which received their connection (SO_INCOMING_CPU): 'none', 'cpu' (that CPU only), 'core' (its SMT siblings), 'llc' (CPUs sharing its last-level cache) (default: none)"},
 		{{0, 0, 0, 0}, NULL},
 	};
         /*  *INDENT-ON* */
@@ -443,6 +611,38 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 'i':
 			nsjconf->max_conns_per_ip = strtoul(optarg, NULL, 0);
 			break;
+		case 0xa01:
+			nsjconf->max_conns = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0xa02:
+			nsjconf->max_queued = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0xc01:
+		case 0xc02:
+			{
+				struct warmup_t *p = utilMalloc(sizeof(struct warmup_t));
+				p->path = optarg;
+				p->mlock = (c == 0xc02);
+				if (p->mlock) {
+					nsjconf->warmup_mlock_cnt++;
+				}
+				TAILQ_INSERT_TAIL(&nsjconf->warmup, p, pointers);
+			}
+			break;
+		case 0xc03:
+			nsjconf->warmup_wait = true;
+			break;
+		case 0xb01:
+			nsjconf->cache_dir = optarg;
+			break;
+		case 0xb02:
+			nsjconf->cache_max_bytes = strtoull(optarg, NULL, 0);
+			break;
+		case 0xa03:
+			if (admitAddTenant(nsjconf, optarg) == false) {
+				return false;
+			}
+			break;
 		case 'u':
 			user = optarg;
 			break;
@@ -525,6 +725,22 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x0407:
 			nsjconf->clone_newcgroup = true;
 			break;
+		case 0x0408:
+			{
+				char *eq = strchr(optarg, '=');
+				if (eq == NULL || eq == optarg) {
+					LOG_E("--sysctl must be in the 'name=value' form: '%s' provided",
+					      optarg);
+					return false;
+				}
+				*eq = '\0';
+				struct sysctl_t *p = utilMalloc(sizeof(struct sysctl_t));
+				p->name = optarg;
+				p->path = NULL;
+				p->value = eq + 1;
+				TAILQ_INSERT_TAIL(&nsjconf->sysctls, p, pointers);
+			}
+			break;
 		case 0x0501:
 			nsjconf->keep_caps = true;
 			break;
@@ -537,6 +753,12 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x0504:
 			nsjconf->skip_setsid = true;
 			break;
+		case 0x050c:
+			nsjconf->pty = true;
+			break;
+		case 0x050d:
+			nsjconf->session_grace = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
 		case 0x0505:
 			{
 				struct fds_t *f;
@@ -548,6 +770,18 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x0507:
 			nsjconf->disable_no_new_privs = true;
 			break;
+		case 0x050a:
+			nsjconf->seccomp_policy = optarg;
+			break;
+		case 0x050b:
+			nsjconf->seccomp_learn = optarg;
+			break;
+		case 0x0508:
+			nsjconf->log_rate = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x0509:
+			nsjconf->log_burst = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
 		case 0x0506:
 			nsjconf->pivot_root_only = true;
 			break;
@@ -562,6 +796,30 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x0603:
 			nsjconf->mount_proc = false;
 			break;
+		case 0x0605:
+			nsjconf->landlock = true;
+			break;
+		case 0x0606:
+			nsjconf->scratch_dir = optarg;
+			break;
+		case 0x0607:
+			nsjconf->scratch_mount = optarg;
+			break;
+		case 0x0608:
+			nsjconf->scratch_pool = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x0609:
+			nsjconf->scratch_rm_rate = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x060a:
+			nsjconf->scratch_quota_bytes = strtoull(optarg, NULL, 0);
+			break;
+		case 0x060b:
+			nsjconf->scratch_quota_inodes = strtoull(optarg, NULL, 0);
+			break;
+		case 0x060c:
+			nsjconf->scratch_quota_projid = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
 		case 'E':
 			{
 				struct charptr_t *p = utilMalloc(sizeof(struct charptr_t));
@@ -656,6 +914,23 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x703:
 			nsjconf->iface_vs_gw = optarg;
 			break;
+		case 0x704:
+			nsjconf->tls_cert = optarg;
+			break;
+		case 0x705:
+			nsjconf->tls_key = optarg;
+			break;
+		case 0x706:
+			nsjconf->tls_handshake_timeout = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x707:
+			nsjconf->reuseport = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x708:
+			if (cpuParseLocality(nsjconf, optarg) == false) {
+				return false;
+			}
+			break;
 		case 0x801:
 			nsjconf->cgroup_mem_max = (size_t) strtoull(optarg, NULL, 0);
 			break;
@@ -665,6 +940,70 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		case 0x803:
 			nsjconf->cgroup_mem_parent = optarg;
 			break;
+		case 0x804:
+			nsjconf->cgroup_mem_soft = (size_t) strtoull(optarg, NULL, 0);
+			break;
+		case 0x805:
+			nsjconf->cgroup_mem_swap_max = (size_t) strtoull(optarg, NULL, 0);
+			break;
+		case 0x806:
+			nsjconf->cgroup_kill = true;
+			break;
+		case 0x807:
+			nsjconf->cgroup_kill_mount = optarg;
+			break;
+		case 0x808:
+			nsjconf->cgroup_kill_parent = optarg;
+			break;
+		case 0x809:
+			nsjconf->cgroup_cpu_ms_max = strtoull(optarg, NULL, 0);
+			break;
+		case 0x80a:
+			nsjconf->cgroup_cpu_mount = optarg;
+			break;
+		case 0x80b:
+			nsjconf->cgroup_cpu_parent = optarg;
+			break;
+		case 0xd01:
+			nsjconf->perf = true;
+			break;
+		case 0xd02:
+			nsjconf->perf_ipc_min = strtod(optarg, NULL);
+			break;
+		case 0xd03:
+			nsjconf->perf_ipc_max = strtod(optarg, NULL);
+			break;
+		case 0xe01:
+			nsjconf->criu_dir = optarg;
+			break;
+		case 0xe02:
+			nsjconf->criu_bin = optarg;
+			break;
+		case 0xe03:
+			nsjconf->criu_ready_timeout = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x901:
+			nsjconf->ksm = true;
+			break;
+		case 0x902:
+			nsjconf->ksm_pages_to_scan = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x903:
+			nsjconf->ksm_sleep_ms = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 0x904:
+			nsjconf->disable_thp = true;
+			break;
+		case 0x905:
+			if (cmdlineParseNumaPolicy(nsjconf, optarg) == false) {
+				return false;
+			}
+			break;
+		case 0x906:
+			if (cmdlineParseNumaNodes(nsjconf, optarg) == false) {
+				return false;
+			}
+			break;
 		default:
 			cmdlineUsage(argv[0], custom_opts);
 			return false;
@@ -672,6 +1011,146 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		}
 	}
 
+	if (nsjconf->cgroup_mem_swap_max != (size_t) 0 && nsjconf->cgroup_mem_max == (size_t) 0) {
+		LOG_E("--cgroup_mem_swap_max requires --cgroup_mem_max");
+		return false;
+	}
+
+	{
+		struct warmup_t *p;
+		TAILQ_FOREACH(p, &nsjconf->warmup, pointers) {
+			if (p->path[0] != '/') {
+				LOG_E("--warmup paths must be absolute: '%s' provided", p->path);
+				return false;
+			}
+		}
+	}
+
+	if (nsjconf->seccomp_policy != NULL && nsjconf->apply_sandbox == false) {
+		LOG_E("--seccomp_policy cannot be used together with --disable_sandbox");
+		return false;
+	}
+	if (nsjconf->seccomp_learn != NULL) {
+		if (nsjconf->seccomp_policy != NULL || nsjconf->apply_sandbox == false) {
+			LOG_E("--seccomp_learn cannot be used together with --seccomp_policy or "
+			      "--disable_sandbox");
+			return false;
+		}
+		if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
+			LOG_E("--seccomp_learn cannot be used in [MODE_STANDALONE_EXECVE]");
+			return false;
+		}
+	}
+
+	if (nsjconf->pty == true) {
+		if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
+			LOG_E("--pty cannot be used in [MODE_STANDALONE_EXECVE]");
+			return false;
+		}
+		/* The jail's terminal needs a session of its own */
+		if (nsjconf->skip_setsid == true || nsjconf->is_silent == true) {
+			LOG_E("--pty cannot be used together with --skip_setsid or --silent");
+			return false;
+		}
+	}
+
+	/* Otherwise set_mempolicy() would only fail with EINVAL in every jail */
+	bool numa_nodes = false;
+	for (size_t i = 0; i < ARRAYSIZE(nsjconf->numa_nodes); i++) {
+		numa_nodes |= (nsjconf->numa_nodes[i] != 0);
+	}
+	bool numa_needs_nodes = (nsjconf->numa_policy == MPOL_BIND
+				 || nsjconf->numa_policy == MPOL_INTERLEAVE
+				 || nsjconf->numa_policy == MPOL_PREFERRED);
+	if (numa_needs_nodes == true && numa_nodes == false) {
+		LOG_E("--numa_policy bind, interleave and preferred require --numa_nodes");
+		return false;
+	}
+	if (numa_needs_nodes == false && numa_nodes == true) {
+		LOG_E("--numa_nodes requires --numa_policy bind, interleave or preferred");
+		return false;
+	}
+
+	if (nsjconf->session_grace > 0 && nsjconf->mode != MODE_LISTEN_TCP) {
+		LOG_E("--session_grace can only be used in [MODE_LISTEN_TCP]");
+		return false;
+	}
+
+	if (nsjconf->criu_dir != NULL) {
+		if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
+			LOG_E("--criu_dir cannot be used in [MODE_STANDALONE_EXECVE]");
+			return false;
+		}
+		/* CRIU restores the same PIDs, which must not collide between jails */
+		if (nsjconf->clone_newpid == false) {
+			LOG_E("--criu_dir requires a PID namespace");
+			return false;
+		}
+		if (nsjconf->scratch_dir != NULL || nsjconf->iface != NULL
+		    || nsjconf->seccomp_learn != NULL || nsjconf->pty == true
+		    || nsjconf->session_grace > 0) {
+			LOG_E("--criu_dir cannot be used together with --scratch_dir, --iface, "
+			      "--seccomp_learn, --pty or --session_grace");
+			return false;
+		}
+	}
+
+	if (nsjconf->cache_dir != NULL) {
+		if (nsjconf->mode != MODE_STANDALONE_ONCE) {
+			LOG_E("--cache_dir can only be used in [MODE_STANDALONE_ONCE]");
+			return false;
+		}
+		if (nsjconf->cache_dir[0] != '/') {
+			LOG_E("--cache_dir must be an absolute path: '%s' provided", nsjconf->cache_dir);
+			return false;
+		}
+	}
+
+	if (admitAddTenant(nsjconf, "default=::/0") == false) {
+		return false;
+	}
+
+	if (nsjconf->tls_cert != NULL) {
+		if (nsjconf->mode != MODE_LISTEN_TCP) {
+			LOG_E("--tls_cert can only be used in [MODE_LISTEN_TCP]");
+			return false;
+		}
+		if (nsjconf->tls_key == NULL) {
+			nsjconf->tls_key = nsjconf->tls_cert;
+		}
+	} else if (nsjconf->tls_key != NULL) {
+		LOG_E("--tls_key requires --tls_cert");
+		return false;
+	}
+
+	if (nsjconf->landlock == true) {
+		if (nsjconf->chroot != NULL) {
+			LOG_E("--landlock cannot be used together with --chroot");
+			return false;
+		}
+		nsjconf->clone_newns = false;
+	}
+
+	if (nsjconf->scratch_dir != NULL) {
+		if (nsjconf->scratch_dir[0] != '/') {
+			LOG_E("--scratch_dir must be an absolute path: '%s' provided",
+			      nsjconf->scratch_dir);
+			return false;
+		}
+		if (nsjconf->mode == MODE_STANDALONE_EXECVE || nsjconf->landlock == true) {
+			LOG_E("--scratch_dir requires a supervising process and a mount namespace");
+			return false;
+		}
+		/* The source is updated with scratchAcquire() before each new jail is created */
+		struct mounts_t *p = utilMalloc(sizeof(struct mounts_t));
+		p->src = nsjconf->scratch_cur;
+		p->dst = nsjconf->scratch_mount;
+		p->flags = MS_BIND | MS_REC;
+		p->options = "";
+		p->fs_type = "";
+		TAILQ_INSERT_TAIL(&nsjconf->mountpts, p, pointers);
+	}
+
 	if (nsjconf->mount_proc == true) {
 		struct mounts_t *p = utilMalloc(sizeof(struct mounts_t));
 		p->src = NULL;
@@ -681,6 +1160,15 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 		p->fs_type = "proc";
 		TAILQ_INSERT_HEAD(&nsjconf->mountpts, p, pointers);
 	}
+	if (nsjconf->pty == true) {
+		struct mounts_t *p = utilMalloc(sizeof(struct mounts_t));
+		p->src = NULL;
+		p->dst = "/dev/pts";
+		p->flags = MS_NOSUID | MS_NOEXEC;
+		p->options = "newinstance,ptmxmode=0666,mode=0620";
+		p->fs_type = "devpts";
+		TAILQ_INSERT_TAIL(&nsjconf->mountpts, p, pointers);
+	}
 	if (nsjconf->chroot != NULL) {
 		struct mounts_t *p = utilMalloc(sizeof(struct mounts_t));
 		p->src = nsjconf->chroot;
@@ -717,6 +1205,7 @@ bool cmdlineParse(int argc, char *argv[], struct nsjconf_t * nsjconf)
 	}
 
 	nsjconf->argv = &argv[optind];
+	nsjconf->cmdline_argv = argv;
 	if (nsjconf->argv[0] == NULL) {
 		LOG_E("No command provided");
 		cmdlineUsage(argv[0], custom_opts);
@@ -25,8 +25,10 @@
 #include <limits.h>
 #include <netinet/ip6.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/queue.h>
 #include <sys/resource.h>
+#include <time.h>
 #include <sys/types.h>
 
 #define ARRAYSIZE(array) (sizeof(array) / sizeof(*array))
@@ -53,15 +55,60 @@ static void __attribute__ ((unused)) __clang_cleanup_func(void (^*dfunc) (void))
 #endif
 #endif
 
+struct tenant_t;
+
+/* Number of perf_event counters per jail */
+#define PERF_EVENTS 4
+
 struct pids_t {
 	pid_t pid;
+	unsigned int jail_id;
 	time_t start;
+	struct timespec start_mono;
 	char remote_txt[64];
 	struct sockaddr_in6 remote_addr;
 	int pid_syscall_fd;
+	char scratch[64];
+	unsigned int projid;
+	uint64_t quota_peak_bytes;
+	uint64_t quota_peak_inodes;
+	uint64_t ksm_peak_pages;
+	int64_t ksm_peak_profit;
+	struct tenant_t *tenant;
+	bool cpu_exceeded;
+	int perf_fds[PERF_EVENTS];
+	uint64_t perf_last[PERF_EVENTS];
+	bool perf_flagged;
+	/* The main process has exited, but other processes are left in the jail's kill cgroup */
+	time_t drain_since;
+	bool drain_warned;
 	 TAILQ_ENTRY(pids_t) pointers;
 };
 
+/* log2 buckets of the queue wait time in milliseconds: <1, <2, <4, ... */
+#define ADMIT_HIST_BUCKETS 16
+
+struct admitconn_t {
+	int fd;
+	struct timespec queued;
+	 TAILQ_ENTRY(admitconn_t) pointers;
+};
+
+struct tenant_t {
+	const char *name;
+	struct in6_addr prefix;
+	unsigned int prefix_len;
+	unsigned int weight;
+	unsigned int max_conns;
+	double vfinish;
+	unsigned int queued;
+	uint64_t admitted;
+	uint64_t dropped;
+	uint64_t wait_hist[ADMIT_HIST_BUCKETS];
+	 TAILQ_HEAD(admitconnlist, admitconn_t) conns;
+	 TAILQ_ENTRY(tenant_t) pointers;
+};
+
 struct mounts_t {
 	const char *src;
 	const char *dst;
@@ -78,6 +125,19 @@ struct mapping_t {
 	 TAILQ_ENTRY(mapping_t) pointers;
 };
 
+struct sysctl_t {
+	const char *name;
+	const char *path;
+	const char *value;
+	 TAILQ_ENTRY(sysctl_t) pointers;
+};
+
+struct warmup_t {
+	const char *path;
+	bool mlock;
+	 TAILQ_ENTRY(warmup_t) pointers;
+};
+
 struct fds_t {
 	int fd;
 	 TAILQ_ENTRY(fds_t) pointers;
@@ -90,6 +150,13 @@ enum ns_mode_t {
 	MODE_STANDALONE_RERUN
 };
 
+enum cpu_locality_t {
+	CPU_LOCALITY_NONE = 0,
+	CPU_LOCALITY_CPU,
+	CPU_LOCALITY_CORE,
+	CPU_LOCALITY_LLC
+};
+
 struct charptr_t {
 	char *val;
 	 TAILQ_ENTRY(charptr_t) pointers;
@@ -99,13 +166,19 @@ struct nsjconf_t {
 	const char *hostname;
 	const char *cwd;
 	char *const *argv;
+	char *const *cmdline_argv;
 	int port;
 	const char *bindhost;
 	bool daemonize;
 	time_t tlimit;
 	bool apply_sandbox;
+	const char *seccomp_policy;
+	struct sock_fprog *seccomp_prog;
+	const char *seccomp_learn;
 	bool pivot_root_only;
 	bool verbose;
+	unsigned int log_rate;
+	unsigned int log_burst;
 	bool keep_env;
 	bool keep_caps;
 	bool disable_no_new_privs;
@@ -124,32 +197,85 @@ struct nsjconf_t {
 	bool clone_newipc;
 	bool clone_newuts;
 	bool clone_newcgroup;
+	bool landlock;
+	int landlock_fd;
 	enum ns_mode_t mode;
 	const char *chroot;
 	bool is_root_rw;
 	bool is_silent;
 	bool skip_setsid;
+	bool pty;
+	unsigned int session_grace;
 	uid_t outside_uid;
 	gid_t outside_gid;
 	uid_t inside_uid;
 	gid_t inside_gid;
 	unsigned int max_conns_per_ip;
+	unsigned int max_conns;
+	unsigned int max_queued;
+	struct tenant_t *tenant_cur;
+	char *const *envp;
+	char **env_prebuilt;
+	void (*exit_cb) (pid_t pid, int status, void *arg);
+	void *exit_cb_arg;
+	const char *cache_dir;
+	uint64_t cache_max_bytes;
+	bool warmup_wait;
+	unsigned int warmup_mlock_cnt;
 	size_t tmpfs_size;
 	bool mount_proc;
+	const char *scratch_dir;
+	const char *scratch_mount;
+	unsigned int scratch_pool;
+	unsigned int scratch_rm_rate;
+	uint64_t scratch_quota_bytes;
+	uint64_t scratch_quota_inodes;
+	unsigned int scratch_quota_projid;
+	char scratch_cur[PATH_MAX];
 	bool iface_no_lo;
 	const char *iface;
 	const char *iface_vs_ip;
 	const char *iface_vs_nm;
 	const char *iface_vs_gw;
+	const char *tls_cert;
+	const char *tls_key;
+	unsigned int tls_handshake_timeout;
+	unsigned int reuseport;
+	enum cpu_locality_t cpu_locality;
+	void *tls_ctx;
 	const char *cgroup_mem_mount;
 	const char *cgroup_mem_parent;
 	size_t cgroup_mem_max;
+	size_t cgroup_mem_soft;
+	size_t cgroup_mem_swap_max;
+	bool cgroup_kill;
+	const char *cgroup_kill_mount;
+	const char *cgroup_kill_parent;
+	uint64_t cgroup_cpu_ms_max;
+	const char *cgroup_cpu_mount;
+	const char *cgroup_cpu_parent;
+	unsigned int reap_interval_ms;
+	bool perf;
+	double perf_ipc_min;
+	double perf_ipc_max;
+	const char *criu_dir;
+	const char *criu_bin;
+	unsigned int criu_ready_timeout;
+	bool disable_thp;
+	int numa_policy;
+	unsigned long numa_nodes[16];
+	bool ksm;
+	unsigned int ksm_pages_to_scan;
+	unsigned int ksm_sleep_ms;
 	 TAILQ_HEAD(envlist, charptr_t) envs;
 	 TAILQ_HEAD(pidslist, pids_t) pids;
 	 TAILQ_HEAD(mountptslist, mounts_t) mountpts;
 	 TAILQ_HEAD(fdslistt, fds_t) open_fds;
 	 TAILQ_HEAD(uidmaplistt, mapping_t) uid_mappings;
 	 TAILQ_HEAD(gidmaplistt, mapping_t) gid_mappings;
+	 TAILQ_HEAD(tenantlist, tenant_t) tenants;
+	 TAILQ_HEAD(warmuplist, warmup_t) warmup;
+	 TAILQ_HEAD(sysctllist, sysctl_t) sysctls;
 };
 
 #endif				/* NS_COMMON_H */
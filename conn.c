@@ -0,0 +1,230 @@
+/*
+
+   nsjail - connections being set up
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * Connections which have been accepted, but can't be handed over to a jail (or to the session
+ * they resume) yet: their TLS handshake (--tls_cert) isn't done, or the client hasn't sent its
+ * session line (--session_grace). They're polled with the ptys in the supervisor's main loop,
+ * and progress as the data arrives, so a slow client doesn't hold anything else up. The
+ * handshake has --tls_handshake_timeout to complete, and then the client has
+ * SESSION_HELLO_TIMEOUT_SEC to send its line.
+ */
+
+#include "conn.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admit.h"
+#include "log.h"
+#include "session.h"
+#include "tls.h"
+#include "util.h"
+
+/* Beyond that, new connections are rejected until some of the pending ones are done with */
+#define CONN_MAX_PENDING 256
+
+struct conn_t {
+	int fd;
+	/* While the TLS handshake is in progress */
+	void *ssl;
+	short events;
+	time_t deadline;
+	/* The session line, as far as it has been received */
+	char line[128];
+	size_t off;
+	 TAILQ_ENTRY(conn_t) pointers;
+};
+
+static TAILQ_HEAD(connq_t, conn_t) connPending = TAILQ_HEAD_INITIALIZER(connPending);
+static size_t connPendingCnt = 0;
+
+static bool connSetNonBlock(int fd, bool nonblock)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1) {
+		PLOG_W("fcntl(%d, F_GETFL)", fd);
+		return false;
+	}
+	flags = nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	if (fcntl(fd, F_SETFL, flags) == -1) {
+		PLOG_W("fcntl(%d, F_SETFL, %s)", fd, nonblock ? "O_NONBLOCK" : "~O_NONBLOCK");
+		return false;
+	}
+	return true;
+}
+
+/* The jail gets the socket as its stdio, and expects it to be blocking */
+static void connEnqueue(struct nsjconf_t *nsjconf, int fd)
+{
+	if (connSetNonBlock(fd, false) == false) {
+		close(fd);
+		return;
+	}
+	admitEnqueue(nsjconf, fd);
+}
+
+/* Returns false once the connection is done with: handed over, or closed */
+static bool connProgress(struct nsjconf_t *nsjconf, struct conn_t *c)
+{
+	if (c->ssl != NULL) {
+		int ret = tlsContinue(c->ssl, c->fd, &c->events);
+		if (ret == 0) {
+			return true;
+		}
+		c->ssl = NULL;
+		if (ret == -1) {
+			close(c->fd);
+			return false;
+		}
+		if (nsjconf->session_grace == 0) {
+			connEnqueue(nsjconf, c->fd);
+			return false;
+		}
+		/* The session line might have come with the end of the handshake */
+		c->events = POLLIN;
+		c->deadline = time(NULL) + SESSION_HELLO_TIMEOUT_SEC;
+	}
+
+	int ret = sessionReadLine(c->fd, c->line, sizeof(c->line), &c->off);
+	if (ret == 0) {
+		return true;
+	}
+	if (ret == -1) {
+		LOG_W("Couldn't read the session line from the connection");
+		close(c->fd);
+		return false;
+	}
+	if (sessionAccept(c->fd, c->line) == true) {
+		connEnqueue(nsjconf, c->fd);
+	} else {
+		close(c->fd);
+	}
+	return false;
+}
+
+/* Takes ownership of connfd, which is passed on to admitEnqueue() once it's set up */
+void connAdd(struct nsjconf_t *nsjconf, int connfd)
+{
+	if (nsjconf->session_grace == 0 && nsjconf->tls_ctx == NULL) {
+		admitEnqueue(nsjconf, connfd);
+		return;
+	}
+	if (connPendingCnt >= CONN_MAX_PENDING) {
+		LOG_W("Rejecting connection: %zu connections are being set up already",
+		      connPendingCnt);
+		close(connfd);
+		return;
+	}
+	if (connSetNonBlock(connfd, true) == false) {
+		close(connfd);
+		return;
+	}
+
+	void *ssl;
+	if (tlsStart(nsjconf, connfd, &ssl) == false) {
+		close(connfd);
+		return;
+	}
+
+	struct conn_t *c = utilMalloc(sizeof(struct conn_t));
+	c->fd = connfd;
+	c->ssl = ssl;
+	c->events = POLLIN;
+	c->deadline = time(NULL)
+	    + ((ssl != NULL) ? nsjconf->tls_handshake_timeout : SESSION_HELLO_TIMEOUT_SEC);
+	c->off = 0;
+	/* With TCP_DEFER_ACCEPT, the ClientHello or the session line has usually arrived by now */
+	if (connProgress(nsjconf, c) == false) {
+		free(c);
+		return;
+	}
+	TAILQ_INSERT_TAIL(&connPending, c, pointers);
+	connPendingCnt++;
+}
+
+size_t connCount(void)
+{
+	return connPendingCnt;
+}
+
+/* Fills connCount() entries of pfds */
+void connPollFds(struct pollfd *pfds)
+{
+	size_t i = 0;
+	struct conn_t *c;
+	TAILQ_FOREACH(c, &connPending, pointers) {
+		pfds[i].fd = c->fd;
+		pfds[i].events = c->events;
+		pfds[i].revents = 0;
+		i++;
+	}
+}
+
+/* How long poll() can wait before the earliest deadline, timeout_ms if that's sooner */
+int connTimeout(int timeout_ms)
+{
+	time_t now = time(NULL);
+	struct conn_t *c;
+	TAILQ_FOREACH(c, &connPending, pointers) {
+		int ms = (c->deadline > now) ? (int)(c->deadline - now) * 1000 : 0;
+		if (timeout_ms == -1 || ms < timeout_ms) {
+			timeout_ms = ms;
+		}
+	}
+	return timeout_ms;
+}
+
+/* Takes the results of poll() for the entries filled by connPollFds() */
+void connPump(struct nsjconf_t *nsjconf, const struct pollfd *pfds)
+{
+	time_t now = time(NULL);
+	size_t i = 0;
+	struct conn_t *c, *next;
+	for (c = TAILQ_FIRST(&connPending); c != NULL; c = next) {
+		next = TAILQ_NEXT(c, pointers);
+		bool pending = true;
+		if (pfds[i++].revents != 0) {
+			pending = connProgress(nsjconf, c);
+		}
+		if (pending == true && now >= c->deadline && c->ssl != NULL) {
+			LOG_W("TLS handshake timed out after %u seconds",
+			      nsjconf->tls_handshake_timeout);
+			tlsAbort(c->ssl);
+			close(c->fd);
+			pending = false;
+		}
+		if (pending == true && now >= c->deadline) {
+			LOG_W("No session line received from the connection in %d seconds",
+			      SESSION_HELLO_TIMEOUT_SEC);
+			close(c->fd);
+			pending = false;
+		}
+		if (pending == false) {
+			TAILQ_REMOVE(&connPending, c, pointers);
+			connPendingCnt--;
+			free(c);
+		}
+	}
+}
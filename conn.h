@@ -0,0 +1,37 @@
+/*
+
+   nsjail - connections being set up
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_CONN_H
+#define NS_CONN_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+void connAdd(struct nsjconf_t *nsjconf, int connfd);
+size_t connCount(void);
+void connPollFds(struct pollfd *pfds);
+int connTimeout(int timeout_ms);
+void connPump(struct nsjconf_t *nsjconf, const struct pollfd *pfds);
+
+#endif				/* NS_CONN_H */
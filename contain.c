@@ -27,6 +27,7 @@
 #include <grp.h>
 #include <inttypes.h>
 #include <linux/capability.h>
+#include <linux/mempolicy.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -47,6 +48,7 @@
 #include "mount.h"
 #include "net.h"
 #include "pid.h"
+#include "sysctl.h"
 #include "util.h"
 #include "uts.h"
 
@@ -65,6 +67,11 @@ static bool containInitUtsNs(struct nsjconf_t *nsjconf)
 	return utsInitNs(nsjconf);
 }
 
+static bool containInitSysctls(struct nsjconf_t *nsjconf)
+{
+	return sysctlInitNs(nsjconf);
+}
+
 static bool containInitCgroupNs(void)
 {
 	return cgroupInitNs();
@@ -141,6 +148,22 @@ static bool containPrepareEnv(struct nsjconf_t *nsjconf)
 		PLOG_E("personality(%lx)", nsjconf->personality);
 		return false;
 	}
+	if (nsjconf->disable_thp && prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) == -1) {
+		PLOG_E("prctl(PR_SET_THP_DISABLE, 1)");
+		return false;
+	}
+	if (nsjconf->numa_policy != -1) {
+		const unsigned long *nodes = nsjconf->numa_nodes;
+		unsigned long maxnode = sizeof(nsjconf->numa_nodes) * CHAR_BIT + 1;
+		if (nsjconf->numa_policy == MPOL_DEFAULT || nsjconf->numa_policy == MPOL_LOCAL) {
+			nodes = NULL;
+			maxnode = 0;
+		}
+		if (syscall(__NR_set_mempolicy, nsjconf->numa_policy, nodes, maxnode) == -1) {
+			PLOG_E("set_mempolicy(mode=%d)", nsjconf->numa_policy);
+			return false;
+		}
+	}
 	errno = 0;
 	if (setpriority(PRIO_PROCESS, 0, 19) == -1 && errno != 0) {
 		PLOG_W("setpriority(19)");
@@ -304,16 +327,16 @@ static bool containMakeFdsCOE(struct nsjconf_t *nsjconf)
 
 bool containSetupFD(struct nsjconf_t * nsjconf, int fd_in, int fd_out, int fd_err)
 {
-	if (nsjconf->mode != MODE_LISTEN_TCP) {
-		if (nsjconf->is_silent == false) {
-			return true;
-		}
+	if (nsjconf->mode != MODE_LISTEN_TCP && nsjconf->is_silent == true) {
 		if (TEMP_FAILURE_RETRY(fd_in = fd_out = fd_err = open("/dev/null", O_RDWR)) == -1) {
 			PLOG_E("open('/dev/null', O_RDWR)");
 			return false;
 		}
 	}
-	/* Set stdin/stdout/stderr to the net */
+	/*
+	 * Set stdin/stdout/stderr to the net, or to the fds passed by the caller in standalone
+	 * modes (dup2() is a no-op for fd:0/1/2)
+	 */
 	if (TEMP_FAILURE_RETRY(dup2(fd_in, STDIN_FILENO)) == -1) {
 		PLOG_E("dup2(%d, STDIN_FILENO)", fd_in);
 		return false;
@@ -343,6 +366,9 @@ bool containContain(struct nsjconf_t * nsjconf)
 	if (containInitUtsNs(nsjconf) == false) {
 		return false;
 	}
+	if (containInitSysctls(nsjconf) == false) {
+		return false;
+	}
 	if (containInitCgroupNs() == false) {
 		return false;
 	}
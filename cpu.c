@@ -0,0 +1,215 @@
+/*
+
+   nsjail - CPU locality of jails
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cpu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif				/* SO_INCOMING_CPU */
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+/* Affinity mask of jails whose connection was received by a given CPU, indexed by the CPU */
+static cpu_set_t *cpuGroups = NULL;
+static int cpuCnt = 0;
+
+static const char *cpuLocalityName(enum cpu_locality_t locality)
+{
+	switch (locality) {
+	case CPU_LOCALITY_NONE:
+		return "none";
+	case CPU_LOCALITY_CPU:
+		return "cpu";
+	case CPU_LOCALITY_CORE:
+		return "core";
+	case CPU_LOCALITY_LLC:
+		return "llc";
+	}
+	return "unknown";
+}
+
+bool cpuParseLocality(struct nsjconf_t * nsjconf, const char *str)
+{
+	static const enum cpu_locality_t localities[] = {
+		CPU_LOCALITY_NONE,
+		CPU_LOCALITY_CPU,
+		CPU_LOCALITY_CORE,
+		CPU_LOCALITY_LLC,
+	};
+	for (size_t i = 0; i < ARRAYSIZE(localities); i++) {
+		if (strcasecmp(str, cpuLocalityName(localities[i])) == 0) {
+			nsjconf->cpu_locality = localities[i];
+			return true;
+		}
+	}
+	LOG_E("Unknown --cpu_locality '%s', supported values: none, cpu, core, llc", str);
+	return false;
+}
+
+/* Parses the kernel's CPU list format, e.g. '0-3,8,10-11' */
+static bool cpuReadList(const char *fname, cpu_set_t * mask)
+{
+	if (access(fname, R_OK) == -1) {
+		return false;
+	}
+	char buf[4096];
+	ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+	if (sz <= 0) {
+		return false;
+	}
+	buf[sz] = '\0';
+
+	CPU_ZERO(mask);
+	char *saveptr;
+	for (char *tok = strtok_r(buf, ",\n", &saveptr); tok; tok = strtok_r(NULL, ",\n", &saveptr)) {
+		char *end;
+		unsigned long lo = strtoul(tok, &end, 10);
+		unsigned long hi = (*end == '-') ? strtoul(end + 1, NULL, 10) : lo;
+		for (unsigned long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu, mask);
+		}
+	}
+	return (CPU_COUNT(mask) > 0);
+}
+
+/* The last-level cache is the one with the highest 'level' among cache/indexN */
+static bool cpuReadLlc(int cpu, cpu_set_t * mask)
+{
+	char fname[PATH_MAX];
+	char buf[32];
+	int best_idx = -1;
+	long best_level = 0;
+	for (int idx = 0; idx < 16; idx++) {
+		snprintf(fname, sizeof(fname), "%s/cpu%d/cache/index%d/level", CPU_SYSFS, cpu, idx);
+		if (access(fname, R_OK) == -1) {
+			break;
+		}
+		ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+		if (sz <= 0) {
+			break;
+		}
+		buf[sz] = '\0';
+		long level = strtol(buf, NULL, 10);
+		if (level > best_level) {
+			best_level = level;
+			best_idx = idx;
+		}
+	}
+	if (best_idx == -1) {
+		return false;
+	}
+	snprintf(fname, sizeof(fname), "%s/cpu%d/cache/index%d/shared_cpu_list", CPU_SYSFS, cpu,
+		 best_idx);
+	return cpuReadList(fname, mask);
+}
+
+static bool cpuReadCore(int cpu, cpu_set_t * mask)
+{
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s/cpu%d/topology/thread_siblings_list", CPU_SYSFS, cpu);
+	return cpuReadList(fname, mask);
+}
+
+/*
+ * The topology is read once, as the groups are needed for every new jail. CPUs whose group
+ * can't be determined (e.g. sysfs is not mounted) keep a single-CPU group
+ */
+bool cpuInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->cpu_locality == CPU_LOCALITY_NONE) {
+		return true;
+	}
+
+	long cnt = sysconf(_SC_NPROCESSORS_CONF);
+	if (cnt <= 0) {
+		PLOG_E("sysconf(_SC_NPROCESSORS_CONF)");
+		return false;
+	}
+	cpuCnt = (cnt > CPU_SETSIZE) ? CPU_SETSIZE : (int)cnt;
+	cpuGroups = utilMalloc(sizeof(cpu_set_t) * cpuCnt);
+
+	size_t fallbacks = 0;
+	for (int cpu = 0; cpu < cpuCnt; cpu++) {
+		bool ok = true;
+		if (nsjconf->cpu_locality == CPU_LOCALITY_CORE) {
+			ok = cpuReadCore(cpu, &cpuGroups[cpu]);
+		} else if (nsjconf->cpu_locality == CPU_LOCALITY_LLC) {
+			ok = cpuReadLlc(cpu, &cpuGroups[cpu]);
+		}
+		if (ok == false || nsjconf->cpu_locality == CPU_LOCALITY_CPU) {
+			CPU_ZERO(&cpuGroups[cpu]);
+			CPU_SET(cpu, &cpuGroups[cpu]);
+			fallbacks += (ok == false);
+		}
+		LOG_D("CPU #%d: %s group of %d CPU(s)", cpu, cpuLocalityName(nsjconf->cpu_locality),
+		      CPU_COUNT(&cpuGroups[cpu]));
+	}
+	if (fallbacks > 0) {
+		LOG_W("Couldn't read the '%s' topology of %zu CPU(s) from '%s', their jails will be "
+		      "pinned to the receiving CPU only", cpuLocalityName(nsjconf->cpu_locality),
+		      fallbacks, CPU_SYSFS);
+	}
+	return true;
+}
+
+/*
+ * Called before the new process is allowed to continue. The affinity is taken from the CPU
+ * which processed the last packet of the connection in the softirq context, so the jail runs
+ * in the same cache domain as its network processing. Failures are not fatal, the jail simply
+ * runs wherever the scheduler puts it
+ */
+void cpuInitFromParent(struct nsjconf_t *nsjconf, pid_t pid, int sock)
+{
+	if (nsjconf->cpu_locality == CPU_LOCALITY_NONE) {
+		return;
+	}
+	int cpu = -1;
+	socklen_t len = sizeof(cpu);
+	if (getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1) {
+		/* Not a socket, e.g. in the standalone modes */
+		return;
+	}
+	if (cpu < 0 || cpu >= cpuCnt) {
+		LOG_D("PID: %d, incoming CPU of fd #%d is unknown (%d)", pid, sock, cpu);
+		return;
+	}
+	if (sched_setaffinity(pid, sizeof(cpu_set_t), &cpuGroups[cpu]) == -1) {
+		PLOG_W("sched_setaffinity(PID: %d, %s group of CPU #%d)", pid,
+		       cpuLocalityName(nsjconf->cpu_locality), cpu);
+		return;
+	}
+	LOG_D("PID: %d pinned to the %s group of CPU #%d (%d CPU(s))", pid,
+	      cpuLocalityName(nsjconf->cpu_locality), cpu, CPU_COUNT(&cpuGroups[cpu]));
+}
@@ -0,0 +1,350 @@
+/*
+
+   nsjail - checkpoint/restore of jails with CRIU
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * With --criu_dir, a template jail is started at startup, with pipes as stdin/stdout/stderr,
+ * and an fd (its number is in $NSJAIL_READY_FD) to which it writes a byte (or which it closes)
+ * once it has initialized. It's then checkpointed with 'criu dump' (which kills it), and every
+ * jail after that is restored from the image with 'criu restore', with the pipes replaced by
+ * the jail's stdin/stdout/stderr (--inherit-fd).
+ *
+ * The restored processes are children of nsjail (--restore-sibling), and start in the cgroups
+ * of the CRIU process, which are renamed after the restored PID. Jails fall back to a cold
+ * start if the restore fails.
+ */
+
+#include "criu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/magic.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+#include "env.h"
+#include "log.h"
+#include "subproc.h"
+#include "util.h"
+
+#define CRIU_READY_ENV "NSJAIL_READY_FD"
+
+static int criuReadyFd = -1;
+static struct fds_t *criuReadyPass = NULL;
+static char criuReadyEnv[64];
+static struct charptr_t criuReadyEnvPtr;
+
+static bool criuReady = false;
+/* Inodes of the template's stdin/stdout/stderr pipes, replaced on restore */
+static ino_t criuPipeIno[3];
+static long criuColdMs = 0;
+
+static long criuMsSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+/* Runs CRIU with the given stdin/stdout/stderr, optionally in the cgroups of a new jail */
+static pid_t criuExec(struct nsjconf_t *nsjconf, const char *const *argv, int fd_in,
+		      int fd_out, int fd_err, bool join_cgroups)
+{
+	pid_t pid = fork();
+	if (pid == -1) {
+		PLOG_E("fork()");
+		return -1;
+	}
+	if (pid != 0) {
+		return pid;
+	}
+
+	if (join_cgroups && cgroupInitNsFromParent(nsjconf, getpid()) == false) {
+		_exit(1);
+	}
+	if (fd_in != -1 && (dup2(fd_in, STDIN_FILENO) == -1 || dup2(fd_out, STDOUT_FILENO) == -1
+			    || dup2(fd_err, STDERR_FILENO) == -1)) {
+		PLOG_E("dup2()");
+		_exit(1);
+	}
+	execvp(argv[0], (char *const *)argv);
+	PLOG_E("execvp('%s')", argv[0]);
+	_exit(1);
+}
+
+static bool criuWait(pid_t pid, const char *what)
+{
+	int status;
+	if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1) {
+		PLOG_E("waitpid(%d)", (int)pid);
+		return false;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		return true;
+	}
+	LOG_E("'criu %s' failed (status: %#x)", what, status);
+	return false;
+}
+
+/*
+ * Called before envInit(), so the template gets $NSJAIL_READY_FD. The fd is reserved here, and
+ * replaced with the write end of the readiness pipe by criuCheckpoint()
+ */
+bool criuInit(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->criu_dir == NULL) {
+		return true;
+	}
+	if (mkdir(nsjconf->criu_dir, 0700) == -1 && errno != EEXIST) {
+		PLOG_E("mkdir('%s')", nsjconf->criu_dir);
+		return false;
+	}
+	struct statfs sfs;
+	if (statfs(nsjconf->criu_dir, &sfs) == -1) {
+		PLOG_E("statfs('%s')", nsjconf->criu_dir);
+		return false;
+	}
+	if (sfs.f_type != TMPFS_MAGIC) {
+		LOG_W("'%s' is not on tmpfs, restores will read the image from disk",
+		      nsjconf->criu_dir);
+	}
+
+	criuReadyFd = TEMP_FAILURE_RETRY(open("/dev/null", O_RDONLY | O_CLOEXEC));
+	if (criuReadyFd == -1) {
+		PLOG_E("open('/dev/null')");
+		return false;
+	}
+	criuReadyPass = utilMalloc(sizeof(struct fds_t));
+	criuReadyPass->fd = criuReadyFd;
+	TAILQ_INSERT_TAIL(&nsjconf->open_fds, criuReadyPass, pointers);
+	snprintf(criuReadyEnv, sizeof(criuReadyEnv), "%s=%d", CRIU_READY_ENV, criuReadyFd);
+	criuReadyEnvPtr.val = criuReadyEnv;
+	TAILQ_INSERT_TAIL(&nsjconf->envs, &criuReadyEnvPtr, pointers);
+	return true;
+}
+
+/* Discards the template's output, so it can't block on a full pipe */
+static void criuDrain(struct pollfd *pfd)
+{
+	char buf[4096];
+	if (pfd->revents & POLLIN) {
+		while (read(pfd->fd, buf, sizeof(buf)) > 0) ;
+	} else if (pfd->revents & (POLLHUP | POLLERR)) {
+		pfd->fd = -1;
+	}
+}
+
+static bool criuWaitReady(struct nsjconf_t *nsjconf, pid_t pid, int ready_fd, int out_fd,
+			  int err_fd)
+{
+	struct pollfd pfds[3] = {
+		{.fd = ready_fd,.events = POLLIN,.revents = 0},
+		{.fd = out_fd,.events = POLLIN,.revents = 0},
+		{.fd = err_fd,.events = POLLIN,.revents = 0},
+	};
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		if (poll(pfds, ARRAYSIZE(pfds), 100) == -1 && errno != EINTR) {
+			PLOG_E("poll()");
+			return false;
+		}
+		/* A byte, or EOF */
+		if (pfds[0].revents & (POLLIN | POLLHUP)) {
+			return true;
+		}
+		criuDrain(&pfds[1]);
+		criuDrain(&pfds[2]);
+
+		siginfo_t si = {.si_pid = 0 };
+		if (waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == 0 && si.si_pid != 0) {
+			LOG_E("The template jail (PID: %d) exited before signaling readiness via $%s",
+			      (int)pid, CRIU_READY_ENV);
+			return false;
+		}
+		if (criuMsSince(&start) > (long)nsjconf->criu_ready_timeout * 1000L) {
+			LOG_E("The template jail (PID: %d) didn't signal readiness via $%s in %u s",
+			      (int)pid, CRIU_READY_ENV, nsjconf->criu_ready_timeout);
+			return false;
+		}
+	}
+}
+
+/* The template is killed by 'criu dump', or here if anything failed */
+static void criuReapTemplate(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	for (int i = 0; subprocCount(nsjconf) > 0; i++) {
+		if (i == 100) {
+			kill(pid, SIGKILL);
+		}
+		subprocReap(nsjconf);
+		usleep(10000);
+	}
+}
+
+static bool criuDump(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	char pid_str[32];
+	snprintf(pid_str, sizeof(pid_str), "%d", (int)pid);
+	const char *argv[] = {
+		nsjconf->criu_bin, "dump", "--tree", pid_str, "--images-dir", nsjconf->criu_dir,
+		"--log-file", "dump.log", "--shell-job", "--ext-mount-map", "auto",
+		"--manage-cgroups=ignore", NULL,
+	};
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t cpid = criuExec(nsjconf, argv, -1, -1, -1, false);
+	if (cpid == -1 || criuWait(cpid, "dump") == false) {
+		LOG_E("Couldn't checkpoint the template jail, see '%s/dump.log'",
+		      nsjconf->criu_dir);
+		return false;
+	}
+	long ms = criuMsSince(&start);
+	LOG_I("Template jail checkpointed to '%s' in %ld.%03ld s (cold start: %ld.%03ld s)",
+	      nsjconf->criu_dir, ms / 1000, ms % 1000, criuColdMs / 1000, criuColdMs % 1000);
+	return true;
+}
+
+/* Starts the template jail, waits until it's ready, and checkpoints it */
+bool criuCheckpoint(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->criu_dir == NULL) {
+		return true;
+	}
+
+	int ready[2], in[2], out[2], err[2];
+	if (pipe2(ready, O_CLOEXEC) == -1 || pipe2(in, O_CLOEXEC) == -1
+	    || pipe2(out, O_CLOEXEC | O_NONBLOCK) == -1
+	    || pipe2(err, O_CLOEXEC | O_NONBLOCK) == -1) {
+		PLOG_E("pipe2()");
+		return false;
+	}
+	if (dup3(ready[1], criuReadyFd, O_CLOEXEC) == -1) {
+		PLOG_E("dup3(%d, %d)", ready[1], criuReadyFd);
+		return false;
+	}
+	close(ready[1]);
+	struct stat st;
+	for (int i = 0; i < 3; i++) {
+		int fd = (i == 0) ? in[0] : ((i == 1) ? out[1] : err[1]);
+		if (fstat(fd, &st) == -1) {
+			PLOG_E("fstat(%d)", fd);
+			return false;
+		}
+		criuPipeIno[i] = st.st_ino;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = subprocRunChild(nsjconf, in[0], out[1], err[1]);
+	close(in[0]);
+	close(out[1]);
+	close(err[1]);
+
+	/* Later jails (if cold-started) must not get the fd, nor whatever reuses its number */
+	close(criuReadyFd);
+	TAILQ_REMOVE(&nsjconf->open_fds, criuReadyPass, pointers);
+	free(criuReadyPass);
+	criuReadyPass = NULL;
+	TAILQ_REMOVE(&nsjconf->envs, &criuReadyEnvPtr, pointers);
+	envInit(nsjconf);
+
+	bool ret = false;
+	if (pid != -1 && criuWaitReady(nsjconf, pid, ready[0], out[0], err[0]) == true) {
+		criuColdMs = criuMsSince(&start);
+		ret = criuDump(nsjconf, pid);
+	}
+	if (pid != -1) {
+		criuReapTemplate(nsjconf, pid);
+	}
+	close(ready[0]);
+	close(in[1]);
+	close(out[0]);
+	close(err[0]);
+	criuReady = ret;
+	return ret;
+}
+
+/* Returns -1 if the jail should be cold-started instead */
+pid_t criuRestore(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err)
+{
+	if (criuReady == false) {
+		return -1;
+	}
+
+	char pidfile[PATH_MAX];
+	snprintf(pidfile, sizeof(pidfile), "%s/restore.pid", nsjconf->criu_dir);
+	unlink(pidfile);
+	char inherit[3][64];
+	for (int i = 0; i < 3; i++) {
+		snprintf(inherit[i], sizeof(inherit[i]), "fd[%d]:pipe:[%" PRIu64 "]", i,
+			 (uint64_t) criuPipeIno[i]);
+	}
+	const char *argv[] = {
+		nsjconf->criu_bin, "restore", "--images-dir", nsjconf->criu_dir, "--log-file",
+		"restore.log", "--restore-detached", "--restore-sibling", "--pidfile", pidfile,
+		"--shell-job", "--ext-mount-map", "auto", "--manage-cgroups=ignore",
+		"--inherit-fd", inherit[0], "--inherit-fd", inherit[1], "--inherit-fd", inherit[2],
+		NULL,
+	};
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t cpid = criuExec(nsjconf, argv, fd_in, fd_out, fd_err, true);
+	if (cpid == -1) {
+		return -1;
+	}
+	bool ok = criuWait(cpid, "restore");
+
+	pid_t pid = -1;
+	char buf[32];
+	ssize_t sz = ok ? utilReadFromFile(pidfile, buf, sizeof(buf) - 1) : -1;
+	if (sz > 0) {
+		buf[sz] = '\0';
+		pid = (pid_t) strtol(buf, NULL, 10);
+	}
+	if (pid > 0 && cgroupRename(nsjconf, cpid, pid) == false) {
+		kill(pid, SIGKILL);
+		TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+		pid = -1;
+	}
+	if (pid <= 0) {
+		cgroupFinishFromParent(nsjconf, cpid);
+		LOG_W("Couldn't restore the jail from '%s' (see '%s/restore.log'), cold-starting "
+		      "it instead", nsjconf->criu_dir, nsjconf->criu_dir);
+		return -1;
+	}
+
+	long ms = criuMsSince(&start);
+	LOG_I("PID: %d restored from '%s' in %ld.%03ld s (cold start: %ld.%03ld s)", (int)pid,
+	      nsjconf->criu_dir, ms / 1000, ms % 1000, criuColdMs / 1000, criuColdMs % 1000);
+	return pid;
+}
@@ -0,0 +1,195 @@
+/*
+
+   nsjail - environment of jailed processes
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "env.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+/*
+ * The environment is built once: [inherited (--keep_env)] [--env] [per-jail slots] NULL. Only
+ * the slots are filled before each clone(), and the child passes the array to execve() as is
+ */
+enum {
+	ENV_SLOT_JAIL_ID = 0,
+	ENV_SLOT_REMOTE_ADDR,
+	ENV_SLOT_REMOTE_PORT,
+	ENV_SLOT_LOCAL_PORT,
+	ENV_SLOT_CNT,
+};
+
+static const char *envSlotNames[ENV_SLOT_CNT] = {
+	[ENV_SLOT_JAIL_ID] = "JAIL_ID",
+	[ENV_SLOT_REMOTE_ADDR] = "REMOTE_ADDR",
+	[ENV_SLOT_REMOTE_PORT] = "REMOTE_PORT",
+	[ENV_SLOT_LOCAL_PORT] = "LOCAL_PORT",
+};
+
+/* Fits 'REMOTE_ADDR=' and an IPv6 address */
+#define ENV_SLOT_SIZE 64
+
+static char envSlots[ENV_SLOT_CNT][ENV_SLOT_SIZE];
+static size_t envSlotsIdx = 0;
+static unsigned int envJailId = 0;
+
+static bool envNameEq(const char *a, const char *b)
+{
+	size_t alen = strcspn(a, "=");
+	size_t blen = strcspn(b, "=");
+	return (alen == blen && memcmp(a, b, alen) == 0);
+}
+
+/* Variables set by --env or by the slots replace the inherited ones */
+static bool envIsOverridden(struct nsjconf_t *nsjconf, const char *var)
+{
+	for (size_t i = 0; i < ENV_SLOT_CNT; i++) {
+		if (envNameEq(var, envSlotNames[i])) {
+			return true;
+		}
+	}
+	struct charptr_t *p;
+	TAILQ_FOREACH(p, &nsjconf->envs, pointers) {
+		if (envNameEq(var, p->val)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool envInit(struct nsjconf_t * nsjconf)
+{
+	size_t cnt = ENV_SLOT_CNT + 1;
+	if (nsjconf->keep_env) {
+		for (size_t i = 0; environ[i]; i++) {
+			cnt++;
+		}
+	}
+	struct charptr_t *p;
+	TAILQ_FOREACH(p, &nsjconf->envs, pointers) {
+		cnt++;
+	}
+
+	char **envp = utilMalloc(sizeof(char *) * cnt);
+	size_t idx = 0;
+	if (nsjconf->keep_env) {
+		for (size_t i = 0; environ[i]; i++) {
+			if (envIsOverridden(nsjconf, environ[i]) == false) {
+				envp[idx++] = environ[i];
+			}
+		}
+	}
+	TAILQ_FOREACH(p, &nsjconf->envs, pointers) {
+		/* putenv("NAME") semantics, i.e. 'unset' */
+		if (strchr(p->val, '=') == NULL) {
+			continue;
+		}
+		bool skip = false;
+		for (size_t i = 0; i < ENV_SLOT_CNT; i++) {
+			if (envNameEq(p->val, envSlotNames[i])) {
+				LOG_W("'%s' is set for every jail by nsjail, ignoring --env '%s'",
+				      envSlotNames[i], p->val);
+				skip = true;
+			}
+		}
+		/* The last one wins, as with putenv() */
+		struct charptr_t *q = TAILQ_NEXT(p, pointers);
+		for (; q != NULL && skip == false; q = TAILQ_NEXT(q, pointers)) {
+			if (envNameEq(p->val, q->val)) {
+				skip = true;
+			}
+		}
+		if (skip == false) {
+			envp[idx++] = p->val;
+		}
+	}
+	envSlotsIdx = idx;
+	for (size_t i = 0; i <= ENV_SLOT_CNT; i++) {
+		envp[idx + i] = NULL;
+	}
+	/* Rebuilt by criuCheckpoint(), once the template jail is started */
+	free(nsjconf->env_prebuilt);
+	nsjconf->env_prebuilt = envp;
+	return true;
+}
+
+static void envSetSlot(int slot, const char *fmt, ...)
+    __attribute__ ((format(printf, 2, 3)));
+
+static void envSetSlot(int slot, const char *fmt, ...)
+{
+	int off = snprintf(envSlots[slot], ENV_SLOT_SIZE, "%s=", envSlotNames[slot]);
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(&envSlots[slot][off], ENV_SLOT_SIZE - off, fmt, args);
+	va_end(args);
+}
+
+static void envAddrToText(const struct sockaddr_in6 *addr, char *buf, size_t len)
+{
+	if (IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr)) {
+		inet_ntop(AF_INET, &addr->sin6_addr.s6_addr[12], buf, len);
+	} else {
+		inet_ntop(AF_INET6, &addr->sin6_addr, buf, len);
+	}
+}
+
+/*
+ * Fills the slots for the next jail, in the parent, right before clone(). REMOTE_ADDR,
+ * REMOTE_PORT and LOCAL_PORT are only set if sock is a connected socket
+ */
+void envPrepare(struct nsjconf_t *nsjconf, int sock)
+{
+	char **envp = nsjconf->env_prebuilt;
+	size_t idx = envSlotsIdx;
+
+	envSetSlot(ENV_SLOT_JAIL_ID, "%u", ++envJailId);
+	envp[idx++] = envSlots[ENV_SLOT_JAIL_ID];
+
+	struct sockaddr_in6 raddr, laddr;
+	socklen_t rlen = sizeof(raddr), llen = sizeof(laddr);
+	if (getpeername(sock, (struct sockaddr *)&raddr, &rlen) == 0
+	    && getsockname(sock, (struct sockaddr *)&laddr, &llen) == 0
+	    && raddr.sin6_family == AF_INET6) {
+		char addr[INET6_ADDRSTRLEN];
+		envAddrToText(&raddr, addr, sizeof(addr));
+		envSetSlot(ENV_SLOT_REMOTE_ADDR, "%s", addr);
+		envSetSlot(ENV_SLOT_REMOTE_PORT, "%hu", ntohs(raddr.sin6_port));
+		envSetSlot(ENV_SLOT_LOCAL_PORT, "%hu", ntohs(laddr.sin6_port));
+		envp[idx++] = envSlots[ENV_SLOT_REMOTE_ADDR];
+		envp[idx++] = envSlots[ENV_SLOT_REMOTE_PORT];
+		envp[idx++] = envSlots[ENV_SLOT_LOCAL_PORT];
+	}
+	envp[idx] = NULL;
+}
+
+/* JAIL_ID of the jail prepared last */
+unsigned int envGetJailId(void)
+{
+	return envJailId;
+}
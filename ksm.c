@@ -0,0 +1,168 @@
+/*
+
+   nsjail - kernel same-page merging
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "ksm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif				/* PR_SET_MEMORY_MERGE */
+
+#define KSM_SYSFS "/sys/kernel/mm/ksm"
+
+static bool ksmSetTunable(const char *name, unsigned int val)
+{
+	char fname[PATH_MAX];
+	char str[64];
+	snprintf(fname, sizeof(fname), "%s/%s", KSM_SYSFS, name);
+	snprintf(str, sizeof(str), "%u", val);
+	LOG_D("Setting '%s' to '%s'", fname, str);
+	if (utilWriteBufToFile(fname, str, strlen(str), O_WRONLY) == false) {
+		LOG_E("Couldn't set '%s' to '%s'", fname, str);
+		return false;
+	}
+	return true;
+}
+
+static bool ksmGetTunable(const char *name, unsigned long *val)
+{
+	char fname[PATH_MAX];
+	char buf[64];
+	snprintf(fname, sizeof(fname), "%s/%s", KSM_SYSFS, name);
+	ssize_t sz = utilReadFromFile(fname, buf, sizeof(buf) - 1);
+	if (sz <= 0) {
+		return false;
+	}
+	buf[sz] = '\0';
+	*val = strtoul(buf, NULL, 10);
+	return true;
+}
+
+/*
+ * PR_SET_MEMORY_MERGE requires CAP_SYS_RESOURCE in the initial user namespace, which new
+ * jails don't have (they start in a new user namespace). The flag is inherited over
+ * clone() and preserved across execve() (Linux >= 6.7), so it's set on the supervisor
+ * itself, and every jail created from now on will be eligible for merging.
+ */
+bool ksmInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->ksm == false) {
+		return true;
+	}
+	if (nsjconf->ksm_pages_to_scan != 0
+	    && ksmSetTunable("pages_to_scan", nsjconf->ksm_pages_to_scan) == false) {
+		return false;
+	}
+	if (nsjconf->ksm_sleep_ms != 0
+	    && ksmSetTunable("sleep_millisecs", nsjconf->ksm_sleep_ms) == false) {
+		return false;
+	}
+	if ((nsjconf->ksm_pages_to_scan != 0 || nsjconf->ksm_sleep_ms != 0)
+	    && ksmSetTunable("run", 1) == false) {
+		return false;
+	}
+	if (prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) == -1) {
+		/* The prctl exists since 6.4, but jails need the flag to survive execve() (6.7) */
+		PLOG_E("prctl(PR_SET_MEMORY_MERGE, 1). It requires Linux >= 6.7 and "
+		       "CAP_SYS_RESOURCE");
+		return false;
+	}
+
+	unsigned long run = 0;
+	if (ksmGetTunable("run", &run) == true && run != 1) {
+		LOG_W("KSM is not running ('%s/run' is %lu), no pages will be merged", KSM_SYSFS,
+		      run);
+	}
+	return true;
+}
+
+/*
+ * The counters are gone by the time the process is reaped, so they're sampled periodically
+ * from /proc/PID/ksm_stat
+ */
+void ksmSample(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	if (nsjconf->ksm == false) {
+		return;
+	}
+
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "/proc/%d/ksm_stat", (int)p->pid);
+	int fd = TEMP_FAILURE_RETRY(open(fname, O_RDONLY | O_CLOEXEC));
+	if (fd == -1) {
+		return;
+	}
+	char buf[1024];
+	ssize_t sz = utilReadFromFd(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (sz <= 0) {
+		return;
+	}
+	buf[sz] = '\0';
+
+	const char *s;
+	if ((s = strstr(buf, "ksm_merging_pages ")) != NULL) {
+		uint64_t pages = strtoull(s + strlen("ksm_merging_pages "), NULL, 10);
+		if (pages > p->ksm_peak_pages) {
+			p->ksm_peak_pages = pages;
+		}
+	}
+	if ((s = strstr(buf, "ksm_process_profit ")) != NULL) {
+		int64_t profit = strtoll(s + strlen("ksm_process_profit "), NULL, 10);
+		if (profit > p->ksm_peak_profit) {
+			p->ksm_peak_profit = profit;
+		}
+	}
+}
+
+void ksmFinish(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	if (nsjconf->ksm == false) {
+		return;
+	}
+	LOG_I("PID: %d KSM merging pages peak: %" PRIu64 " (%" PRIu64 " KiB), profit peak: %"
+	      PRId64 " bytes", p->pid, p->ksm_peak_pages,
+	      p->ksm_peak_pages * (uint64_t) sysconf(_SC_PAGESIZE) / 1024, p->ksm_peak_profit);
+}
+
+void ksmDisplay(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->ksm == false) {
+		return;
+	}
+	unsigned long shared = 0, sharing = 0, unshared = 0;
+	ksmGetTunable("pages_shared", &shared);
+	ksmGetTunable("pages_sharing", &sharing);
+	ksmGetTunable("pages_unshared", &unshared);
+	LOG_I("KSM: pages_shared: %lu, pages_sharing: %lu (~%lu KiB saved), pages_unshared: %lu",
+	      shared, sharing, sharing * (unsigned long)sysconf(_SC_PAGESIZE) / 1024, unshared);
+}
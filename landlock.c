@@ -0,0 +1,172 @@
+/*
+
+   nsjail - Landlock file-system confinement
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "landlock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/landlock.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#ifndef __NR_landlock_create_ruleset
+#define __NR_landlock_create_ruleset 444
+#endif				/* __NR_landlock_create_ruleset */
+#ifndef __NR_landlock_add_rule
+#define __NR_landlock_add_rule 445
+#endif				/* __NR_landlock_add_rule */
+#ifndef __NR_landlock_restrict_self
+#define __NR_landlock_restrict_self 446
+#endif				/* __NR_landlock_restrict_self */
+#ifndef LANDLOCK_ACCESS_FS_REFER
+#define LANDLOCK_ACCESS_FS_REFER (1ULL << 13)
+#endif				/* LANDLOCK_ACCESS_FS_REFER */
+#ifndef LANDLOCK_ACCESS_FS_TRUNCATE
+#define LANDLOCK_ACCESS_FS_TRUNCATE (1ULL << 14)
+#endif				/* LANDLOCK_ACCESS_FS_TRUNCATE */
+
+#define LANDLOCK_ACCESS_FILE (LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_WRITE_FILE | \
+	LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_TRUNCATE)
+#define LANDLOCK_ACCESS_RO (LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE | \
+	LANDLOCK_ACCESS_FS_READ_DIR)
+#define LANDLOCK_ACCESS_RW_V1 (LANDLOCK_ACCESS_RO | LANDLOCK_ACCESS_FS_WRITE_FILE | \
+	LANDLOCK_ACCESS_FS_REMOVE_DIR | LANDLOCK_ACCESS_FS_REMOVE_FILE | \
+	LANDLOCK_ACCESS_FS_MAKE_CHAR | LANDLOCK_ACCESS_FS_MAKE_DIR | LANDLOCK_ACCESS_FS_MAKE_REG | \
+	LANDLOCK_ACCESS_FS_MAKE_SOCK | LANDLOCK_ACCESS_FS_MAKE_FIFO | \
+	LANDLOCK_ACCESS_FS_MAKE_BLOCK | LANDLOCK_ACCESS_FS_MAKE_SYM)
+
+static bool landlockAddPath(int ruleset_fd, const char *path, uint64_t access)
+{
+	int fd = TEMP_FAILURE_RETRY(open(path, O_PATH | O_CLOEXEC));
+	if (fd == -1) {
+		PLOG_E("open('%s', O_PATH)", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		PLOG_E("fstat('%s')", path);
+		close(fd);
+		return false;
+	}
+	/* Directory-only rights are rejected with EINVAL for non-directories */
+	if (S_ISDIR(st.st_mode) == false) {
+		access &= LANDLOCK_ACCESS_FILE;
+	}
+
+	struct landlock_path_beneath_attr attr = {
+		.allowed_access = access,
+		.parent_fd = fd,
+	};
+	LOG_D("Landlock: allowing %#" PRIx64 " beneath '%s'", (uint64_t) access, path);
+	if (syscall(__NR_landlock_add_rule, ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &attr, 0) ==
+	    -1) {
+		PLOG_E("landlock_add_rule('%s', %#" PRIx64 ")", path, (uint64_t) access);
+		close(fd);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+/*
+ * The ruleset is built once in the supervisor, and the resulting fd is inherited by every
+ * new jail, which only has to call landlock_restrict_self() with it
+ */
+bool landlockInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->landlock == false) {
+		return true;
+	}
+
+	int abi = syscall(__NR_landlock_create_ruleset, NULL, 0, LANDLOCK_CREATE_RULESET_VERSION);
+	if (abi < 1) {
+		PLOG_E("Landlock is not supported by this kernel");
+		return false;
+	}
+
+	uint64_t handled = LANDLOCK_ACCESS_RW_V1;
+	if (abi >= 2) {
+		handled |= LANDLOCK_ACCESS_FS_REFER;
+	}
+	if (abi >= 3) {
+		handled |= LANDLOCK_ACCESS_FS_TRUNCATE;
+	}
+	struct landlock_ruleset_attr rs_attr = {
+		.handled_access_fs = handled,
+	};
+	int ruleset_fd =
+	    syscall(__NR_landlock_create_ruleset, &rs_attr, sizeof(rs_attr.handled_access_fs), 0);
+	if (ruleset_fd == -1) {
+		PLOG_E("landlock_create_ruleset(handled_access_fs=%#" PRIx64 ")", handled);
+		return false;
+	}
+	if (TEMP_FAILURE_RETRY(fcntl(ruleset_fd, F_SETFD, FD_CLOEXEC)) == -1) {
+		PLOG_W("fcntl(%d, F_SETFD, FD_CLOEXEC)", ruleset_fd);
+	}
+
+	struct mounts_t *p;
+	TAILQ_FOREACH(p, &nsjconf->mountpts, pointers) {
+		/* Implicit / and /proc mounts, nothing to grant here */
+		if (p->src == NULL && (strcmp(p->dst, "/") == 0 || strcmp(p->dst, "/proc") == 0)) {
+			continue;
+		}
+		if (p->src == NULL) {
+			LOG_E("Landlock mode cannot provide a '%s' mount at '%s'", p->fs_type, p->dst);
+			close(ruleset_fd);
+			return false;
+		}
+		if (strcmp(p->src, p->dst) != 0) {
+			LOG_E("Landlock mode doesn't remap paths ('%s' -> '%s'), use 'source' only",
+			      p->src, p->dst);
+			close(ruleset_fd);
+			return false;
+		}
+		uint64_t access = (p->flags & MS_RDONLY) ? LANDLOCK_ACCESS_RO : handled;
+		if (landlockAddPath(ruleset_fd, p->src, access) == false) {
+			close(ruleset_fd);
+			return false;
+		}
+	}
+
+	LOG_D("Landlock ruleset (ABI v%d) prepared as fd=%d", abi, ruleset_fd);
+	nsjconf->landlock_fd = ruleset_fd;
+	return true;
+}
+
+/* Requires PR_SET_NO_NEW_PRIVS, or CAP_SYS_ADMIN in the current user namespace */
+bool landlockApply(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->landlock == false) {
+		return true;
+	}
+	if (syscall(__NR_landlock_restrict_self, nsjconf->landlock_fd, 0) == -1) {
+		PLOG_E("landlock_restrict_self(%d)", nsjconf->landlock_fd);
+		return false;
+	}
+	close(nsjconf->landlock_fd);
+	return true;
+}
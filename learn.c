@@ -0,0 +1,576 @@
+/*
+
+   nsjail - learning seccomp-bpf policies from the jails' syscalls
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * With --seccomp_learn, every jail gets a filter returning SECCOMP_RET_USER_NOTIF for all
+ * syscalls. The supervisor takes the listener fd out of the jail with pidfd_getfd(), and
+ * passes it to a helper process, which counts the syscalls (and the values of arguments
+ * selecting what a syscall does, e.g. the request of ioctl()), and lets them continue.
+ *
+ * The helper keeps the profile in the --seccomp_learn file, accumulated across runs, and
+ * after every run writes FILE.policy (see policy.c), with the most frequently used syscalls
+ * first, to be used with --seccomp_policy.
+ */
+
+#include "learn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "policy.h"
+#include "util.h"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif				/* __NR_pidfd_open */
+#ifndef __NR_pidfd_getfd
+#define __NR_pidfd_getfd 438
+#endif				/* __NR_pidfd_getfd */
+#ifndef SECCOMP_USER_NOTIF_FLAG_CONTINUE
+#define SECCOMP_USER_NOTIF_FLAG_CONTINUE (1UL << 0)
+#endif				/* SECCOMP_USER_NOTIF_FLAG_CONTINUE */
+
+/* Syscall numbers above it are counted as foreign (e.g. the x32 ABI on x86_64) */
+#define LEARN_NR_MAX 1024
+/* With more distinct values of the selector argument, any value is allowed */
+#define LEARN_MAX_VALS 16
+/* How long the supervisor waits for a new jail to install the filter */
+#define LEARN_LISTENER_TIMEOUT_MS 5000
+
+/* Arguments selecting what a syscall does, the policy allows only the values seen */
+static const struct {
+	const char *name;
+	int arg;
+} learnSelectors[] = {
+	{"socket", 0},		/* domain */
+	{"socketpair", 0},	/* domain */
+	{"ioctl", 1},		/* request */
+	{"fcntl", 1},		/* cmd */
+	{"prctl", 0},		/* option */
+	{"personality", 0},	/* persona */
+};
+
+struct learnsc_t {
+	uint64_t count;
+	/* The selector argument, or -1 */
+	int arg;
+	bool any;
+	size_t nvals;
+	uint64_t vals[LEARN_MAX_VALS];
+};
+
+/* In the helper */
+static struct learnsc_t learnSyscalls[LEARN_NR_MAX];
+static uint64_t learnRuns = 0;
+static uint64_t learnForeign = 0;
+
+/* In the supervisor */
+static int learnCtlFd = -1;
+
+static void learnAddVal(struct learnsc_t *sc, uint64_t val)
+{
+	if (sc->any) {
+		return;
+	}
+	for (size_t i = 0; i < sc->nvals; i++) {
+		if (sc->vals[i] == val) {
+			return;
+		}
+	}
+	if (sc->nvals == LEARN_MAX_VALS) {
+		sc->any = true;
+		return;
+	}
+	sc->vals[sc->nvals++] = val;
+}
+
+static void learnRecord(const struct seccomp_data *data)
+{
+	if (data->arch != POLICY_ARCH || data->nr < 0 || data->nr >= LEARN_NR_MAX) {
+		learnForeign++;
+		return;
+	}
+	struct learnsc_t *sc = &learnSyscalls[data->nr];
+	sc->count++;
+	if (sc->arg != -1) {
+		learnAddVal(sc, data->args[sc->arg]);
+	}
+}
+
+/* Lines: 'name count [argN val,val,...|*]' */
+static void learnLoad(const char *fname)
+{
+	FILE *f = fopen(fname, "re");
+	if (f == NULL) {
+		if (errno != ENOENT) {
+			PLOG_W("fopen('%s')", fname);
+		}
+		return;
+	}
+	char *line = NULL;
+	size_t len = 0;
+	while (getline(&line, &len, f) != -1) {
+		line[strcspn(line, "#\r\n")] = '\0';
+		char *saveptr;
+		const char *name = strtok_r(line, " \t", &saveptr);
+		const char *count = strtok_r(NULL, " \t", &saveptr);
+		if (name == NULL || count == NULL) {
+			continue;
+		}
+		if (strcmp(name, "runs") == 0) {
+			learnRuns = strtoull(count, NULL, 10);
+			continue;
+		}
+		if (strcmp(name, "foreign") == 0) {
+			learnForeign = strtoull(count, NULL, 10);
+			continue;
+		}
+		int nr;
+		if (policySyscallNr(name, &nr) == false || nr < 0 || nr >= LEARN_NR_MAX) {
+			LOG_W("%s: Unknown syscall '%s', skipped", fname, name);
+			continue;
+		}
+		struct learnsc_t *sc = &learnSyscalls[nr];
+		sc->count += strtoull(count, NULL, 10);
+		if (sc->arg == -1) {
+			continue;
+		}
+
+		const char *arg = strtok_r(NULL, " \t", &saveptr);
+		char *vals = strtok_r(NULL, " \t", &saveptr);
+		char expected[8];
+		snprintf(expected, sizeof(expected), "arg%d", sc->arg);
+		if (arg == NULL || vals == NULL || strcmp(arg, expected) != 0) {
+			/* Recorded without (or with another) selector argument */
+			sc->any = true;
+			continue;
+		}
+		char *saveptr2;
+		for (char *v = strtok_r(vals, ",", &saveptr2); v != NULL;
+		     v = strtok_r(NULL, ",", &saveptr2)) {
+			if (strcmp(v, "*") == 0) {
+				sc->any = true;
+			} else {
+				learnAddVal(sc, strtoull(v, NULL, 0));
+			}
+		}
+	}
+	free(line);
+	fclose(f);
+	LOG_D("Loaded the seccomp profile '%s' (%" PRIu64 " runs)", fname, learnRuns);
+}
+
+/* Written to a temporary file first, so --seccomp_policy never sees a partial policy */
+static FILE *learnCreate(const char *fname, char *tmp, size_t len)
+{
+	snprintf(tmp, len, "%s.tmp", fname);
+	FILE *f = fopen(tmp, "we");
+	if (f == NULL) {
+		PLOG_E("fopen('%s')", tmp);
+	}
+	return f;
+}
+
+static bool learnCommit(FILE * f, const char *tmp, const char *fname)
+{
+	bool err = (ferror(f) != 0);
+	if (fclose(f) != 0 || err) {
+		PLOG_E("Couldn't write '%s'", tmp);
+		unlink(tmp);
+		return false;
+	}
+	if (rename(tmp, fname) == -1) {
+		PLOG_E("rename('%s', '%s')", tmp, fname);
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+static const char *learnName(int nr, char *buf, size_t len)
+{
+	const char *name = policySyscallName(nr);
+	if (strcmp(name, "unknown") == 0) {
+		snprintf(buf, len, "%d", nr);
+		return buf;
+	}
+	return name;
+}
+
+static void learnSaveProfile(const char *fname)
+{
+	char tmp[PATH_MAX];
+	FILE *f = learnCreate(fname, tmp, sizeof(tmp));
+	if (f == NULL) {
+		return;
+	}
+	fprintf(f, "# nsjail seccomp profile (--seccomp_learn): syscall, number of calls, and the "
+		"values of the selector argument ('*': too many to list)\n");
+	fprintf(f, "runs %" PRIu64 "\n", learnRuns);
+	fprintf(f, "foreign %" PRIu64 "\n", learnForeign);
+	for (int nr = 0; nr < LEARN_NR_MAX; nr++) {
+		const struct learnsc_t *sc = &learnSyscalls[nr];
+		if (sc->count == 0) {
+			continue;
+		}
+		char buf[16];
+		fprintf(f, "%s %" PRIu64, learnName(nr, buf, sizeof(buf)), sc->count);
+		if (sc->arg != -1) {
+			fprintf(f, " arg%d ", sc->arg);
+			if (sc->any) {
+				fprintf(f, "*");
+			}
+			for (size_t i = 0; sc->any == false && i < sc->nvals; i++) {
+				fprintf(f, "%s%#" PRIx64, i ? "," : "", sc->vals[i]);
+			}
+		}
+		fprintf(f, "\n");
+	}
+	learnCommit(f, tmp, fname);
+}
+
+static int learnCmp(const void *a, const void *b)
+{
+	int nra = *(const int *)a;
+	int nrb = *(const int *)b;
+	uint64_t ca = learnSyscalls[nra].count;
+	uint64_t cb = learnSyscalls[nrb].count;
+	if (ca != cb) {
+		return (ca < cb) ? 1 : -1;
+	}
+	return nra - nrb;
+}
+
+static void learnSavePolicy(const char *profile)
+{
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s.policy", profile);
+	char tmp[PATH_MAX];
+	FILE *f = learnCreate(fname, tmp, sizeof(tmp));
+	if (f == NULL) {
+		return;
+	}
+
+	int nrs[LEARN_NR_MAX];
+	size_t cnt = 0;
+	for (int nr = 0; nr < LEARN_NR_MAX; nr++) {
+		if (learnSyscalls[nr].count > 0) {
+			nrs[cnt++] = nr;
+		}
+	}
+	qsort(nrs, cnt, sizeof(nrs[0]), learnCmp);
+
+	fprintf(f, "# Generated by nsjail from %" PRIu64 " runs recorded in '%s', the most "
+		"frequently used syscalls first\n", learnRuns, profile);
+	if (learnForeign > 0) {
+		fprintf(f, "# %" PRIu64 " calls of other architectures or ABIs were seen, they're "
+			"not allowed\n", learnForeign);
+	}
+	fprintf(f, "DEFAULT KILL\n");
+	for (size_t i = 0; i < cnt; i++) {
+		const struct learnsc_t *sc = &learnSyscalls[nrs[i]];
+		char buf[16];
+		const char *name = learnName(nrs[i], buf, sizeof(buf));
+		if (sc->arg == -1 || sc->any) {
+			fprintf(f, "ALLOW %s  # %" PRIu64 " calls\n", name, sc->count);
+			continue;
+		}
+		for (size_t j = 0; j < sc->nvals; j++) {
+			fprintf(f, "ALLOW %s if arg%d == %#" PRIx64, name, sc->arg, sc->vals[j]);
+			if (j == 0) {
+				fprintf(f, "  # %" PRIu64 " calls", sc->count);
+			}
+			fprintf(f, "\n");
+		}
+	}
+	if (learnCommit(f, tmp, fname) == true) {
+		LOG_I("Seccomp policy '%s' written: %zu syscalls seen in %" PRIu64 " runs", fname,
+		      cnt, learnRuns);
+	}
+}
+
+static void learnNotif(int fd)
+{
+	struct seccomp_notif req;
+	memset(&req, '\0', sizeof(req));
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, &req) == -1) {
+		/* ENOENT: the process was killed in the meantime */
+		if (errno != ENOENT && errno != EINTR) {
+			PLOG_W("ioctl(SECCOMP_IOCTL_NOTIF_RECV)");
+		}
+		return;
+	}
+	learnRecord(&req.data);
+
+	struct seccomp_notif_resp resp = {
+		.id = req.id,
+		.val = 0,
+		.error = 0,
+		.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE,
+	};
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, &resp) == -1 && errno != ENOENT) {
+		PLOG_W("ioctl(SECCOMP_IOCTL_NOTIF_SEND)");
+	}
+}
+
+/*
+ * Commands from the supervisor: 'L' with a new listener fd, and 'S' when a jail has
+ * finished, answered with 'A' once the profile and the policy are saved
+ */
+static void learnHelper(struct nsjconf_t *nsjconf, int ctlfd)
+{
+	/* Exits when the supervisor does, after saving what's left, so ^C must not kill it */
+	signal(SIGINT, SIG_IGN);
+
+	for (int nr = 0; nr < LEARN_NR_MAX; nr++) {
+		learnSyscalls[nr].arg = -1;
+	}
+	for (size_t i = 0; i < ARRAYSIZE(learnSelectors); i++) {
+		int nr;
+		if (policySyscallNr(learnSelectors[i].name, &nr) == true && nr >= 0
+		    && nr < LEARN_NR_MAX) {
+			learnSyscalls[nr].arg = learnSelectors[i].arg;
+		}
+	}
+	learnLoad(nsjconf->seccomp_learn);
+
+	size_t npfds = 1;
+	struct pollfd *pfds = utilMalloc(sizeof(struct pollfd));
+	pfds[0].fd = ctlfd;
+	pfds[0].events = POLLIN;
+	for (;;) {
+		if (poll(pfds, npfds, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			PLOG_E("poll()");
+			break;
+		}
+		for (size_t i = npfds - 1; i > 0; i--) {
+			if (pfds[i].revents & POLLIN) {
+				learnNotif(pfds[i].fd);
+			} else if (pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+				/* All processes using the filter are gone */
+				close(pfds[i].fd);
+				pfds[i] = pfds[--npfds];
+			}
+		}
+		if ((pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+			continue;
+		}
+
+		char cmd;
+		int fd;
+		if (utilRecvFd(ctlfd, &cmd, &fd) <= 0) {
+			break;
+		}
+		if (cmd == 'L' && fd != -1) {
+			pfds = realloc(pfds, sizeof(struct pollfd) * (npfds + 1));
+			if (pfds == NULL) {
+				PLOG_F("realloc(%zu)", sizeof(struct pollfd) * (npfds + 1));
+			}
+			pfds[npfds].fd = fd;
+			pfds[npfds].events = POLLIN;
+			npfds++;
+		} else if (cmd == 'S') {
+			learnRuns++;
+			learnSaveProfile(nsjconf->seccomp_learn);
+			learnSavePolicy(nsjconf->seccomp_learn);
+			utilSendFd(ctlfd, 'A', -1);
+		} else if (fd != -1) {
+			close(fd);
+		}
+	}
+	learnSaveProfile(nsjconf->seccomp_learn);
+	learnSavePolicy(nsjconf->seccomp_learn);
+}
+
+bool learnInit(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->seccomp_learn == NULL) {
+		return true;
+	}
+#if defined(POLICY_ARCH)
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		PLOG_E("socketpair(AF_UNIX, SOCK_SEQPACKET)");
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		PLOG_E("fork()");
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		learnHelper(nsjconf, sv[1]);
+		_exit(0);
+	}
+	close(sv[1]);
+	learnCtlFd = sv[0];
+	LOG_I("Learning the seccomp policy: profile in '%s', policy in '%s.policy', helper PID: %d",
+	      nsjconf->seccomp_learn, nsjconf->seccomp_learn, (int)pid);
+	return true;
+#else
+	LOG_E("--seccomp_learn is not supported on this CPU architecture");
+	return false;
+#endif				/* defined(POLICY_ARCH) */
+}
+
+/*
+ * In the jail, right before execve(). seccomp() returns the lowest free fd, which is sent to
+ * the supervisor first: once the filter is installed, every syscall (including a write to
+ * pipefd) waits until the listener is being read. Nothing may be logged after that here
+ */
+bool learnApply(struct nsjconf_t *nsjconf, int pipefd)
+{
+	if (nsjconf->seccomp_learn == NULL) {
+		return true;
+	}
+	/* pidfd_getfd() requires ptrace access, which a non-dumpable process wouldn't give */
+	if (prctl(PR_SET_DUMPABLE, 1, 0, 0, 0) == -1) {
+		PLOG_W("prctl(PR_SET_DUMPABLE, 1)");
+	}
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+		PLOG_E("prctl(PR_SET_NO_NEW_PRIVS, 1)");
+		return false;
+	}
+	int fd = fcntl(pipefd, F_DUPFD, 0);
+	if (fd == -1) {
+		PLOG_E("fcntl(%d, F_DUPFD)", pipefd);
+		return false;
+	}
+	close(fd);
+	int32_t nfd = fd;
+	if (utilWriteToFd(pipefd, &nfd, sizeof(nfd)) == false) {
+		LOG_E("Couldn't send the seccomp listener fd number to the supervisor");
+		return false;
+	}
+
+	struct sock_filter filter[] = {
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+	};
+	struct sock_fprog prog = {
+		.len = (unsigned short)ARRAYSIZE(filter),
+		.filter = filter,
+	};
+	int listener =
+	    syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+	if (listener == -1) {
+		PLOG_E("seccomp(SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER). It "
+		       "requires Linux >= 5.5");
+		return false;
+	}
+	/* Otherwise the supervisor doesn't find the listener, and kills the jail */
+	return (listener == fd);
+}
+
+/*
+ * Takes the listener out of the new jail (and passes it to the helper), after which the jail's
+ * execve() can continue
+ */
+bool learnInitFromParent(struct nsjconf_t *nsjconf, pid_t pid, int pipefd)
+{
+	if (nsjconf->seccomp_learn == NULL) {
+		return true;
+	}
+	int32_t nfd;
+	if (utilReadFromFd(pipefd, &nfd, sizeof(nfd)) != sizeof(nfd)) {
+		LOG_E("PID: %d didn't send its seccomp listener fd number", (int)pid);
+		return false;
+	}
+	int pidfd = syscall(__NR_pidfd_open, pid, 0);
+	if (pidfd == -1) {
+		PLOG_E("pidfd_open(%d). It requires Linux >= 5.3", (int)pid);
+		kill(pid, SIGKILL);
+		return false;
+	}
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int fd;
+	for (;;) {
+		fd = syscall(__NR_pidfd_getfd, pidfd, nfd, 0);
+		if (fd != -1 || errno != EBADF) {
+			break;
+		}
+		/* Not installed yet. Readable once the process is gone */
+		struct pollfd pfd = {.fd = pidfd,.events = POLLIN,.revents = 0 };
+		if (poll(&pfd, 1, 1) == 1) {
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L >
+		    LEARN_LISTENER_TIMEOUT_MS) {
+			break;
+		}
+	}
+	close(pidfd);
+	if (fd == -1) {
+		PLOG_E("pidfd_getfd(pid=%d, fd=%d). It requires Linux >= 5.6, and ptrace access to "
+		       "the jail", (int)pid, (int)nfd);
+		kill(pid, SIGKILL);
+		return false;
+	}
+
+	bool ret = utilSendFd(learnCtlFd, 'L', fd);
+	close(fd);
+	if (ret == false) {
+		LOG_E("Couldn't pass the seccomp listener of PID: %d to the helper", (int)pid);
+		kill(pid, SIGKILL);
+		return false;
+	}
+	return true;
+}
+
+/* Waits until the profile is saved, so it's complete e.g. when nsjail exits */
+void learnFinishFromParent(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->seccomp_learn == NULL || learnCtlFd == -1) {
+		return;
+	}
+	if (utilSendFd(learnCtlFd, 'S', -1) == false) {
+		return;
+	}
+	struct pollfd pfd = {.fd = learnCtlFd,.events = POLLIN,.revents = 0 };
+	char cmd;
+	int fd;
+	if (TEMP_FAILURE_RETRY(poll(&pfd, 1, 1000)) != 1 || utilRecvFd(learnCtlFd, &cmd, &fd) <= 0) {
+		LOG_W("The seccomp profile '%s' wasn't saved in time", nsjconf->seccomp_learn);
+	}
+}
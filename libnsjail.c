@@ -0,0 +1,201 @@
+/*
+
+   nsjail - C API for spawning jails from other programs
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "libnsjail.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "cmdline.h"
+#include "cpu.h"
+#include "criu.h"
+#include "env.h"
+#include "ksm.h"
+#include "landlock.h"
+#include "learn.h"
+#include "log.h"
+#include "perf.h"
+#include "policy.h"
+#include "quota.h"
+#include "scratch.h"
+#include "subproc.h"
+#include "sysctl.h"
+#include "tls.h"
+#include "util.h"
+#include "warmup.h"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif				/* __NR_pidfd_open */
+
+/*
+ * The modules keep their state (log sink, pty relays, cgroups, scratch directories, result
+ * cache, etc.) in globals, so there can only be one configuration per process
+ */
+static bool nsjailConfCreated = false;
+static bool nsjailInitDone = false;
+
+struct nsjconf_t *nsjailConfNew(int argc, char *argv[])
+{
+	if (nsjailConfCreated == true) {
+		LOG_E("Only one nsjail configuration per process is supported");
+		return NULL;
+	}
+	struct nsjconf_t *nsjconf = utilMalloc(sizeof(struct nsjconf_t));
+	/* Re-initialize getopt(), the calling program might have used it already */
+	optind = 0;
+	if (cmdlineParse(argc, argv, nsjconf) == false) {
+		free(nsjconf);
+		return NULL;
+	}
+	/* It'd replace the calling process with the jail */
+	if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
+		LOG_E("[MODE_STANDALONE_EXECVE] (-Me) cannot be used with libnsjail");
+		free(nsjconf);
+		return NULL;
+	}
+	nsjailConfCreated = true;
+	return nsjconf;
+}
+
+bool nsjailInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjailInitDone == true) {
+		LOG_E("nsjailInit() can only be called once per process");
+		return false;
+	}
+	nsjailInitDone = true;
+
+	/* Before envInit(), as it adds $NSJAIL_READY_FD for the template jail */
+	if (criuInit(nsjconf) == false) {
+		return false;
+	}
+	if (envInit(nsjconf) == false) {
+		return false;
+	}
+	if (landlockInit(nsjconf) == false) {
+		return false;
+	}
+	if (cgroupInit(nsjconf) == false) {
+		return false;
+	}
+	if (perfInit(nsjconf) == false) {
+		return false;
+	}
+	if (policyInit(nsjconf) == false) {
+		return false;
+	}
+	if (learnInit(nsjconf) == false) {
+		return false;
+	}
+	if (scratchInit(nsjconf) == false) {
+		return false;
+	}
+	if (quotaInit(nsjconf) == false) {
+		return false;
+	}
+	if (ksmInit(nsjconf) == false) {
+		return false;
+	}
+	if (tlsInit(nsjconf) == false) {
+		return false;
+	}
+	if (cacheInit(nsjconf) == false) {
+		return false;
+	}
+	if (cpuInit(nsjconf) == false) {
+		return false;
+	}
+	if (warmupInit(nsjconf) == false) {
+		return false;
+	}
+	if (sysctlInit(nsjconf) == false) {
+		return false;
+	}
+	/* Starts the template jail, so it must be the last one */
+	if (criuCheckpoint(nsjconf) == false) {
+		return false;
+	}
+	return true;
+}
+
+pid_t nsjailSpawn(struct nsjconf_t * nsjconf, int fd_in, int fd_out, int fd_err,
+		  char *const argv[], char *const envp[], int *pidfd)
+{
+	if (pidfd != NULL) {
+		*pidfd = -1;
+	}
+
+	warmupWait(nsjconf);
+
+	/* Only used by the new process, which gets a copy of the configuration */
+	char *const *conf_argv = nsjconf->argv;
+	if (argv != NULL) {
+		nsjconf->argv = argv;
+	}
+	nsjconf->envp = envp;
+	pid_t pid = subprocRunChild(nsjconf, fd_in, fd_out, fd_err);
+	nsjconf->argv = conf_argv;
+	nsjconf->envp = NULL;
+
+	if (pid == -1) {
+		return -1;
+	}
+	if (pidfd != NULL) {
+		/*
+		 * The process can't be reaped before nsjailReap() is called, so the PID is still
+		 * valid. pidfds are always O_CLOEXEC
+		 */
+		*pidfd = syscall(__NR_pidfd_open, pid, 0);
+		if (*pidfd == -1) {
+			PLOG_D("pidfd_open(%d)", (int)pid);
+		}
+	}
+	return pid;
+}
+
+void nsjailSetExitCallback(struct nsjconf_t *nsjconf, nsjail_exit_cb_t cb, void *arg)
+{
+	nsjconf->exit_cb = cb;
+	nsjconf->exit_cb_arg = arg;
+}
+
+int nsjailReap(struct nsjconf_t *nsjconf)
+{
+	int ret = subprocReap(nsjconf);
+	logFlush();
+	return ret;
+}
+
+int nsjailCount(struct nsjconf_t *nsjconf)
+{
+	return subprocCount(nsjconf);
+}
+
+void nsjailKillAll(struct nsjconf_t *nsjconf)
+{
+	subprocKillAll(nsjconf);
+}
@@ -0,0 +1,89 @@
+/*
+
+   nsjail - C API for spawning jails from other programs
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * Link with libnsjail.a (and -lssl -lcrypto / -lnl-3 -lnl-route-3 if nsjail was built with
+ * them). The configuration is opaque, and is only accessed through these functions.
+ *
+ * Only one configuration per process is supported: nsjail's modules keep their state in
+ * globals. A second nsjailConfNew() (after a successful one) returns NULL, and a second
+ * nsjailInit() fails.
+ *
+ * Typical use:
+ *   struct nsjconf_t *conf = nsjailConfNew(argc, argv);  // nsjail's command-line syntax
+ *   nsjailInit(conf);
+ *   nsjailSetExitCallback(conf, cb, arg);
+ *   pid_t pid = nsjailSpawn(conf, fd_in, fd_out, fd_err, job_argv, job_envp, &pidfd);
+ *   ...
+ *   nsjailReap(conf);  // on SIGCHLD, on pidfd readiness, and at least once a second
+ */
+
+#ifndef NS_LIBNSJAIL_H
+#define NS_LIBNSJAIL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct nsjconf_t;
+
+typedef void (*nsjail_exit_cb_t) (pid_t pid, int status, void *arg);
+
+/*
+ * Parses the configuration from nsjail's command-line options (argv[0] is the program name,
+ * and the command after '--' is the default one for nsjailSpawn()). argv must stay valid for
+ * as long as the configuration is used. -Me is not supported. Returns NULL on errors, or if a
+ * configuration has been created already
+ */
+struct nsjconf_t *nsjailConfNew(int argc, char *argv[]);
+
+/*
+ * Global (per-configuration) setup: environment, Landlock ruleset, scratch directories,
+ * quotas, KSM, TLS, result cache, page-cache warmup. Fails if it has been called already
+ */
+bool nsjailInit(struct nsjconf_t *nsjconf);
+
+/*
+ * Creates a new jail with fd_in/fd_out/fd_err as its fd:0/1/2. argv and envp replace the
+ * configured command and environment when non-NULL (JAIL_ID/REMOTE_ADDR/REMOTE_PORT/
+ * LOCAL_PORT are only added to the configured environment). Blocks until the warmup is done
+ * with --warmup_wait. If pidfd is non-NULL, it's set to a
+ * pidfd (O_CLOEXEC) of the new process, or -1 if the kernel doesn't support pidfd_open().
+ * Returns the PID of the new process, or -1 on errors
+ */
+pid_t nsjailSpawn(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err,
+		  char *const argv[], char *const envp[], int *pidfd);
+
+/* Called from nsjailReap() with the wait() status of every finished jail */
+void nsjailSetExitCallback(struct nsjconf_t *nsjconf, nsjail_exit_cb_t cb, void *arg);
+
+/*
+ * Waits for finished jails (without blocking), and enforces the time limits. Only the jails'
+ * processes are waited for. Returns the exit code of the last failing jail, or 0
+ */
+int nsjailReap(struct nsjconf_t *nsjconf);
+
+/* Returns the number of running jails */
+int nsjailCount(struct nsjconf_t *nsjconf);
+
+/* Sends SIGKILL to all running jails */
+void nsjailKillAll(struct nsjconf_t *nsjconf);
+
+#endif				/* NS_LIBNSJAIL_H */
@@ -23,23 +23,180 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
 static __thread int log_fd = STDERR_FILENO;
 static __thread bool log_fd_isatty = true;
 static __thread bool log_verbose = false;
+static __thread unsigned int log_rate = 0;
+static __thread unsigned int log_burst = 0;
+static __thread bool log_rate_paused = false;
 
 #define _LOG_DEFAULT_FILE "/var/log/nsjail.log"
 
+/* Number of call sites (function + line) tracked by the rate limiter */
+#define LOG_SITES 512
+/* A message repeated for this long is summarized, even if no other message comes */
+#define LOG_REPEAT_WINDOW_MS 10000
+
+struct logsite_t {
+	const char *fn;
+	int ln;
+	/* In 1/1000ths of a message */
+	uint64_t tokens;
+	uint64_t refilled_ms;
+	uint64_t suppressed;
+	uint64_t suppressed_total;
+};
+
+static __thread struct logsite_t log_sites[LOG_SITES];
+static __thread uint64_t log_suppressed_total = 0;
+
+/* The previous message (without the timestamp), and how many times it was repeated since */
+static __thread char log_last[1024];
+static __thread enum llevel_t log_last_ll;
+static __thread const char *log_last_fn;
+static __thread int log_last_ln;
+static __thread uint64_t log_last_ms = 0;
+static __thread uint64_t log_repeated = 0;
+static __thread uint64_t log_repeated_total = 0;
+
+/*
+ * Structured sinks: --log journald[:SOCKET] (the native protocol of systemd-journald) or
+ * --log syslog[:SOCKET] (RFC 5424), over a local datagram socket. Entries are batched, and
+ * sent with one sendmmsg(). The socket is non-blocking, entries which the receiver can't
+ * take are dropped and counted
+ */
+enum logsink_t {
+	LOG_SINK_FD = 0,
+	LOG_SINK_JOURNALD,
+	LOG_SINK_SYSLOG,
+};
+
+#define LOG_JOURNALD_SOCKET "/run/systemd/journal/socket"
+#define LOG_SYSLOG_SOCKET "/dev/log"
+/* Entries sent at once */
+#define LOG_BATCH 32
+/* Max. time an entry waits in the batch, if nothing else is logged it's sent by logFlush() */
+#define LOG_BATCH_MS 100
+#define LOG_ENTRY_MAX 6144
+/* Private enterprise number reserved for documentation (RFC 5612), names the SD element */
+#define LOG_SYSLOG_SDID "nsjail@32473"
+#define LOG_SYSLOG_FACILITY 3	/* daemon */
+
+struct logentry_t {
+	size_t len;
+	char buf[LOG_ENTRY_MAX];
+};
+
+static __thread enum logsink_t log_sink = LOG_SINK_FD;
+static __thread int log_sock = -1;
+static __thread struct sockaddr_un log_sock_addr;
+static __thread char log_hostname[256];
+/* Only the process which opened the sink batches, others (e.g. jails) send right away */
+static __thread pid_t log_owner = 0;
+static __thread struct logentry_t *log_batch = NULL;
+static __thread size_t log_batch_cnt = 0;
+static __thread uint64_t log_batch_ms = 0;
+static __thread uint64_t log_sent_total = 0;
+static __thread uint64_t log_batches_total = 0;
+static __thread uint64_t log_dropped_total = 0;
+static __thread uint64_t log_dropped = 0;
+
+/* The jail which is being set up, run or reaped, attached to messages as structured fields */
+static __thread unsigned int log_jail_id = 0;
+static __thread pid_t log_jail_pid = 0;
+static __thread char log_jail_remote[64] = "";
+static __thread const char *log_jail_phase = NULL;
+
+static void logSinkFlush(void);
+
+static bool logSinkConnect(void)
+{
+	if (TEMP_FAILURE_RETRY(connect(log_sock, (const struct sockaddr *)&log_sock_addr,
+				       sizeof(log_sock_addr))) == -1) {
+		return false;
+	}
+	return true;
+}
+
+static void logSinkAtExit(void)
+{
+	logSinkFlush();
+}
+
+/* 'name' or 'name:SOCKET' */
+static bool logIsSink(const char *spec, const char *name)
+{
+	size_t len = strlen(name);
+	return (strncmp(spec, name, len) == 0 && (spec[len] == '\0' || spec[len] == ':'));
+}
+
+static bool logSinkOpen(const char *spec)
+{
+	const char *path;
+	enum logsink_t sink;
+	if (logIsSink(spec, "journald")) {
+		sink = LOG_SINK_JOURNALD;
+		path = spec + strlen("journald");
+		path = (*path == ':') ? path + 1 : LOG_JOURNALD_SOCKET;
+	} else {
+		sink = LOG_SINK_SYSLOG;
+		path = spec + strlen("syslog");
+		path = (*path == ':') ? path + 1 : LOG_SYSLOG_SOCKET;
+	}
+
+	memset(&log_sock_addr, '\0', sizeof(log_sock_addr));
+	log_sock_addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(log_sock_addr.sun_path)) {
+		LOG_E("Log socket path too long: '%s'", path);
+		return false;
+	}
+	snprintf(log_sock_addr.sun_path, sizeof(log_sock_addr.sun_path), "%s", path);
+
+	log_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (log_sock == -1) {
+		PLOG_E("socket(AF_UNIX, SOCK_DGRAM)");
+		return false;
+	}
+	if (logSinkConnect() == false) {
+		PLOG_E("connect('%s')", path);
+		close(log_sock);
+		log_sock = -1;
+		return false;
+	}
+	if (gethostname(log_hostname, sizeof(log_hostname) - 1) == -1 || log_hostname[0] == '\0') {
+		snprintf(log_hostname, sizeof(log_hostname), "-");
+	}
+	if (log_batch == NULL) {
+		log_batch = malloc(sizeof(struct logentry_t) * LOG_BATCH);
+		if (log_batch == NULL) {
+			PLOG_E("malloc(%zu)", sizeof(struct logentry_t) * LOG_BATCH);
+			close(log_sock);
+			log_sock = -1;
+			return false;
+		}
+		atexit(logSinkAtExit);
+	}
+	log_batch_cnt = 0;
+	log_owner = syscall(__NR_getpid);
+	log_sink = sink;
+	return true;
+}
+
 /*
  * Log to stderr by default. Use a dup()d fd, because in the future we'll associate the
  * connection socket with fd (0, 1, 2).
@@ -47,12 +204,19 @@ static __thread bool log_verbose = false;
 bool logInitLogFile(struct nsjconf_t *nsjconf, const char *logfile, bool is_verbose)
 {
 	log_verbose = is_verbose;
+	log_rate = nsjconf->log_rate;
+	log_burst = (nsjconf->log_burst > 0) ? nsjconf->log_burst : 1;
 
 	if (logfile == NULL && nsjconf->daemonize == true) {
 		logfile = _LOG_DEFAULT_FILE;
 	}
 	if (logfile == NULL) {
 		log_fd = STDERR_FILENO;
+	} else if (logIsSink(logfile, "journald") || logIsSink(logfile, "syslog")) {
+		log_fd = STDERR_FILENO;
+		if (logSinkOpen(logfile) == false) {
+			return false;
+		}
 	} else {
 		if (TEMP_FAILURE_RETRY(log_fd = open(logfile, O_CREAT | O_RDWR | O_APPEND, 0640)) == -1) {
 			log_fd = STDERR_FILENO;
@@ -64,22 +228,282 @@ bool logInitLogFile(struct nsjconf_t *nsjconf, const char *logfile, bool is_verb
 	return true;
 }
 
-void logLog(enum llevel_t ll, const char *fn, int ln, bool perr, const char *fmt, ...)
+/* CLOCK_MONOTONIC_COARSE is served from the vDSO, so it doesn't cost a syscall */
+static uint64_t logNowMs(void)
 {
-	if (ll == DEBUG && !log_verbose) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t) ts.tv_sec * 1000ULL + (uint64_t) ts.tv_nsec / 1000000ULL;
+}
+
+static struct logsite_t *logGetSite(const char *fn, int ln)
+{
+	size_t h = (((uintptr_t) fn >> 3) ^ ((size_t) ln * 2654435761U)) % LOG_SITES;
+	for (size_t i = 0; i < LOG_SITES; i++) {
+		struct logsite_t *s = &log_sites[(h + i) % LOG_SITES];
+		if (s->fn == fn && s->ln == ln) {
+			return s;
+		}
+		if (s->fn == NULL) {
+			s->fn = fn;
+			s->ln = ln;
+			s->tokens = (uint64_t) log_burst *1000ULL;
+			s->refilled_ms = logNowMs();
+			return s;
+		}
+	}
+	/* The table is full, messages from this site are not limited */
+	return NULL;
+}
+
+/* Token bucket: log_rate messages per second, up to log_burst at once */
+static bool logRateLimited(struct logsite_t *s, uint64_t now_ms)
+{
+	uint64_t cap = (uint64_t) log_burst *1000ULL;
+	s->tokens += (now_ms - s->refilled_ms) * log_rate;
+	s->tokens = (s->tokens > cap) ? cap : s->tokens;
+	s->refilled_ms = now_ms;
+	if (s->tokens < 1000ULL) {
+		s->suppressed++;
+		s->suppressed_total++;
+		log_suppressed_total++;
+		return true;
+	}
+	s->tokens -= 1000ULL;
+	return false;
+}
+
+/* Fields which don't fit into the entry are left out */
+static void logJournaldField(struct logentry_t *e, const char *key, const char *val)
+{
+	size_t klen = strlen(key);
+	size_t vlen = strlen(val);
+	size_t left = sizeof(e->buf) - e->len;
+	if (strchr(val, '\n') == NULL) {
+		if (klen + 1 + vlen + 1 > left) {
+			return;
+		}
+		e->len += snprintf(&e->buf[e->len], left, "%s=%s\n", key, val);
+		return;
+	}
+	/* Multi-line values: KEY\n, little-endian 64-bit length, the value, \n */
+	if (klen + 1 + 8 + vlen + 1 > left) {
 		return;
 	}
+	memcpy(&e->buf[e->len], key, klen);
+	e->len += klen;
+	e->buf[e->len++] = '\n';
+	for (size_t i = 0; i < 8; i++) {
+		e->buf[e->len++] = (char)(((uint64_t) vlen >> (i * 8)) & 0xff);
+	}
+	memcpy(&e->buf[e->len], val, vlen);
+	e->len += vlen;
+	e->buf[e->len++] = '\n';
+}
 
-	char strerr[512];
-	if (perr == true) {
-		snprintf(strerr, sizeof(strerr), "%s", strerror(errno));
+static void logJournaldFormat(struct logentry_t *e, int prio, const char *fn, int ln,
+			      const char *msg)
+{
+	char num[32];
+	e->len = 0;
+	snprintf(num, sizeof(num), "%d", prio);
+	logJournaldField(e, "PRIORITY", num);
+	logJournaldField(e, "SYSLOG_IDENTIFIER", "nsjail");
+	snprintf(num, sizeof(num), "%d", (int)log_owner);
+	logJournaldField(e, "SYSLOG_PID", num);
+	logJournaldField(e, "CODE_FUNC", fn);
+	snprintf(num, sizeof(num), "%d", ln);
+	logJournaldField(e, "CODE_LINE", num);
+	if (log_jail_id != 0) {
+		snprintf(num, sizeof(num), "%u", log_jail_id);
+		logJournaldField(e, "NSJAIL_JAIL_ID", num);
+	}
+	if (log_jail_pid != 0) {
+		snprintf(num, sizeof(num), "%d", (int)log_jail_pid);
+		logJournaldField(e, "NSJAIL_PID", num);
+	}
+	if (log_jail_remote[0] != '\0') {
+		logJournaldField(e, "NSJAIL_REMOTE", log_jail_remote);
+	}
+	if (log_jail_phase != NULL) {
+		logJournaldField(e, "NSJAIL_PHASE", log_jail_phase);
+	}
+	logJournaldField(e, "MESSAGE", msg);
+}
+
+/* PARAM-VALUE escaping: '"', '\' and ']' */
+static void logSyslogParam(struct logentry_t *e, const char *name, const char *val)
+{
+	size_t left = sizeof(e->buf) - e->len;
+	int len = snprintf(&e->buf[e->len], left, " %s=\"", name);
+	if (len < 0 || (size_t) len >= left) {
+		return;
+	}
+	e->len += len;
+	for (; *val != '\0' && e->len < sizeof(e->buf) - 3; val++) {
+		if (*val == '"' || *val == '\\' || *val == ']') {
+			e->buf[e->len++] = '\\';
+		}
+		e->buf[e->len++] = *val;
+	}
+	e->buf[e->len++] = '"';
+}
+
+/* <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID [SD-ELEMENT] MSG */
+static void logSyslogFormat(struct logentry_t *e, int prio, const char *fn, int ln,
+			    const char *msg)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	struct tm utctime;
+	gmtime_r(&ts.tv_sec, &utctime);
+	char timestr[32];
+	if (strftime(timestr, sizeof(timestr), "%FT%T", &utctime) == 0) {
+		timestr[0] = '\0';
+	}
+
+	int len = snprintf(e->buf, sizeof(e->buf), "<%d>1 %s.%06ldZ %s nsjail %d - [%s",
+			   LOG_SYSLOG_FACILITY * 8 + prio, timestr, ts.tv_nsec / 1000L,
+			   log_hostname, (int)log_owner, LOG_SYSLOG_SDID);
+	e->len = (len < 0) ? 0 : (size_t) len;
+	char num[32];
+	logSyslogParam(e, "func", fn);
+	snprintf(num, sizeof(num), "%d", ln);
+	logSyslogParam(e, "line", num);
+	if (log_jail_id != 0) {
+		snprintf(num, sizeof(num), "%u", log_jail_id);
+		logSyslogParam(e, "jail", num);
+	}
+	if (log_jail_pid != 0) {
+		snprintf(num, sizeof(num), "%d", (int)log_jail_pid);
+		logSyslogParam(e, "pid", num);
+	}
+	if (log_jail_remote[0] != '\0') {
+		logSyslogParam(e, "remote", log_jail_remote);
+	}
+	if (log_jail_phase != NULL) {
+		logSyslogParam(e, "phase", log_jail_phase);
+	}
+	size_t left = sizeof(e->buf) - e->len;
+	len = snprintf(&e->buf[e->len], left, "] %s", msg);
+	e->len = (len < 0 || (size_t) len >= left) ? sizeof(e->buf) - 1 : e->len + len;
+}
+
+static void logSinkFormat(struct logentry_t *e, enum llevel_t ll, const char *fn, int ln,
+			  const char *msg)
+{
+	/* syslog(3) severities */
+	static const int logPrio[] = {
+		[HELP] = 6,
+		[HELP_BOLD] = 6,
+		[DEBUG] = 7,
+		[INFO] = 6,
+		[WARNING] = 4,
+		[ERROR] = 3,
+		[FATAL] = 2,
+	};
+	if (log_sink == LOG_SINK_JOURNALD) {
+		logJournaldFormat(e, logPrio[ll], fn, ln, msg);
+	} else {
+		logSyslogFormat(e, logPrio[ll], fn, ln, msg);
 	}
+}
+
+/* Never blocks, what the receiver doesn't take right away is dropped */
+static void logSinkSend(void)
+{
+	struct mmsghdr msgs[LOG_BATCH];
+	struct iovec iovs[LOG_BATCH];
+	memset(msgs, '\0', sizeof(msgs));
+	for (size_t i = 0; i < log_batch_cnt; i++) {
+		iovs[i].iov_base = log_batch[i].buf;
+		iovs[i].iov_len = log_batch[i].len;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	size_t sent = 0;
+	bool reconnected = false;
+	while (sent < log_batch_cnt) {
+		int ret = sendmmsg(log_sock, &msgs[sent], log_batch_cnt - sent, MSG_DONTWAIT);
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		/* The receiver was restarted, and its socket re-created */
+		if (ret == -1 && (errno == ECONNREFUSED || errno == ENOTCONN)
+		    && reconnected == false) {
+			reconnected = true;
+			if (logSinkConnect() == true) {
+				continue;
+			}
+		}
+		break;
+	}
+	log_batches_total++;
+	log_sent_total += sent;
+	log_dropped += log_batch_cnt - sent;
+	log_dropped_total += log_batch_cnt - sent;
+	log_batch_cnt = 0;
+}
+
+static void logSinkFlush(void)
+{
+	if (log_sink == LOG_SINK_FD || log_batch_cnt == 0) {
+		return;
+	}
+	if (syscall(__NR_getpid) != log_owner) {
+		/* Inherited from the parent, which sends them itself */
+		log_batch_cnt = 0;
+		return;
+	}
+	logSinkSend();
+}
+
+static void logSinkQueue(enum llevel_t ll, const char *fn, int ln, const char *msg)
+{
+	bool owner = (syscall(__NR_getpid) == log_owner);
+	if (owner == false) {
+		log_batch_cnt = 0;
+	}
+	uint64_t now_ms = logNowMs();
+	if (log_batch_cnt == 0) {
+		log_batch_ms = now_ms;
+	}
+	/* Reported as soon as there's space for it again */
+	if (log_dropped > 0 && log_batch_cnt < LOG_BATCH - 1) {
+		char note[128];
+		snprintf(note, sizeof(note), "%" PRIu64 " log messages dropped, the receiver was "
+			 "too slow", log_dropped);
+		logSinkFormat(&log_batch[log_batch_cnt++], WARNING, __func__, __LINE__, note);
+		log_dropped = 0;
+	}
+	logSinkFormat(&log_batch[log_batch_cnt++], ll, fn, ln, msg);
+
+	if (owner == false || ll >= WARNING || log_batch_cnt == LOG_BATCH
+	    || now_ms - log_batch_ms >= LOG_BATCH_MS) {
+		logSinkSend();
+	}
+}
+
+/* The whole line is written with a single write() */
+static void logWrite(enum llevel_t ll, const char *fn, int ln, const char *msg)
+{
+	/* Help messages are meant for the operator's console */
+	if (log_sink != LOG_SINK_FD && ll != HELP && ll != HELP_BOLD) {
+		logSinkQueue(ll, fn, ln, msg);
+		return;
+	}
+
 	struct ll_t {
 		char *descr;
 		char *prefix;
 		bool print_funcline;
 	};
-	struct ll_t logLevels[] = {
+	static const struct ll_t logLevels[] = {
 		{"HR", "\033[0m", false},
 		{"HB", "\033[1m", false},
 		{"D", "\033[0;4m", true},
@@ -89,42 +513,182 @@ void logLog(enum llevel_t ll, const char *fn, int ln, bool perr, const char *fmt
 		{"F", "\033[7;35m", true},
 	};
 
-	time_t ltstamp = time(NULL);
-	struct tm utctime;
-	localtime_r(&ltstamp, &utctime);
-	char timestr[32];
-	if (strftime(timestr, sizeof(timestr) - 1, "%FT%T%z", &utctime) == 0) {
-		timestr[0] = '\0';
+	char timestr[32] = "";
+	if (logLevels[ll].print_funcline) {
+		time_t ltstamp = time(NULL);
+		struct tm utctime;
+		localtime_r(&ltstamp, &utctime);
+		if (strftime(timestr, sizeof(timestr) - 1, "%FT%T%z", &utctime) == 0) {
+			timestr[0] = '\0';
+		}
 	}
 
-	/* Start printing logs */
-	if (log_fd_isatty) {
-		dprintf(log_fd, "%s", logLevels[ll].prefix);
-	}
+	char buf[8192];
+	int len;
 	if (logLevels[ll].print_funcline) {
-		dprintf(log_fd, "[%s][%s][%ld] %s():%d ", timestr, logLevels[ll].descr,
-			syscall(__NR_getpid), fn, ln);
+		len = snprintf(buf, sizeof(buf), "%s[%s][%s][%ld] %s():%d %s%s\n",
+			       log_fd_isatty ? logLevels[ll].prefix : "", timestr,
+			       logLevels[ll].descr, syscall(__NR_getpid), fn, ln, msg,
+			       log_fd_isatty ? "\033[0m" : "");
+	} else {
+		len = snprintf(buf, sizeof(buf), "%s%s%s\n",
+			       log_fd_isatty ? logLevels[ll].prefix : "", msg,
+			       log_fd_isatty ? "\033[0m" : "");
+	}
+	if (len < 0) {
+		return;
+	}
+	if ((size_t) len >= sizeof(buf)) {
+		len = sizeof(buf) - 1;
+		buf[len - 1] = '\n';
+	}
+	if (TEMP_FAILURE_RETRY(write(log_fd, buf, len)) == -1) {
+		return;
 	}
+}
 
+static void logFlushRepeated(void)
+{
+	if (log_repeated == 0) {
+		return;
+	}
+	char msg[128];
+	snprintf(msg, sizeof(msg), "Last message repeated %" PRIu64 " times", log_repeated);
+	logWrite(log_last_ll, log_last_fn, log_last_ln, msg);
+	log_repeated = 0;
+}
+
+void logLog(enum llevel_t ll, const char *fn, int ln, bool perr, const char *fmt, ...)
+{
+	if (ll == DEBUG && !log_verbose) {
+		return;
+	}
+
+	char strerr[512];
+	if (perr == true) {
+		snprintf(strerr, sizeof(strerr), "%s", strerror(errno));
+	}
+
+	/* Help and fatal messages are never suppressed */
+	bool limited = (ll != HELP && ll != HELP_BOLD && ll != FATAL);
+	uint64_t now_ms = 0;
+	uint64_t suppressed = 0;
+	if (limited) {
+		now_ms = logNowMs();
+		struct logsite_t *s = (log_rate > 0
+				       && log_rate_paused == false) ? logGetSite(fn, ln) : NULL;
+		if (s != NULL && logRateLimited(s, now_ms) == true) {
+			return;
+		}
+		if (s != NULL) {
+			suppressed = s->suppressed;
+			s->suppressed = 0;
+		}
+	}
+
+	char msg[4096];
 	va_list args;
 	va_start(args, fmt);
-	vdprintf(log_fd, fmt, args);
+	vsnprintf(msg, sizeof(msg), fmt, args);
 	va_end(args);
 	if (perr == true) {
-		dprintf(log_fd, ": %s", strerr);
+		size_t len = strlen(msg);
+		snprintf(&msg[len], sizeof(msg) - len, ": %s", strerr);
 	}
-	if (log_fd_isatty) {
-		dprintf(log_fd, "\033[0m");
+
+	if (limited) {
+		if (suppressed == 0 && ll == log_last_ll && fn == log_last_fn && ln == log_last_ln
+		    && strcmp(msg, log_last) == 0
+		    && now_ms - log_last_ms < LOG_REPEAT_WINDOW_MS) {
+			log_repeated++;
+			log_repeated_total++;
+			return;
+		}
+		logFlushRepeated();
+		snprintf(log_last, sizeof(log_last), "%s", msg);
+		log_last_ll = ll;
+		log_last_fn = fn;
+		log_last_ln = ln;
+		log_last_ms = now_ms;
 	}
-	dprintf(log_fd, "\n");
-	/* End printing logs */
+	if (suppressed > 0) {
+		char note[256];
+		snprintf(note, sizeof(note), "%" PRIu64 " messages suppressed by the rate limit",
+			 suppressed);
+		logWrite(WARNING, fn, ln, note);
+	}
+	logWrite(ll, fn, ln, msg);
 
 	if (ll == FATAL) {
+		logSinkFlush();
 		exit(1);
 	}
 }
 
+/* Used around output requested by the operator (e.g. with SIGUSR1), which is never dropped */
+void logPauseRateLimit(bool pause)
+{
+	log_rate_paused = pause;
+}
+
+/*
+ * Sends the batched entries, and the summary of a repeated message once its window is over,
+ * even if no other message comes. Called from the main loop, which the SIGALRM timer wakes up
+ */
+void logFlush(void)
+{
+	if (log_repeated > 0 && logNowMs() - log_last_ms >= LOG_REPEAT_WINDOW_MS) {
+		logFlushRepeated();
+	}
+	logSinkFlush();
+}
+
+/* Log entries are batched in this process from now on (e.g. after daemon()) */
+void logSetOwner(void)
+{
+	log_owner = syscall(__NR_getpid);
+}
+
+void logSetJail(unsigned int jail_id, pid_t pid, const char *remote)
+{
+	log_jail_id = jail_id;
+	log_jail_pid = pid;
+	snprintf(log_jail_remote, sizeof(log_jail_remote), "%s", remote ? remote : "");
+}
+
+/* A string constant, e.g. "spawn" */
+void logSetPhase(const char *phase)
+{
+	log_jail_phase = phase;
+}
+
+void logClearJail(void)
+{
+	logSetJail(0, 0, NULL);
+	logSetPhase(NULL);
+}
+
+void logDisplay(void)
+{
+	logFlushRepeated();
+	LOG_I("Log: %" PRIu64 " messages suppressed by the rate limit, %" PRIu64
+	      " coalesced as repeated", log_suppressed_total, log_repeated_total);
+	if (log_sink != LOG_SINK_FD) {
+		LOG_I("Log: %" PRIu64 " messages sent to '%s' in %" PRIu64 " batches, %" PRIu64
+		      " dropped", log_sent_total, log_sock_addr.sun_path, log_batches_total,
+		      log_dropped_total);
+	}
+	for (size_t i = 0; i < LOG_SITES; i++) {
+		struct logsite_t *s = &log_sites[i];
+		if (s->fn != NULL && s->suppressed_total > 0) {
+			LOG_I("Log: %s():%d, suppressed: %" PRIu64 " (%" PRIu64 " since it was last "
+			      "logged)", s->fn, s->ln, s->suppressed_total, s->suppressed);
+		}
+	}
+}
+
 void logStop(int sig)
 {
+	logFlushRepeated();
 	LOG_I("Server stops due to fatal signal (%d) caught. Exiting", sig);
 }
@@ -55,6 +55,13 @@ enum llevel_t {
 bool logInitLogFile(struct nsjconf_t *nsjconf, const char *logfile, bool is_verbose);
 void logLog(enum llevel_t ll, const char *fn, int ln, bool perr, const char *fmt, ...)
     __attribute__ ((format(printf, 5, 6)));
+void logPauseRateLimit(bool pause);
+void logFlush(void);
+void logSetOwner(void);
+void logSetJail(unsigned int jail_id, pid_t pid, const char *remote);
+void logSetPhase(const char *phase);
+void logClearJail(void);
+void logDisplay(void);
 void logStop(int sig);
 
 #endif				/* NS_LOG_H */
@@ -249,6 +249,15 @@ static bool mountInitNsInternal(struct nsjconf_t *nsjconf)
  */
 bool mountInitNs(struct nsjconf_t * nsjconf)
 {
+	/* File-system access is confined later on, in sandboxApply() */
+	if (nsjconf->landlock == true) {
+		if (chdir(nsjconf->cwd) == -1) {
+			PLOG_E("chdir('%s')", nsjconf->cwd);
+			return false;
+		}
+		return true;
+	}
+
 	if (nsjconf->mode != MODE_STANDALONE_EXECVE) {
 		return mountInitNsInternal(nsjconf);
 	}
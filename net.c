@@ -23,6 +23,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <linux/filter.h>
 #include <net/if.h>
 #include <net/route.h>
 #include <netinet/ip6.h>
@@ -42,6 +43,7 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "session.h"
 
 #define IFACE_NAME "vs"
 
@@ -224,8 +226,40 @@ bool netLimitConns(struct nsjconf_t * nsjconf, int connsock)
 	return true;
 }
 
-int netGetRecvSocket(const char *bindhost, int port)
+/*
+ * Connections are steered to the listening socket with index (receiving CPU % group size),
+ * sockets get their indexes in the order in which they joined the SO_REUSEPORT group
+ */
+static bool netSetReusePort(int sockfd, unsigned int group)
+{
+	int so = 1;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &so, sizeof(so)) == -1) {
+		PLOG_E("setsockopt(%d, SO_REUSEPORT)", sockfd);
+		return false;
+	}
+	if (group < 2) {
+		return true;
+	}
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, group),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = ARRAYSIZE(code),
+		.filter = code,
+	};
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+		PLOG_E("setsockopt(%d, SO_ATTACH_REUSEPORT_CBPF)", sockfd);
+		return false;
+	}
+	return true;
+}
+
+int netGetRecvSocket(struct nsjconf_t *nsjconf)
 {
+	const char *bindhost = nsjconf->bindhost;
+	int port = nsjconf->port;
 	if (port < 1 || port > 65535) {
 		LOG_F("TCP port %d out of bounds (0 <= port <= 65535)", port);
 	}
@@ -246,6 +280,10 @@ int netGetRecvSocket(const char *bindhost, int port)
 		PLOG_E("setsockopt(%d, SO_REUSEADDR)", sockfd);
 		return -1;
 	}
+	if (nsjconf->reuseport > 0 && netSetReusePort(sockfd, nsjconf->reuseport) == false) {
+		close(sockfd);
+		return -1;
+	}
 	struct sockaddr_in6 addr = {
 		.sin6_family = AF_INET6,
 		.sin6_port = htons(port),
@@ -258,6 +296,15 @@ int netGetRecvSocket(const char *bindhost, int port)
 		PLOG_E("bind(host:[%s], port:%d)", bindhost, port);
 		return -1;
 	}
+	/*
+	 * Sessions start with a line from the client, which usually arrives with the first segment.
+	 * Accepting the connection once it has saves a poll() round, conn.c doesn't rely on it
+	 */
+	so = SESSION_HELLO_TIMEOUT_SEC;
+	if (nsjconf->session_grace > 0
+	    && setsockopt(sockfd, SOL_TCP, TCP_DEFER_ACCEPT, &so, sizeof(so)) == -1) {
+		PLOG_W("setsockopt(%d, TCP_DEFER_ACCEPT)", sockfd);
+	}
 	if (listen(sockfd, SOMAXCONN) == -1) {
 		close(sockfd);
 		PLOG_E("listen(%d)", SOMAXCONN);
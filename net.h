@@ -28,7 +28,7 @@
 #include "common.h"
 
 bool netLimitConns(struct nsjconf_t *nsjconf, int connsock);
-int netGetRecvSocket(const char *bindhost, int port);
+int netGetRecvSocket(struct nsjconf_t *nsjconf);
 int netAcceptConn(int listenfd);
 void netConnToText(int fd, bool remote, char *buf, size_t s, struct sockaddr_in6 *addr_or_null);
 bool netInitNsFromParent(struct nsjconf_t *nsjconf, int pid);
@@ -30,13 +30,21 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "admit.h"
+#include "cache.h"
 #include "cmdline.h"
+#include "conn.h"
+#include "libnsjail.h"
 #include "log.h"
 #include "net.h"
+#include "pty.h"
 #include "subproc.h"
+#include "warmup.h"
 
 static __thread int nsjailSigFatal = 0;
 static __thread bool nsjailShowProc = false;
+static __thread bool nsjailReload = false;
+static __thread bool nsjailWinch = false;
 
 static void nsjailSig(int sig)
 {
@@ -50,6 +58,14 @@ static void nsjailSig(int sig)
 		nsjailShowProc = true;
 		return;
 	}
+	if (sig == SIGHUP) {
+		nsjailReload = true;
+		return;
+	}
+	if (sig == SIGWINCH) {
+		nsjailWinch = true;
+		return;
+	}
 	nsjailSigFatal = sig;
 }
 
@@ -72,8 +88,18 @@ static bool nsjailSetSigHandler(int sig)
 	return true;
 }
 
-static bool nsjailSetSigHandlers(void)
+static bool nsjailSetSigHandlers(struct nsjconf_t *nsjconf)
 {
+	/* Restarts the warmup, otherwise SIGHUP keeps its default action */
+	if (nsjconf->mode == MODE_LISTEN_TCP && TAILQ_EMPTY(&nsjconf->warmup) == false
+	    && nsjailSetSigHandler(SIGHUP) == false) {
+		return false;
+	}
+	/* Passed on to the jail's pty, the size of a TCP connection's terminal is unknown */
+	if (nsjconf->pty == true && nsjconf->mode != MODE_LISTEN_TCP
+	    && nsjailSetSigHandler(SIGWINCH) == false) {
+		return false;
+	}
 	if (nsjailSetSigHandler(SIGINT) == false) {
 		return false;
 	}
@@ -92,15 +118,22 @@ static bool nsjailSetSigHandlers(void)
 	return true;
 }
 
+/* The interval is shortened by subprocReap() when a jail gets close to its CPU time limit */
 static bool nsjailSetTimer(struct nsjconf_t *nsjconf)
 {
 	if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
 		return true;
 	}
 
+	static unsigned int interval_ms = 0;
+	if (nsjconf->reap_interval_ms == interval_ms) {
+		return true;
+	}
+	interval_ms = nsjconf->reap_interval_ms;
+
 	struct itimerval it = {
-		.it_value = {.tv_sec = 1,.tv_usec = 0},
-		.it_interval = {.tv_sec = 1,.tv_usec = 0},
+		.it_value = {.tv_sec = interval_ms / 1000,.tv_usec = (interval_ms % 1000) * 1000},
+		.it_interval = {.tv_sec = interval_ms / 1000,.tv_usec = (interval_ms % 1000) * 1000},
 	};
 	if (setitimer(ITIMER_REAL, &it, NULL) == -1) {
 		PLOG_E("setitimer(ITIMER_REAL)");
@@ -111,7 +144,7 @@ static bool nsjailSetTimer(struct nsjconf_t *nsjconf)
 
 static void nsjailListenMode(struct nsjconf_t *nsjconf)
 {
-	int listenfd = netGetRecvSocket(nsjconf->bindhost, nsjconf->port);
+	int listenfd = netGetRecvSocket(nsjconf);
 	if (listenfd == -1) {
 		return;
 	}
@@ -124,25 +157,46 @@ static void nsjailListenMode(struct nsjconf_t *nsjconf)
 		}
 		if (nsjailShowProc == true) {
 			nsjailShowProc = false;
+			logPauseRateLimit(true);
 			subprocDisplay(nsjconf);
+			admitDisplay(nsjconf);
+			logDisplay();
+			logPauseRateLimit(false);
+		}
+		if (nsjailReload == true) {
+			nsjailReload = false;
+			warmupInit(nsjconf);
 		}
-		int connfd = netAcceptConn(listenfd);
+		logFlush();
+		int connfd = ptyWait(nsjconf, listenfd) ? netAcceptConn(listenfd) : -1;
 		if (connfd >= 0) {
-			subprocRunChild(nsjconf, connfd, connfd, connfd);
-			close(connfd);
+			connAdd(nsjconf, connfd);
 		}
 		subprocReap(nsjconf);
+		nsjailSetTimer(nsjconf);
+		if (warmupReady(nsjconf) == true) {
+			admitDispatch(nsjconf);
+		}
 	}
 }
 
 static int nsjailStandaloneMode(struct nsjconf_t *nsjconf)
 {
-	subprocRunChild(nsjconf, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+	int fd_in = STDIN_FILENO, fd_out = STDOUT_FILENO, fd_err = STDERR_FILENO;
+	int cached_status;
+	if (cacheLookup(nsjconf, &fd_in, &fd_out, &fd_err, &cached_status) == true) {
+		return cached_status;
+	}
+	warmupWait(nsjconf);
+	subprocRunChild(nsjconf, fd_in, fd_out, fd_err);
 	for (;;) {
 		int child_status = subprocReap(nsjconf);
+		nsjailSetTimer(nsjconf);
 
 		if (subprocCount(nsjconf) == 0) {
+			ptyFinish(nsjconf);
 			if (nsjconf->mode == MODE_STANDALONE_ONCE) {
+				cacheStore(nsjconf, child_status);
 				return child_status;
 			}
 			subprocRunChild(nsjconf, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
@@ -150,15 +204,24 @@ static int nsjailStandaloneMode(struct nsjconf_t *nsjconf)
 		}
 		if (nsjailShowProc == true) {
 			nsjailShowProc = false;
+			logPauseRateLimit(true);
 			subprocDisplay(nsjconf);
+			logDisplay();
+			logPauseRateLimit(false);
+		}
+		if (nsjailWinch == true) {
+			nsjailWinch = false;
+			ptyResize(nsjconf);
 		}
 		if (nsjailSigFatal > 0) {
 			subprocKillAll(nsjconf);
+			ptyFinish(nsjconf);
 			logStop(nsjailSigFatal);
 			return -1;
 		}
 
-		pause();
+		logFlush();
+		ptyWait(nsjconf, -1);
 	}
 	// not reached
 }
@@ -172,11 +235,18 @@ int main(int argc, char *argv[])
 	if (nsjconf.clone_newuser == false && geteuid() != 0) {
 		LOG_W("--disable_clone_newuser requires root() privs");
 	}
-	if (nsjconf.daemonize && (daemon(0, 0) == -1)) {
-		PLOG_F("daemon");
+	if (nsjconf.daemonize) {
+		logFlush();
+		if (daemon(0, 0) == -1) {
+			PLOG_F("daemon");
+		}
+		logSetOwner();
 	}
 	cmdlineLogParams(&nsjconf);
-	if (nsjailSetSigHandlers() == false) {
+	if (nsjailInit(&nsjconf) == false) {
+		exit(1);
+	}
+	if (nsjailSetSigHandlers(&nsjconf) == false) {
 		exit(1);
 	}
 	if (nsjailSetTimer(&nsjconf) == false) {
@@ -0,0 +1,240 @@
+/*
+
+   nsjail - hardware performance counters of jails
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "perf.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+struct perfevent_t {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+};
+
+/* The first event is the group leader. The IPC is computed from the first two */
+static const struct perfevent_t perfHwEvents[PERF_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache misses"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context switches"},
+};
+
+/* Used where the hardware PMU is not available, e.g. in most virtual machines */
+static const struct perfevent_t perfSwEvents[PERF_EVENTS] = {
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task clock (ns)"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page faults"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "CPU migrations"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context switches"},
+};
+
+/* Intervals shorter than this (in cycles) are too noisy to judge the IPC */
+#define PERF_SAMPLE_MIN_CYCLES 100000000ULL
+
+static const struct perfevent_t *perfEvents = perfHwEvents;
+
+/*
+ * The counters follow the task (on any CPU) and, with inherit, all of its descendants, which
+ * includes processes that left its process group or PID namespace
+ */
+static int perfOpen(const struct perfevent_t *ev, pid_t pid, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, '\0', sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = ev->type;
+	attr.config = ev->config;
+	attr.read_format =
+	    PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.inherit = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, pid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perfClose(int fds[PERF_EVENTS])
+{
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		if (fds[i] != -1) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+/* The first event is the group leader, at fds[0] */
+static bool perfOpenGroup(const struct perfevent_t *evs, pid_t pid, int fds[PERF_EVENTS])
+{
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		fds[i] = -1;
+	}
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		fds[i] = perfOpen(&evs[i], pid, fds[0]);
+		if (fds[i] == -1) {
+			PLOG_D("perf_event_open('%s', PID: %d)", evs[i].name, (int)pid);
+			perfClose(fds);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * One read() returns the whole group, summed over the task and its descendants. Counts are
+ * scaled if the PMU was multiplexed
+ */
+static bool perfRead(int fds[PERF_EVENTS], uint64_t vals[PERF_EVENTS])
+{
+	struct {
+		uint64_t nr;
+		uint64_t time_enabled;
+		uint64_t time_running;
+		uint64_t values[PERF_EVENTS];
+	} rf;
+	if (TEMP_FAILURE_RETRY(read(fds[0], &rf, sizeof(rf))) != (ssize_t) sizeof(rf)) {
+		PLOG_D("read(perf fd #%d)", fds[0]);
+		return false;
+	}
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		vals[i] = rf.values[i];
+		if (rf.time_running > 0 && rf.time_running < rf.time_enabled) {
+			vals[i] = (uint64_t) ((double)vals[i] * rf.time_enabled / rf.time_running);
+		}
+	}
+	return true;
+}
+
+/*
+ * Checks if the counters can be used at all (counting the kernel too requires CAP_PERFMON, or
+ * kernel.perf_event_paranoid <= 1), and whether the hardware ones are available
+ */
+bool perfInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->perf == false) {
+		return true;
+	}
+
+	int fds[PERF_EVENTS];
+	if (perfOpenGroup(perfHwEvents, 0, fds) == true) {
+		perfEvents = perfHwEvents;
+	} else if (perfOpenGroup(perfSwEvents, 0, fds) == true) {
+		LOG_W("Hardware performance counters are not available, only software counters "
+		      "will be collected");
+		perfEvents = perfSwEvents;
+	} else {
+		PLOG_E("perf_event_open(). It requires CAP_PERFMON, or the "
+		       "kernel.perf_event_paranoid sysctl <= 1");
+		return false;
+	}
+	perfClose(fds);
+
+	if (perfEvents == perfSwEvents
+	    && (nsjconf->perf_ipc_min > 0.0 || nsjconf->perf_ipc_max > 0.0)) {
+		LOG_W("--perf_ipc_min/--perf_ipc_max need hardware counters, IPC won't be checked");
+	}
+	return true;
+}
+
+/*
+ * Called before the new process is allowed to continue, so everything it starts is counted.
+ * A jail restored by CRIU is only counted from the restore on, with its later descendants
+ */
+void perfInitFromParent(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	p->perf_flagged = false;
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		p->perf_fds[i] = -1;
+		p->perf_last[i] = 0;
+	}
+	if (nsjconf->perf == false) {
+		return;
+	}
+	if (perfOpenGroup(perfEvents, p->pid, p->perf_fds) == false) {
+		PLOG_W("Couldn't attach performance counters to PID: %d", (int)p->pid);
+	}
+}
+
+/*
+ * Jails whose IPC over the last sampling interval is out of the expected range, e.g. memory
+ * thrashers (low), or tight compute loops like crypto miners (high), are reported once
+ */
+void perfSample(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	if (p->perf_fds[0] == -1 || perfEvents != perfHwEvents || p->perf_flagged == true) {
+		return;
+	}
+	if (nsjconf->perf_ipc_min <= 0.0 && nsjconf->perf_ipc_max <= 0.0) {
+		return;
+	}
+
+	uint64_t vals[PERF_EVENTS];
+	if (perfRead(p->perf_fds, vals) == false) {
+		return;
+	}
+	uint64_t instructions = vals[0] - p->perf_last[0];
+	uint64_t cycles = vals[1] - p->perf_last[1];
+	uint64_t misses = vals[2] - p->perf_last[2];
+	if (cycles < PERF_SAMPLE_MIN_CYCLES) {
+		return;
+	}
+	memcpy(p->perf_last, vals, sizeof(p->perf_last));
+
+	double ipc = (double)instructions / cycles;
+	if ((nsjconf->perf_ipc_min > 0.0 && ipc < nsjconf->perf_ipc_min)
+	    || (nsjconf->perf_ipc_max > 0.0 && ipc > nsjconf->perf_ipc_max)) {
+		LOG_W("PID: %d has anomalous IPC: %.2f (allowed: %.2f-%.2f), instructions: %" PRIu64
+		      ", cycles: %" PRIu64 ", cache misses per 1k instructions: %.1f (%s)", p->pid,
+		      ipc, nsjconf->perf_ipc_min, nsjconf->perf_ipc_max, instructions, cycles,
+		      instructions ? (double)misses * 1000.0 / instructions : 0.0, p->remote_txt);
+		p->perf_flagged = true;
+	}
+}
+
+/* Appends the final counts to the accounting record of the jail (in buf) */
+void perfAccounting(struct pids_t *p, char *buf, size_t len)
+{
+	uint64_t vals[PERF_EVENTS];
+	if (p->perf_fds[0] == -1 || perfRead(p->perf_fds, vals) == false) {
+		return;
+	}
+
+	char ipc[64] = "";
+	if (perfEvents == perfHwEvents && vals[1] > 0) {
+		snprintf(ipc, sizeof(ipc), " (IPC: %.2f)", (double)vals[0] / vals[1]);
+	}
+	size_t off = strlen(buf);
+	snprintf(buf + off, len - off, ", %s: %" PRIu64 ", %s: %" PRIu64 "%s, %s: %" PRIu64
+		 ", %s: %" PRIu64, perfEvents[0].name, vals[0], perfEvents[1].name, vals[1], ipc,
+		 perfEvents[2].name, vals[2], perfEvents[3].name, vals[3]);
+}
+
+void perfFinishFromParent(struct pids_t *p)
+{
+	perfClose(p->perf_fds);
+}
@@ -0,0 +1,36 @@
+/*
+
+   nsjail - hardware performance counters of jails
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_PERF_H
+#define NS_PERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+bool perfInit(struct nsjconf_t *nsjconf);
+void perfInitFromParent(struct nsjconf_t *nsjconf, struct pids_t *p);
+void perfSample(struct nsjconf_t *nsjconf, struct pids_t *p);
+void perfAccounting(struct pids_t *p, char *buf, size_t len);
+void perfFinishFromParent(struct pids_t *p);
+
+#endif				/* NS_PERF_H */
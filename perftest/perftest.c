@@ -0,0 +1,453 @@
+/*
+
+   nsjail - spawn performance regression test
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * Driven by perftest.sh (see 'make perftest'):
+ *
+ *   perftest payload
+ *     Runs in the jail, prints its start time (CLOCK_MONOTONIC isn't namespaced) and exits
+ *   perftest hold
+ *     Like payload, but exits only once its stdin is closed
+ *   perftest standalone SCENARIO RUNS NSJAIL [ARG...]
+ *     Runs 'NSJAIL ARG... -- perftest payload' RUNS times
+ *   perftest listen SCENARIO RUNS PORT NSJAIL [ARG...]
+ *     Starts 'NSJAIL -Ml --port PORT ARG... -- perftest payload', and connects to it RUNS times
+ *   perftest mem SCENARIO RUNS JAILS NSJAIL [ARG...]
+ *     Keeps JAILS instances of 'NSJAIL ARG... -- perftest hold' running at the same time, RUNS
+ *     times
+ *
+ * For each phase, 'SCENARIO PHASE MEDIAN_US P90_US RUNS' is printed:
+ *   spawn:  from the start of nsjail (or the connect()) to the start of the payload
+ *   exit:   from the start of the payload to the exit of nsjail (or the end of the connection)
+ *   total:  both
+ * and for the mem mode, 'SCENARIO mem_kib MEDIAN_KIB P90_KIB RUNS', where the sample is the
+ * growth of the kernel's unreclaimable memory (SUnreclaim, KernelStack and PageTables in
+ * /proc/meminfo) per running jail, i.e. mostly the cost of its namespaces.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERFTEST_MAX_ARGS 512
+/* How long the listening nsjail can take to start */
+#define PERFTEST_LISTEN_TIMEOUT_MS 5000
+
+enum {
+	PHASE_SPAWN = 0,
+	PHASE_EXIT,
+	PHASE_TOTAL,
+	PHASE_CNT,
+};
+
+static const char *perftestPhases[PHASE_CNT] = {
+	[PHASE_SPAWN] = "spawn",
+	[PHASE_EXIT] = "exit",
+	[PHASE_TOTAL] = "total",
+};
+
+static uint64_t perftestNowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int perftestPayload(bool hold)
+{
+	printf("T %" PRIu64 "\n", perftestNowNs());
+	fflush(stdout);
+	char buf[64];
+	while (hold && (read(STDIN_FILENO, buf, sizeof(buf)) > 0 || errno == EINTR)) ;
+	return 0;
+}
+
+/* Reads the payload's start time, and everything up to EOF */
+static bool perftestReadPayload(int fd, uint64_t * start_ns)
+{
+	char buf[256];
+	size_t len = 0;
+	for (;;) {
+		ssize_t sz = read(fd, &buf[len], sizeof(buf) - 1 - len);
+		if (sz == -1 && errno == EINTR) {
+			continue;
+		}
+		if (sz <= 0) {
+			break;
+		}
+		len += sz;
+		if (len == sizeof(buf) - 1) {
+			break;
+		}
+	}
+	buf[len] = '\0';
+	return (sscanf(buf, "T %" SCNu64, start_ns) == 1);
+}
+
+static int perftestCmpU64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void perftestReport(const char *scenario, uint64_t * samples[PHASE_CNT], int runs)
+{
+	for (int i = 0; i < PHASE_CNT; i++) {
+		qsort(samples[i], runs, sizeof(uint64_t), perftestCmpU64);
+		uint64_t med = samples[i][runs / 2];
+		uint64_t p90 = samples[i][(runs * 9) / 10 < runs ? (runs * 9) / 10 : runs - 1];
+		printf("%s %s %" PRIu64 " %" PRIu64 " %d\n", scenario, perftestPhases[i],
+		       med / 1000, p90 / 1000, runs);
+	}
+}
+
+/* nsjail's arguments, with '--' and the payload appended */
+static char **perftestArgv(char *self, int argc, char **argv, const char *mode, int port,
+			   char *payload)
+{
+	static char *args[PERFTEST_MAX_ARGS];
+	static char portstr[16];
+	int n = 0;
+	args[n++] = argv[0];
+	if (mode != NULL) {
+		args[n++] = "-Ml";
+		args[n++] = "--port";
+		snprintf(portstr, sizeof(portstr), "%d", port);
+		args[n++] = portstr;
+	}
+	for (int i = 1; i < argc && n < PERFTEST_MAX_ARGS - 4; i++) {
+		args[n++] = argv[i];
+	}
+	args[n++] = "--";
+	args[n++] = self;
+	args[n++] = payload;
+	args[n] = NULL;
+	return args;
+}
+
+static pid_t perftestStart(char **args, int in_fd, int out_fd)
+{
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		if (out_fd != -1) {
+			dup2(out_fd, STDOUT_FILENO);
+		}
+		if (in_fd == -1) {
+			in_fd = open("/dev/null", O_RDWR);
+		}
+		if (in_fd != -1) {
+			dup2(in_fd, STDIN_FILENO);
+		}
+		execv(args[0], args);
+		perror("execv");
+		_exit(1);
+	}
+	return pid;
+}
+
+static int perftestStandalone(char *self, const char *scenario, int runs, int argc, char **argv)
+{
+	char **args = perftestArgv(self, argc, argv, NULL, 0, "payload");
+	uint64_t *samples[PHASE_CNT];
+	for (int i = 0; i < PHASE_CNT; i++) {
+		samples[i] = calloc(runs, sizeof(uint64_t));
+	}
+
+	for (int r = 0; r < runs; r++) {
+		int pipefd[2];
+		if (pipe2(pipefd, O_CLOEXEC) == -1) {
+			perror("pipe2");
+			return 1;
+		}
+		uint64_t t0 = perftestNowNs();
+		pid_t pid = perftestStart(args, -1, pipefd[1]);
+		close(pipefd[1]);
+		if (pid == -1) {
+			return 1;
+		}
+		uint64_t start_ns;
+		bool ok = perftestReadPayload(pipefd[0], &start_ns);
+		close(pipefd[0]);
+		int status;
+		while (waitpid(pid, &status, 0) == -1 && errno == EINTR) ;
+		uint64_t t1 = perftestNowNs();
+		if (ok == false || WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: nsjail failed (status: %#x)\n", scenario, status);
+			return 2;
+		}
+		samples[PHASE_SPAWN][r] = start_ns - t0;
+		samples[PHASE_EXIT][r] = t1 - start_ns;
+		samples[PHASE_TOTAL][r] = t1 - t0;
+	}
+	perftestReport(scenario, samples, runs);
+	return 0;
+}
+
+static int perftestConnect(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* One connection: the spawn time from connect(), and the exit time up to EOF */
+static bool perftestConnOnce(int port, uint64_t * spawn_ns, uint64_t * exit_ns)
+{
+	uint64_t t0 = perftestNowNs();
+	int fd = perftestConnect(port);
+	if (fd == -1) {
+		return false;
+	}
+	uint64_t start_ns;
+	bool ok = perftestReadPayload(fd, &start_ns);
+	uint64_t t1 = perftestNowNs();
+	close(fd);
+	if (ok == false) {
+		return false;
+	}
+	*spawn_ns = start_ns - t0;
+	*exit_ns = t1 - start_ns;
+	return true;
+}
+
+static int perftestListen(char *self, const char *scenario, int runs, int port, int argc,
+			  char **argv)
+{
+	char **args = perftestArgv(self, argc, argv, "listen", port, "payload");
+	pid_t pid = perftestStart(args, -1, -1);
+	if (pid == -1) {
+		return 1;
+	}
+
+	/* The first connection also waits for nsjail to start listening, it's not counted */
+	int ret = 2;
+	uint64_t spawn_ns, exit_ns;
+	uint64_t deadline = perftestNowNs() + PERFTEST_LISTEN_TIMEOUT_MS * 1000000ULL;
+	while (perftestConnOnce(port, &spawn_ns, &exit_ns) == false) {
+		if (perftestNowNs() > deadline || waitpid(pid, NULL, WNOHANG) == pid) {
+			fprintf(stderr, "%s: couldn't connect to nsjail on port %d\n", scenario,
+				port);
+			goto out;
+		}
+		usleep(10000);
+	}
+
+	uint64_t *samples[PHASE_CNT];
+	for (int i = 0; i < PHASE_CNT; i++) {
+		samples[i] = calloc(runs, sizeof(uint64_t));
+	}
+	for (int r = 0; r < runs; r++) {
+		if (perftestConnOnce(port, &spawn_ns, &exit_ns) == false) {
+			fprintf(stderr, "%s: connection #%d failed\n", scenario, r);
+			goto out;
+		}
+		samples[PHASE_SPAWN][r] = spawn_ns;
+		samples[PHASE_EXIT][r] = exit_ns;
+		samples[PHASE_TOTAL][r] = spawn_ns + exit_ns;
+	}
+	perftestReport(scenario, samples, runs);
+	ret = 0;
+
+ out:
+	kill(pid, SIGTERM);
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) ;
+	return ret;
+}
+
+/* In KiB */
+static uint64_t perftestKernelMem(void)
+{
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f == NULL) {
+		perror("fopen('/proc/meminfo')");
+		return 0;
+	}
+	uint64_t total = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		char name[64];
+		uint64_t kib;
+		if (sscanf(line, "%63[^:]: %" SCNu64, name, &kib) != 2) {
+			continue;
+		}
+		if (strcmp(name, "SUnreclaim") == 0 || strcmp(name, "KernelStack") == 0
+		    || strcmp(name, "PageTables") == 0) {
+			total += kib;
+		}
+	}
+	fclose(f);
+	return total;
+}
+
+/* Starts the jails one after another, and measures them once all of them are running */
+static bool perftestMemRound(char **args, const char *scenario, int jails, uint64_t * kib)
+{
+	pid_t *pids = calloc(jails, sizeof(pid_t));
+	int *in_fds = calloc(jails, sizeof(int));
+	int started = 0;
+	bool ret = false;
+
+	uint64_t before = perftestKernelMem();
+	for (; started < jails; started++) {
+		int in[2], out[2];
+		if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1) {
+			perror("pipe2");
+			goto out;
+		}
+		pids[started] = perftestStart(args, in[0], out[1]);
+		close(in[0]);
+		close(out[1]);
+		in_fds[started] = in[1];
+		/* The payload keeps its stdout open, so only its first line is read */
+		char buf[64];
+		ssize_t len = 0, sz;
+		while (len < (ssize_t) sizeof(buf) - 1
+		       && ((sz = read(out[0], &buf[len], 1)) == 1 || (sz == -1 && errno == EINTR))) {
+			if (sz == 1 && buf[len++] == '\n') {
+				break;
+			}
+		}
+		buf[len] = '\0';
+		close(out[0]);
+		uint64_t start_ns;
+		if (pids[started] == -1 || sscanf(buf, "T %" SCNu64, &start_ns) != 1) {
+			fprintf(stderr, "%s: jail #%d didn't start\n", scenario, started);
+			started++;
+			goto out;
+		}
+	}
+	uint64_t after = perftestKernelMem();
+	*kib = (after > before) ? (after - before) / jails : 0;
+	ret = true;
+
+ out:
+	for (int i = 0; i < started; i++) {
+		close(in_fds[i]);
+	}
+	for (int i = 0; i < started; i++) {
+		int status;
+		if (pids[i] <= 0) {
+			continue;
+		}
+		while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR) ;
+		if (WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: nsjail failed (status: %#x)\n", scenario, status);
+			ret = false;
+		}
+	}
+	free(pids);
+	free(in_fds);
+	return ret;
+}
+
+static int perftestMem(char *self, const char *scenario, int runs, int jails, int argc,
+		       char **argv)
+{
+	char **args = perftestArgv(self, argc, argv, NULL, 0, "hold");
+	uint64_t *samples = calloc(runs, sizeof(uint64_t));
+	for (int r = 0; r < runs; r++) {
+		if (perftestMemRound(args, scenario, jails, &samples[r]) == false) {
+			return 2;
+		}
+	}
+	qsort(samples, runs, sizeof(uint64_t), perftestCmpU64);
+	uint64_t p90 = samples[(runs * 9) / 10 < runs ? (runs * 9) / 10 : runs - 1];
+	printf("%s mem_kib %" PRIu64 " %" PRIu64 " %d\n", scenario, samples[runs / 2], p90, runs);
+	return 0;
+}
+
+static int perftestUsage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s payload|hold\n"
+		"       %s standalone SCENARIO RUNS NSJAIL [ARG...]\n"
+		"       %s listen SCENARIO RUNS PORT NSJAIL [ARG...]\n"
+		"       %s mem SCENARIO RUNS JAILS NSJAIL [ARG...]\n", argv0, argv0, argv0, argv0);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc >= 2 && strcmp(argv[1], "payload") == 0) {
+		return perftestPayload(false);
+	}
+	if (argc >= 2 && strcmp(argv[1], "hold") == 0) {
+		return perftestPayload(true);
+	}
+	/* The payload is this binary, with an absolute path, as the jail's cwd is different */
+	char *self = realpath("/proc/self/exe", NULL);
+	if (self == NULL) {
+		perror("realpath('/proc/self/exe')");
+		return 1;
+	}
+	if (argc >= 5 && strcmp(argv[1], "standalone") == 0) {
+		int runs = atoi(argv[3]);
+		if (runs < 1) {
+			return perftestUsage(argv[0]);
+		}
+		return perftestStandalone(self, argv[2], runs, argc - 4, &argv[4]);
+	}
+	if (argc >= 6 && strcmp(argv[1], "mem") == 0) {
+		int runs = atoi(argv[3]);
+		int jails = atoi(argv[4]);
+		if (runs < 1 || jails < 1) {
+			return perftestUsage(argv[0]);
+		}
+		return perftestMem(self, argv[2], runs, jails, argc - 5, &argv[5]);
+	}
+	if (argc >= 6 && strcmp(argv[1], "listen") == 0) {
+		int runs = atoi(argv[3]);
+		int port = atoi(argv[4]);
+		if (runs < 1 || port < 1) {
+			return perftestUsage(argv[0]);
+		}
+		return perftestListen(self, argv[2], runs, port, argc - 5, &argv[5]);
+	}
+	return perftestUsage(argv[0]);
+}
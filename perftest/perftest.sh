@@ -0,0 +1,210 @@
+#!/bin/sh
+#
+#   nsjail - spawn performance regression test
+#   -----------------------------------------
+#
+#   Copyright 2016 Google Inc. All Rights Reserved.
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+# Usage: perftest.sh NSJAIL PERFTEST BASELINE RESULTS
+#
+# Runs the scenario matrix below, writes 'SCENARIO PHASE MEDIAN_US P90_US RUNS' lines to
+# RESULTS, and compares the medians against BASELINE (same format, with an optional 6th
+# column: the tolerance in percent for that line). Fails if any phase got slower than
+# baseline * (1 + tolerance / 100) + PERFTEST_SLACK_US. The mem_kib lines (kernel memory per
+# running jail, in KiB) are compared the same way, with PERFTEST_SLACK_KIB.
+#
+# Environment:
+#   PERFTEST_RUNS         runs per scenario (default: 20)
+#   PERFTEST_TOLERANCE    default tolerance in percent (default: 25)
+#   PERFTEST_SLACK_US     absolute slack in microseconds, for noise in short phases (default: 500)
+#   PERFTEST_SLACK_KIB    absolute slack in KiB for the memory lines (default: 64)
+#   PERFTEST_MEM_RUNS     runs per memory scenario (default: 7)
+#   PERFTEST_MEM_JAILS    jails running at the same time in a memory scenario (default: 32)
+#   PERFTEST_PORT         TCP port for the listen-mode scenario (default: 31338)
+#   PERFTEST_CGROUP_ARGS  nsjail flags of the cgroup scenario (default: '--cgroup_kill')
+#   PERFTEST_UPDATE       if set to 1, RESULTS are copied to BASELINE instead of compared
+#
+# Optional scenarios, which need privileges or a set-up the machine might not have (e.g. a
+# delegated cgroup, or Landlock), are skipped if nsjail fails in them. Everything else runs unprivileged,
+# with user namespaces.
+
+set -e
+
+if [ $# -ne 4 ]; then
+	echo "Usage: $0 NSJAIL PERFTEST BASELINE RESULTS" >&2
+	exit 1
+fi
+NSJAIL="$1"
+PERFTEST="$2"
+BASELINE="$3"
+RESULTS="$4"
+RUNS="${PERFTEST_RUNS:-20}"
+TOLERANCE="${PERFTEST_TOLERANCE:-25}"
+SLACK_US="${PERFTEST_SLACK_US:-500}"
+SLACK_KIB="${PERFTEST_SLACK_KIB:-64}"
+MEM_RUNS="${PERFTEST_MEM_RUNS:-7}"
+MEM_JAILS="${PERFTEST_MEM_JAILS:-32}"
+PORT="${PERFTEST_PORT:-31338}"
+CGROUP_ARGS="${PERFTEST_CGROUP_ARGS:---cgroup_kill}"
+POLICY="$(dirname "$0")/../seccomp/example.policy"
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+COMMON="--log $TMPDIR/log"
+# The file-system of the jails, --landlock replaces it
+ROOT="--chroot /"
+LANDLOCK="--landlock -R /"
+
+echo "# nsjail perftest: scenario phase median_us p90_us runs" > "$TMPDIR/results"
+
+# SCENARIO 'optional'|'required' [ARG...]
+standalone() {
+	name="$1"
+	kind="$2"
+	shift 2
+	: > "$TMPDIR/log"
+	root="$ROOT"
+	[ "$1" = "--landlock" ] && root=""
+	# shellcheck disable=SC2086
+	if "$PERFTEST" standalone "$name" "$RUNS" "$NSJAIL" -Mo $COMMON $root "$@" \
+		>> "$TMPDIR/results" 2> "$TMPDIR/err"; then
+		echo "$name: done" >&2
+		return
+	fi
+	skipped "$name" "$kind"
+}
+
+mem() {
+	name="$1"
+	kind="$2"
+	shift 2
+	: > "$TMPDIR/log"
+	root="$ROOT"
+	[ "$1" = "--landlock" ] && root=""
+	# shellcheck disable=SC2086
+	if "$PERFTEST" mem "$name" "$MEM_RUNS" "$MEM_JAILS" "$NSJAIL" -Mo $COMMON $root "$@" \
+		>> "$TMPDIR/results" 2> "$TMPDIR/err"; then
+		echo "$name: done" >&2
+		return
+	fi
+	skipped "$name" "$kind"
+}
+
+listen() {
+	name="$1"
+	kind="$2"
+	shift 2
+	: > "$TMPDIR/log"
+	# shellcheck disable=SC2086
+	if "$PERFTEST" listen "$name" "$RUNS" "$PORT" "$NSJAIL" $COMMON $ROOT "$@" \
+		>> "$TMPDIR/results" 2> "$TMPDIR/err"; then
+		echo "$name: done" >&2
+		return
+	fi
+	skipped "$name" "$kind"
+}
+
+skipped() {
+	if [ "$2" = "required" ]; then
+		echo "$1: failed, see the nsjail log:" >&2
+		cat "$TMPDIR/err" "$TMPDIR/log" >&2
+		exit 1
+	fi
+	reason=$(grep -m 1 '\]\[[EF]\]' "$TMPDIR/log" || head -n 1 "$TMPDIR/err")
+	echo "$1: skipped: $reason" >&2
+}
+
+# N bind mounts of /usr, under a tmpfs (the chroot is read-only)
+binds() {
+	i=0
+	out="-T /perftest"
+	while [ "$i" -lt "$1" ]; do
+		out="$out -R /usr:/perftest/b$i"
+		i=$((i + 1))
+	done
+	echo "$out"
+}
+
+standalone base required
+standalone no_newnet required --disable_clone_newnet
+standalone no_newns required --disable_clone_newns
+# /proc can't be mounted without a PID namespace of its own
+standalone no_newpid required --disable_clone_newpid --disable_proc
+standalone no_newipc required --disable_clone_newipc
+standalone no_newuts required --disable_clone_newuts
+standalone newcgroup required --enable_clone_newcgroup
+standalone no_newuser optional --disable_clone_newuser
+# shellcheck disable=SC2046
+standalone binds_16 required $(binds 16)
+# shellcheck disable=SC2046
+standalone binds_64 required $(binds 64)
+# shellcheck disable=SC2086
+standalone cgroup optional $CGROUP_ARGS
+standalone no_seccomp required --disable_sandbox
+standalone seccomp_policy required --seccomp_policy "$POLICY"
+# shellcheck disable=SC2086
+standalone landlock optional $LANDLOCK
+listen listen required
+# The mount namespace (and what's mounted in it) vs Landlock
+mem mem_base required
+mem mem_no_newns required --disable_clone_newns
+# shellcheck disable=SC2086
+mem mem_landlock optional $LANDLOCK
+
+cp "$TMPDIR/results" "$RESULTS"
+echo "Results written to $RESULTS" >&2
+
+if [ "${PERFTEST_UPDATE:-0}" = "1" ]; then
+	cp "$RESULTS" "$BASELINE"
+	echo "Baseline $BASELINE updated" >&2
+	exit 0
+fi
+if [ ! -f "$BASELINE" ]; then
+	echo "No baseline in $BASELINE, create it with 'make perftest-baseline'" >&2
+	exit 1
+fi
+
+awk -v tol="$TOLERANCE" -v slack="$SLACK_US" -v slack_kib="$SLACK_KIB" '
+	/^#/ { next }
+	FILENAME == ARGV[1] {
+		base[$1, $2] = $3
+		btol[$1, $2] = ($6 != "") ? $6 : tol
+		keys[++n] = $1 SUBSEP $2
+		next
+	}
+	{ cur[$1, $2] = $3 }
+	END {
+		printf "%-16s %-7s %12s %12s %8s\n", "scenario", "phase", "baseline",
+		    "current", "change"
+		fail = 0
+		for (i = 1; i <= n; i++) {
+			split(keys[i], k, SUBSEP)
+			b = base[keys[i]]
+			if (!(keys[i] in cur)) {
+				printf "%-16s %-7s %12d %12s %8s\n", k[1], k[2], b, "-", "skipped"
+				continue
+			}
+			c = cur[keys[i]]
+			status = ""
+			s = (k[2] == "mem_kib") ? slack_kib : slack
+			if (c > b * (1 + btol[keys[i]] / 100) + s) {
+				status = "  REGRESSION (tolerance: " btol[keys[i]] "%)"
+				fail = 1
+			}
+			printf "%-16s %-7s %12d %12d %+7.1f%%%s\n", k[1], k[2], b, c,
+			    (b > 0) ? (c - b) * 100 / b : 0, status
+		}
+		exit fail
+	}' "$BASELINE" "$RESULTS"
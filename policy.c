@@ -0,0 +1,754 @@
+/*
+
+   nsjail - seccomp-bpf policies
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * Policies are text files, one rule per line:
+ *
+ *   # Comment
+ *   DEFAULT KILL  # Comments can follow rules too
+ *   ALLOW read, write, exit_group
+ *   ERRNO(1) socket if arg0 == 16
+ *   ALLOW mmap if arg2 != 7 && arg3 == 0x22
+ *   ERRNO(1) clone if arg0 & 0x10000000 == 0x10000000
+ *
+ * Actions: ALLOW, KILL, TRAP, LOG, ERRNO(n). Rules are checked in the order of the file; the
+ * first one whose conditions (64-bit comparisons of the syscall arguments, optionally masked
+ * first) all hold decides. Syscalls without a matching rule get the DEFAULT action (KILL if not
+ * specified). Only the native architecture is allowed, other ones (e.g. i386 on x86_64) are
+ * killed, and so are x32 syscalls on x86_64
+ */
+
+#include "policy.h"
+
+#include <ctype.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+#include "util.h"
+
+#ifndef SECCOMP_RET_KILL_PROCESS
+#define SECCOMP_RET_KILL_PROCESS 0x80000000U
+#endif				/* SECCOMP_RET_KILL_PROCESS */
+#ifndef SECCOMP_RET_LOG
+#define SECCOMP_RET_LOG 0x7ffc0000U
+#endif				/* SECCOMP_RET_LOG */
+
+/* Generated at build time from <sys/syscall.h>, see the Makefile */
+static const struct {
+	const char *name;
+	int nr;
+} policySyscalls[] = {
+#define SYSCALL(name) {#name, __NR_##name},
+#include "syscalls.inc"
+#undef SYSCALL
+};
+
+#define POLICY_MAX_CONDS 6
+
+struct policycond_t {
+	unsigned int arg;
+	bool eq;
+	uint64_t mask;
+	uint64_t val;
+};
+
+struct policyrule_t {
+	int nr;
+	int lineno;
+	uint32_t action;
+	size_t ncond;
+	struct policycond_t cond[POLICY_MAX_CONDS];
+	/* Cleared for rules which can't change the result, and are left out of the program */
+	bool live;
+};
+
+/* A syscall which doesn't simply get the default action */
+struct policysc_t {
+	int nr;
+	/* The result if none of its conditional rules matches */
+	uint32_t fallback;
+	bool conditional;
+	size_t block;
+};
+
+static struct policyrule_t *policyRules = NULL;
+static size_t policyRulesCnt = 0;
+static uint32_t policyDefault = SECCOMP_RET_KILL_PROCESS;
+
+bool policySyscallNr(const char *name, int *nr)
+{
+	for (size_t i = 0; i < ARRAYSIZE(policySyscalls); i++) {
+		if (strcmp(policySyscalls[i].name, name) == 0) {
+			*nr = policySyscalls[i].nr;
+			return true;
+		}
+	}
+	/* Numbers are accepted too, e.g. for syscalls newer than the build headers */
+	char *end;
+	unsigned long val = strtoul(name, &end, 0);
+	if (isdigit((unsigned char)name[0]) && *end == '\0' && val < 4096) {
+		*nr = (int)val;
+		return true;
+	}
+	return false;
+}
+
+static bool policyParseAction(const char *str, uint32_t * action)
+{
+	if (strcasecmp(str, "ALLOW") == 0) {
+		*action = SECCOMP_RET_ALLOW;
+	} else if (strcasecmp(str, "KILL") == 0) {
+		*action = SECCOMP_RET_KILL_PROCESS;
+	} else if (strcasecmp(str, "TRAP") == 0) {
+		*action = SECCOMP_RET_TRAP;
+	} else if (strcasecmp(str, "LOG") == 0) {
+		*action = SECCOMP_RET_LOG;
+	} else if (strncasecmp(str, "ERRNO(", strlen("ERRNO(")) == 0) {
+		char *end;
+		unsigned long err = strtoul(str + strlen("ERRNO("), &end, 0);
+		if (strcmp(end, ")") != 0 || err > SECCOMP_RET_DATA) {
+			return false;
+		}
+		*action = SECCOMP_RET_ERRNO | (uint32_t) err;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool policyParseNum(const char *str, uint64_t * val)
+{
+	char *end;
+	errno = 0;
+	*val = strtoull(str, &end, 0);
+	return (*end == '\0' && errno == 0);
+}
+
+/* 'argN == VAL', 'argN != VAL', or the same with the argument masked: 'argN & MASK == VAL' */
+static bool policyParseCond(char **saveptr, struct policycond_t *cond)
+{
+	const char *arg = strtok_r(NULL, " \t", saveptr);
+	const char *op = strtok_r(NULL, " \t", saveptr);
+	if (arg == NULL || op == NULL) {
+		return false;
+	}
+	if (strncmp(arg, "arg", 3) != 0 || arg[3] < '0' || arg[3] > '5' || arg[4] != '\0') {
+		return false;
+	}
+	cond->arg = arg[3] - '0';
+	cond->mask = UINT64_MAX;
+	if (strcmp(op, "&") == 0) {
+		const char *mask = strtok_r(NULL, " \t", saveptr);
+		if (mask == NULL || policyParseNum(mask, &cond->mask) == false || cond->mask == 0) {
+			return false;
+		}
+		op = strtok_r(NULL, " \t", saveptr);
+		if (op == NULL) {
+			return false;
+		}
+	}
+	if (strcmp(op, "==") == 0) {
+		cond->eq = true;
+	} else if (strcmp(op, "!=") == 0) {
+		cond->eq = false;
+	} else {
+		return false;
+	}
+	const char *val = strtok_r(NULL, " \t", saveptr);
+	if (val == NULL || policyParseNum(val, &cond->val) == false) {
+		return false;
+	}
+	/* The masked argument can never be equal to it */
+	return ((cond->val & ~cond->mask) == 0);
+}
+
+static bool policyParseLine(const char *fname, int lineno, char *line)
+{
+	char *saveptr;
+	char *action_str = strtok_r(line, " \t", &saveptr);
+	if (action_str == NULL || action_str[0] == '#') {
+		return true;
+	}
+
+	if (strcasecmp(action_str, "DEFAULT") == 0) {
+		const char *str = strtok_r(NULL, " \t", &saveptr);
+		if (str == NULL || policyParseAction(str, &policyDefault) == false) {
+			LOG_E("%s:%d: Invalid default action", fname, lineno);
+			return false;
+		}
+		return true;
+	}
+
+	struct policyrule_t rule = {.ncond = 0 };
+	if (policyParseAction(action_str, &rule.action) == false) {
+		LOG_E("%s:%d: Unknown action '%s'", fname, lineno, action_str);
+		return false;
+	}
+
+	/* Syscall names, separated with commas, up to the optional 'if' */
+	int nrs[512];
+	size_t nrs_cnt = 0;
+	char *tok;
+	while ((tok = strtok_r(NULL, " \t,", &saveptr)) != NULL) {
+		if (strcmp(tok, "if") == 0) {
+			break;
+		}
+		if (nrs_cnt == ARRAYSIZE(nrs)) {
+			LOG_E("%s:%d: Too many syscalls", fname, lineno);
+			return false;
+		}
+		if (policySyscallNr(tok, &nrs[nrs_cnt]) == false) {
+			LOG_E("%s:%d: Unknown syscall '%s'", fname, lineno, tok);
+			return false;
+		}
+		nrs_cnt++;
+	}
+	if (nrs_cnt == 0) {
+		LOG_E("%s:%d: No syscalls specified", fname, lineno);
+		return false;
+	}
+	if (tok != NULL) {
+		for (;;) {
+			if (rule.ncond == POLICY_MAX_CONDS) {
+				LOG_E("%s:%d: More than %d conditions", fname, lineno,
+				      POLICY_MAX_CONDS);
+				return false;
+			}
+			if (policyParseCond(&saveptr, &rule.cond[rule.ncond]) == false) {
+				LOG_E("%s:%d: Invalid condition, expected 'argN == VALUE' or "
+				      "'argN != VALUE', optionally with 'argN & MASK', and VALUE "
+				      "within MASK", fname, lineno);
+				return false;
+			}
+			rule.ncond++;
+			const char *and = strtok_r(NULL, " \t", &saveptr);
+			if (and == NULL) {
+				break;
+			}
+			if (strcmp(and, "&&") != 0) {
+				LOG_E("%s:%d: Expected '&&', got '%s'", fname, lineno, and);
+				return false;
+			}
+		}
+	}
+
+	policyRules = realloc(policyRules, sizeof(*policyRules) * (policyRulesCnt + nrs_cnt));
+	if (policyRules == NULL) {
+		PLOG_F("realloc(%zu)", sizeof(*policyRules) * (policyRulesCnt + nrs_cnt));
+	}
+	rule.lineno = lineno;
+	rule.live = true;
+	for (size_t i = 0; i < nrs_cnt; i++) {
+		rule.nr = nrs[i];
+		policyRules[policyRulesCnt++] = rule;
+	}
+	return true;
+}
+
+static bool policyParse(const char *fname)
+{
+	FILE *f = fopen(fname, "re");
+	if (f == NULL) {
+		PLOG_E("fopen('%s')", fname);
+		return false;
+	}
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	bool ret = true;
+	while (getline(&line, &len, f) != -1) {
+		lineno++;
+		line[strcspn(line, "#\r\n")] = '\0';
+		if (policyParseLine(fname, lineno, line) == false) {
+			ret = false;
+			break;
+		}
+	}
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+struct policyprog_t {
+	struct sock_filter *insns;
+	size_t len;
+	size_t cap;
+};
+
+static void policyEmit(struct policyprog_t *prog, struct sock_filter insn)
+{
+	if (prog->len == prog->cap) {
+		prog->cap = prog->cap ? prog->cap * 2 : 256;
+		prog->insns = realloc(prog->insns, sizeof(*prog->insns) * prog->cap);
+		if (prog->insns == NULL) {
+			PLOG_F("realloc(%zu)", sizeof(*prog->insns) * prog->cap);
+		}
+	}
+	prog->insns[prog->len++] = insn;
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define POLICY_ARG_LO(n) (offsetof(struct seccomp_data, args[n]))
+#define POLICY_ARG_HI(n) (offsetof(struct seccomp_data, args[n]) + sizeof(uint32_t))
+#else
+#define POLICY_ARG_LO(n) (offsetof(struct seccomp_data, args[n]) + sizeof(uint32_t))
+#define POLICY_ARG_HI(n) (offsetof(struct seccomp_data, args[n]))
+#endif
+
+/* Both 32-bit halves of the argument are compared, except for those which are masked out */
+static size_t policyCondLen(const struct policycond_t *c)
+{
+	size_t len = 0;
+	for (int h = 0; h < 2; h++) {
+		uint32_t mask = (uint32_t) (c->mask >> (h * 32));
+		if (mask != 0) {
+			len += (mask == UINT32_MAX) ? 2 : 3;
+		}
+	}
+	return len;
+}
+
+/*
+ * A rule is a load, an optional AND and a compare per half of every condition, followed by the
+ * RET, and falls through to the next one if any condition doesn't hold
+ */
+static void policyEmitRule(struct policyprog_t *prog, const struct policyrule_t *rule)
+{
+	size_t rule_len = 1;
+	for (size_t i = 0; i < rule->ncond; i++) {
+		rule_len += policyCondLen(&rule->cond[i]);
+	}
+	size_t pos = 0;
+	for (size_t i = 0; i < rule->ncond; i++) {
+		const struct policycond_t *c = &rule->cond[i];
+		size_t end = pos + policyCondLen(c);
+		for (int h = 0; h < 2; h++) {
+			uint32_t mask = (uint32_t) (c->mask >> (h * 32));
+			uint32_t val = (uint32_t) (c->val >> (h * 32));
+			if (mask == 0) {
+				continue;
+			}
+			policyEmit(prog, (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+								      h ? POLICY_ARG_HI(c->arg) :
+								      POLICY_ARG_LO(c->arg)));
+			pos++;
+			if (mask != UINT32_MAX) {
+				policyEmit(prog, (struct sock_filter)
+					   BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask));
+				pos++;
+			}
+			uint8_t fail = rule_len - pos - 1;
+			if (c->eq) {
+				policyEmit(prog, (struct sock_filter)
+					   BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, val, 0, fail));
+			} else if (pos + 1 == end) {
+				policyEmit(prog, (struct sock_filter)
+					   BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, val, fail, 0));
+			} else {
+				/* Low halves differ: the condition holds, skip to the next one */
+				policyEmit(prog, (struct sock_filter)
+					   BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, val, 0,
+						    end - pos - 1));
+			}
+			pos++;
+		}
+	}
+	policyEmit(prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, rule->action));
+}
+
+const char *policySyscallName(int nr)
+{
+	for (size_t i = 0; i < ARRAYSIZE(policySyscalls); i++) {
+		if (policySyscalls[i].nr == nr) {
+			return policySyscalls[i].name;
+		}
+	}
+	return "unknown";
+}
+
+/*
+ * Decides what's left of the rules of every syscall: rules after its first unconditional one
+ * are never reached, and trailing conditional rules with the same action as the one taken
+ * when they don't match are folded away. Syscalls left without conditional rules are
+ * constant-action
+ */
+static size_t policyAnalyze(struct policysc_t *scs)
+{
+	size_t cnt = 0;
+	for (size_t i = 0; i < policyRulesCnt; i++) {
+		int nr = policyRules[i].nr;
+		bool seen = false;
+		for (size_t j = 0; j < cnt; j++) {
+			seen |= (scs[j].nr == nr);
+		}
+		if (seen) {
+			continue;
+		}
+
+		struct policysc_t *sc = &scs[cnt];
+		sc->nr = nr;
+		sc->fallback = policyDefault;
+		bool unconditional = false;
+		for (size_t j = i; j < policyRulesCnt; j++) {
+			struct policyrule_t *r = &policyRules[j];
+			if (r->nr != nr) {
+				continue;
+			}
+			if (unconditional) {
+				LOG_W("Line %d: the rule for '%s' is never reached", r->lineno,
+				      policySyscallName(nr));
+				r->live = false;
+				continue;
+			}
+			if (r->ncond == 0) {
+				unconditional = true;
+				sc->fallback = r->action;
+				r->live = false;
+			}
+		}
+		sc->conditional = false;
+		bool folding = true;
+		for (size_t j = policyRulesCnt; j > i; j--) {
+			struct policyrule_t *r = &policyRules[j - 1];
+			if (r->nr != nr || r->live == false) {
+				continue;
+			}
+			if (folding && r->action == sc->fallback) {
+				LOG_D("Line %d: the conditional rule for '%s' has the same action as "
+				      "the fallback, folded", r->lineno, policySyscallName(nr));
+				r->live = false;
+				continue;
+			}
+			folding = false;
+			sc->conditional = true;
+		}
+		if (sc->conditional == false && sc->fallback == policyDefault) {
+			continue;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+static int policyScCmp(const void *a, const void *b)
+{
+	const struct policysc_t *sa = a;
+	const struct policysc_t *sb = b;
+	return (sa->nr > sb->nr) - (sa->nr < sb->nr);
+}
+
+struct policypatch_t {
+	size_t insn;
+	/* Index into the syscall array, or -1 for the default action */
+	ssize_t target;
+};
+
+/* BPF_JA has a 32-bit offset, so blocks can be placed anywhere after the dispatch tree */
+static void policyEmitJa(struct policyprog_t *prog, struct policypatch_t *patches,
+			 size_t *npatches, ssize_t target)
+{
+	patches[*npatches].insn = prog->len;
+	patches[*npatches].target = target;
+	(*npatches)++;
+	policyEmit(prog, (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0));
+}
+
+/*
+ * A binary search over the syscall numbers, with linear scans of up to 4 syscalls at the
+ * leaves. It only reads the syscall number, so it never breaks the constant-action cache
+ */
+static void policyEmitTree(struct policyprog_t *prog, struct policysc_t *scs, size_t lo,
+			   size_t hi, struct policypatch_t *patches, size_t *npatches)
+{
+	if (hi - lo <= 4) {
+		for (size_t i = lo; i < hi; i++) {
+			policyEmit(prog, (struct sock_filter)
+				   BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, scs[i].nr, 0, 1));
+			policyEmitJa(prog, patches, npatches, (ssize_t) i);
+		}
+		policyEmitJa(prog, patches, npatches, -1);
+		return;
+	}
+	size_t mid = lo + (hi - lo) / 2;
+	policyEmit(prog, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, scs[mid].nr, 0,
+						      1));
+	size_t ja = prog->len;
+	policyEmit(prog, (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0));
+	policyEmitTree(prog, scs, lo, mid, patches, npatches);
+	prog->insns[ja].k = prog->len - ja - 1;
+	policyEmitTree(prog, scs, mid, hi, patches, npatches);
+}
+
+/*
+ * Layout: the architecture (and x32) check, a dispatch tree on the syscall number, and then the
+ * blocks:
+ * one RET shared by all syscalls with the same constant action, and for every syscall with
+ * conditional rules its rules followed by a RET of its fallback action
+ */
+static bool policyCompile(struct sock_fprog *fprog)
+{
+	struct policyprog_t prog = {.insns = NULL,.len = 0,.cap = 0 };
+	struct policysc_t *scs = utilMalloc(sizeof(struct policysc_t) * (policyRulesCnt + 1));
+	size_t cnt = policyAnalyze(scs);
+	qsort(scs, cnt, sizeof(struct policysc_t), policyScCmp);
+
+	policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+						       offsetof(struct seccomp_data, arch)));
+	policyEmit(&prog, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, POLICY_ARCH, 1,
+						       0));
+	policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+						       SECCOMP_RET_KILL_PROCESS));
+	policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+						       offsetof(struct seccomp_data, nr)));
+#if defined(POLICY_X32_BIT)
+	policyEmit(&prog, (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, POLICY_X32_BIT,
+						       0, 1));
+	policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+						       SECCOMP_RET_KILL_PROCESS));
+#endif				/* defined(POLICY_X32_BIT) */
+
+	/* At most 2 jumps per syscall, plus one to the default action per leaf */
+	struct policypatch_t *patches = utilMalloc(sizeof(struct policypatch_t) * (cnt * 2 + 1));
+	size_t npatches = 0;
+	policyEmitTree(&prog, scs, 0, cnt, patches, &npatches);
+
+	size_t default_block = prog.len;
+	policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, policyDefault));
+	for (size_t i = 0; i < cnt; i++) {
+		struct policysc_t *sc = &scs[i];
+		if (sc->conditional == false) {
+			/* Shared with earlier syscalls with the same action */
+			size_t j;
+			for (j = 0; j < i; j++) {
+				if (scs[j].conditional == false && scs[j].fallback == sc->fallback) {
+					break;
+				}
+			}
+			if (j < i) {
+				sc->block = scs[j].block;
+				continue;
+			}
+			sc->block = prog.len;
+			policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+								       sc->fallback));
+			continue;
+		}
+		sc->block = prog.len;
+		for (size_t j = 0; j < policyRulesCnt; j++) {
+			if (policyRules[j].nr == sc->nr && policyRules[j].live) {
+				policyEmitRule(&prog, &policyRules[j]);
+			}
+		}
+		policyEmit(&prog, (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, sc->fallback));
+	}
+
+	for (size_t i = 0; i < npatches; i++) {
+		size_t target = (patches[i].target == -1) ? default_block :
+		    scs[patches[i].target].block;
+		prog.insns[patches[i].insn].k = target - patches[i].insn - 1;
+	}
+	free(patches);
+	free(scs);
+
+	if (prog.len > BPF_MAXINSNS) {
+		LOG_E("The policy compiles to %zu instructions, the maximum is %d", prog.len,
+		      BPF_MAXINSNS);
+		free(prog.insns);
+		return false;
+	}
+	fprog->filter = prog.insns;
+	fprog->len = (unsigned short)prog.len;
+	return true;
+}
+
+/*
+ * Runs the program the way the kernel does when it builds its constant-action cache (Linux
+ * >= 5.11): with only the syscall number and the architecture known. Returns false if the
+ * result depends on anything else
+ */
+static bool policyEmulate(const struct sock_fprog *fprog, int nr, uint32_t * action,
+			  size_t *steps, const char **reason)
+{
+	uint32_t a = 0;
+	size_t pc = 0;
+	for (*steps = 1; pc < fprog->len; (*steps)++) {
+		const struct sock_filter *f = &fprog->filter[pc];
+		switch (f->code) {
+		case BPF_LD | BPF_W | BPF_ABS:
+			if (f->k == offsetof(struct seccomp_data, arch)) {
+				a = POLICY_ARCH;
+			} else if (f->k == offsetof(struct seccomp_data, nr)) {
+				a = (uint32_t) nr;
+			} else if (f->k >= offsetof(struct seccomp_data, args)) {
+				*reason = "a syscall argument";
+				return false;
+			} else {
+				*reason = "the instruction pointer";
+				return false;
+			}
+			pc++;
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			a &= f->k;
+			pc++;
+			break;
+		case BPF_JMP | BPF_JA:
+			pc += 1 + f->k;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			pc += 1 + ((a == f->k) ? f->jt : f->jf);
+			break;
+		case BPF_JMP | BPF_JGT | BPF_K:
+			pc += 1 + ((a > f->k) ? f->jt : f->jf);
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			pc += 1 + ((a >= f->k) ? f->jt : f->jf);
+			break;
+		case BPF_JMP | BPF_JSET | BPF_K:
+			pc += 1 + ((a & f->k) ? f->jt : f->jf);
+			break;
+		case BPF_RET | BPF_K:
+			*action = f->k;
+			return true;
+		default:
+			*reason = "an instruction not supported by the emulator";
+			return false;
+		}
+	}
+	*reason = "a jump out of the program";
+	return false;
+}
+
+/* Syscalls which are called often enough that they should never go through BPF */
+static const char *policyHotSyscalls[] = {
+	"read", "write", "readv", "writev", "pread64", "pwrite64", "close", "futex", "mmap",
+	"munmap", "mprotect", "brk", "poll", "ppoll", "epoll_wait", "epoll_pwait", "select",
+	"pselect6", "recvfrom", "sendto", "recvmsg", "sendmsg", "clock_gettime",
+	"clock_nanosleep", "nanosleep", "getpid", "gettid", "sched_yield", "lseek", "fstat",
+	"newfstatat", "statx", "openat",
+};
+
+static void policyReport(const char *fname, const struct sock_fprog *fprog)
+{
+	size_t cached = 0, constant = 0, dynamic = 0, steps_sum = 0, steps_max = 0;
+	for (size_t i = 0; i < ARRAYSIZE(policySyscalls); i++) {
+		int nr = policySyscalls[i].nr;
+		uint32_t action;
+		size_t steps;
+		const char *reason;
+		if (policyEmulate(fprog, nr, &action, &steps, &reason) == true) {
+			cached += (action == SECCOMP_RET_ALLOW);
+			constant += (action != SECCOMP_RET_ALLOW);
+			steps_sum += steps;
+			steps_max = (steps > steps_max) ? steps : steps_max;
+			continue;
+		}
+
+		dynamic++;
+		char lines[256] = "";
+		for (size_t j = 0; j < policyRulesCnt; j++) {
+			if (policyRules[j].nr == nr && policyRules[j].live) {
+				size_t len = strlen(lines);
+				snprintf(&lines[len], sizeof(lines) - len, "%s%d", len ? ", " : "",
+					 policyRules[j].lineno);
+			}
+		}
+		bool hot = false;
+		for (size_t j = 0; j < ARRAYSIZE(policyHotSyscalls); j++) {
+			hot |= (strcmp(policyHotSyscalls[j], policySyscalls[i].name) == 0);
+		}
+		if (hot) {
+			LOG_W("%s: hot syscall '%s' is not cacheable, every call runs the filter, as "
+			      "its result depends on %s (lines: %s)", fname, policySyscalls[i].name,
+			      reason, lines);
+		} else {
+			LOG_I("%s: syscall '%s' is not cacheable, as its result depends on %s (lines: "
+			      "%s)", fname, policySyscalls[i].name, reason, lines);
+		}
+	}
+	LOG_I("%s: %u BPF instructions. Syscalls: %zu allowed from the kernel's action cache "
+	      "without running the filter, %zu with another constant action, %zu evaluated on "
+	      "every call. Constant paths: %zu instructions on average, %zu at most", fname,
+	      fprog->len, cached, constant, dynamic,
+	      (cached + constant) ? steps_sum / (cached + constant) : 0, steps_max);
+}
+
+#if defined(POLICY_X32_BIT)
+/* The x32 variant of every syscall must be killed, before any rule gets to see it */
+static bool policyCheckX32(const struct sock_fprog *fprog)
+{
+	for (size_t i = 0; i < ARRAYSIZE(policySyscalls); i++) {
+		uint32_t action;
+		size_t steps;
+		const char *reason;
+		int nr = (int)(POLICY_X32_BIT | (uint32_t) policySyscalls[i].nr);
+		if (policyEmulate(fprog, nr, &action, &steps, &reason) == false
+		    || action != SECCOMP_RET_KILL_PROCESS) {
+			LOG_E("The compiled policy doesn't kill the x32 variant of '%s'",
+			      policySyscalls[i].name);
+			return false;
+		}
+	}
+	return true;
+}
+#endif				/* defined(POLICY_X32_BIT) */
+
+/* The policy is compiled once, and every new jail just installs the program */
+bool policyInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->seccomp_policy == NULL) {
+		return true;
+	}
+#if defined(POLICY_ARCH)
+	if (policyParse(nsjconf->seccomp_policy) == false) {
+		return false;
+	}
+	struct sock_fprog *fprog = utilMalloc(sizeof(struct sock_fprog));
+	if (policyCompile(fprog) == false) {
+		free(fprog);
+		return false;
+	}
+#if defined(POLICY_X32_BIT)
+	if (policyCheckX32(fprog) == false) {
+		free(fprog->filter);
+		free(fprog);
+		return false;
+	}
+#endif				/* defined(POLICY_X32_BIT) */
+	policyReport(nsjconf->seccomp_policy, fprog);
+	nsjconf->seccomp_prog = fprog;
+	return true;
+#else
+	LOG_E("--seccomp_policy is not supported on this CPU architecture");
+	return false;
+#endif				/* defined(POLICY_ARCH) */
+}
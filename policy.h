@@ -0,0 +1,60 @@
+/*
+
+   nsjail - seccomp-bpf policies
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_POLICY_H
+#define NS_POLICY_H
+
+#include <endian.h>
+#include <linux/audit.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+/* The only architecture allowed by policies */
+#if defined(__x86_64__)
+#define POLICY_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define POLICY_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define POLICY_ARCH AUDIT_ARCH_AARCH64
+#elif defined(__arm__)
+#define POLICY_ARCH AUDIT_ARCH_ARM
+#elif defined(__powerpc64__) && __BYTE_ORDER == __LITTLE_ENDIAN
+#define POLICY_ARCH AUDIT_ARCH_PPC64LE
+#elif defined(__s390x__)
+#define POLICY_ARCH AUDIT_ARCH_S390X
+#elif defined(__riscv) && __riscv_xlen == 64
+#define POLICY_ARCH AUDIT_ARCH_RISCV64
+#endif
+
+/*
+ * x32 syscalls have the same architecture as x86_64 ones, and are told apart only by this bit
+ * of the syscall number (__X32_SYSCALL_BIT)
+ */
+#if defined(__x86_64__)
+#define POLICY_X32_BIT 0x40000000U
+#endif
+
+bool policyInit(struct nsjconf_t *nsjconf);
+bool policySyscallNr(const char *name, int *nr);
+const char *policySyscallName(int nr);
+
+#endif				/* NS_POLICY_H */
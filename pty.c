@@ -0,0 +1,793 @@
+/*
+
+   nsjail - pseudo-terminals for the jails
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * With --pty, every jail opens a pty in its own devpts instance (mounted at /dev/pts), makes
+ * the slave its stdio and controlling terminal, and passes the master to the supervisor. The
+ * supervisor relays between the master and the connection (or its own stdio) in its main
+ * loop, with buffered reads and writes, instead of a relay process per jail.
+ *
+ * The relay also carries the resumable sessions (--session_grace, see session.c), for which
+ * the jail's end is a socketpair, unless --pty is used too. A session's relay outlives its
+ * connection, and keeps the most recent output in a ring, to be sent again on resumption.
+ */
+
+#include "pty.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conn.h"
+#include "log.h"
+#include "session.h"
+#include "util.h"
+
+#ifndef TIOCGPTPEER
+#define TIOCGPTPEER _IO('T', 0x41)
+#endif				/* TIOCGPTPEER */
+
+#define PTY_BUF_SIZE (64 * 1024)
+/* How much of a session's output can be sent again to a resumed connection */
+#define PTY_RING_SIZE (256 * 1024)
+/* How long the output of a finished jail is kept for a connection which doesn't read it */
+#define PTY_LINGER_SEC 10
+/* How long ptyFinish() waits for the output to be flushed */
+#define PTY_FINISH_MS 1000
+
+static const char ptyMasterChar = 'P';
+
+struct ptybuf_t {
+	size_t off;
+	size_t len;
+	char buf[PTY_BUF_SIZE];
+};
+
+struct ptyrelay_t {
+	pid_t pid;
+	/* -1 until it's received on setup_fd, the supervisor's end of the setup socketpair */
+	int master;
+	int setup_fd;
+	/* A socketpair, for sessions without --pty */
+	bool master_sock;
+	int conn_in;
+	int conn_out;
+	/* Written with MSG_NOSIGNAL, a reset connection mustn't kill the supervisor */
+	bool conn_sock;
+	/* A connection (listen mode, without sessions) which is gone, hangs the jail's terminal up */
+	bool hangup_on_eof;
+	bool in_eof;
+	bool master_eof;
+	/* The connection's half-close has been passed on to a socketpair with shutdown(SHUT_WR) */
+	bool master_shut;
+	bool conn_err;
+	time_t eof_at;
+	/* conn_in -> master */
+	struct ptybuf_t to_master;
+	/* master -> conn_out */
+	struct ptybuf_t to_conn;
+	/* Sessions only, the token is empty otherwise */
+	char token[SESSION_TOKEN_LEN + 1];
+	unsigned int grace;
+	bool detached;
+	time_t detached_at;
+	/* Bytes read from, and written to the connections, over the whole session */
+	uint64_t in_cnt;
+	uint64_t out_cnt;
+	/* The stream offset from which the output is sent (again) to a resumed connection */
+	uint64_t replay_from;
+	/* The last PTY_RING_SIZE bytes of output, at their stream offsets modulo PTY_RING_SIZE */
+	char *ring;
+	 TAILQ_ENTRY(ptyrelay_t) pointers;
+};
+
+static TAILQ_HEAD(ptyrelayq_t, ptyrelay_t) ptyRelays = TAILQ_HEAD_INITIALIZER(ptyRelays);
+static size_t ptyRelaysCnt = 0;
+static struct pollfd *ptyPfds = NULL;
+static size_t ptyPfdsCnt = 0;
+
+/* The supervisor's terminal (standalone modes), put in the raw mode while relaying */
+static bool ptyTermSaved = false;
+static int ptyTermFd = -1;
+static struct termios ptyTerm;
+
+bool ptyApply(struct nsjconf_t *nsjconf, int pipefd)
+{
+	if (nsjconf->pty == false) {
+		return true;
+	}
+
+	int master = TEMP_FAILURE_RETRY(open("/dev/pts/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC));
+	if (master == -1 && errno == ENOENT) {
+		/* No devpts instance of its own (e.g. with --disable_clone_newns) */
+		master = TEMP_FAILURE_RETRY(open("/dev/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC));
+	}
+	if (master == -1) {
+		PLOG_E("open('/dev/pts/ptmx')");
+		return false;
+	}
+	int unlock = 0;
+	if (ioctl(master, TIOCSPTLCK, &unlock) == -1) {
+		PLOG_E("ioctl(TIOCSPTLCK)");
+		close(master);
+		return false;
+	}
+	int slave = ioctl(master, TIOCGPTPEER, O_RDWR | O_NOCTTY);
+	if (slave == -1) {
+		/* Before Linux 4.13 */
+		int ptn;
+		if (ioctl(master, TIOCGPTN, &ptn) == -1) {
+			PLOG_E("ioctl(TIOCGPTN)");
+			close(master);
+			return false;
+		}
+		char path[64];
+		snprintf(path, sizeof(path), "/dev/pts/%d", ptn);
+		slave = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_NOCTTY));
+		if (slave == -1) {
+			PLOG_E("open('%s')", path);
+			close(master);
+			return false;
+		}
+	}
+
+	/* The connection can't tell its window size, so it's a classic terminal */
+	struct winsize ws = {.ws_row = 24,.ws_col = 80 };
+	struct winsize cur;
+	if (isatty(STDIN_FILENO) && ioctl(STDIN_FILENO, TIOCGWINSZ, &cur) == 0 && cur.ws_row > 0
+	    && cur.ws_col > 0) {
+		ws = cur;
+	}
+	if (ioctl(slave, TIOCSWINSZ, &ws) == -1) {
+		PLOG_W("ioctl(TIOCSWINSZ)");
+	}
+
+	bool ret = utilSendFd(pipefd, ptyMasterChar, master);
+	close(master);
+	if (ret == false) {
+		LOG_E("Couldn't pass the pty master to the supervisor");
+		close(slave);
+		return false;
+	}
+
+	for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+		if (TEMP_FAILURE_RETRY(dup2(slave, fd)) == -1) {
+			PLOG_E("dup2(%d, %d)", slave, fd);
+			return false;
+		}
+	}
+	if (slave > STDERR_FILENO) {
+		close(slave);
+	}
+	if (ioctl(STDIN_FILENO, TIOCSCTTY, 0) == -1) {
+		PLOG_E("ioctl(TIOCSCTTY)");
+		return false;
+	}
+	return true;
+}
+
+static void ptySetNonBlock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		PLOG_W("fcntl(%d, F_SETFL, O_NONBLOCK)", fd);
+	}
+}
+
+/* Keystrokes (e.g. ^C) go to the jail's terminal, not to the supervisor */
+static void ptySetRaw(int fd)
+{
+	if (ptyTermSaved == true || isatty(fd) == 0) {
+		return;
+	}
+	if (tcgetattr(fd, &ptyTerm) == -1) {
+		PLOG_W("tcgetattr(%d)", fd);
+		return;
+	}
+	struct termios raw = ptyTerm;
+	cfmakeraw(&raw);
+	/* The supervisor's own logs still need '\n' -> '\r\n' */
+	raw.c_oflag |= OPOST | ONLCR;
+	if (tcsetattr(fd, TCSANOW, &raw) == -1) {
+		PLOG_W("tcsetattr(%d)", fd);
+		return;
+	}
+	ptyTermFd = fd;
+	ptyTermSaved = true;
+}
+
+static void ptyRestoreTerm(void)
+{
+	if (ptyTermSaved == false) {
+		return;
+	}
+	if (tcsetattr(ptyTermFd, TCSANOW, &ptyTerm) == -1) {
+		PLOG_W("tcsetattr(%d)", ptyTermFd);
+	}
+	ptyTermSaved = false;
+}
+
+static void ptySetConnSock(struct ptyrelay_t *r)
+{
+	/* The supervisor must never block on a single connection */
+	ptySetNonBlock(r->conn_in);
+	ptySetNonBlock(r->conn_out);
+	/* Echoed keystrokes shouldn't wait for the corked segments to fill up */
+	int so = 0;
+	setsockopt(r->conn_out, SOL_TCP, TCP_CORK, &so, sizeof(so));
+	so = 1;
+	setsockopt(r->conn_out, SOL_TCP, TCP_NODELAY, &so, sizeof(so));
+}
+
+static void ptyCloseFd(int fd)
+{
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+static bool ptyRecvMaster(pid_t pid, int pipefd, int *master)
+{
+	char cmd;
+	*master = -1;
+	if (utilRecvFd(pipefd, &cmd, master) != sizeof(cmd) || cmd != ptyMasterChar
+	    || *master == -1) {
+		LOG_E("Couldn't receive the pty master from PID %d", pid);
+		ptyCloseFd(*master);
+		*master = -1;
+		return false;
+	}
+	return true;
+}
+
+/* Takes ownership of relay_fd, the supervisor's end of a session's socketpair (or -1) */
+bool ptyInitFromParent(struct nsjconf_t *nsjconf, pid_t pid, int pipefd, int relay_fd, int fd_in,
+		       int fd_out)
+{
+	if (nsjconf->pty == false && relay_fd == -1) {
+		return true;
+	}
+
+	/*
+	 * The jail sends the pty master once it's set up, which is received from the main loop.
+	 * With --seccomp_learn, learnInitFromParent() waits for the jail to get to execve() anyway,
+	 * and reads from pipefd after the master
+	 */
+	int master = relay_fd;
+	int setup_fd = -1;
+	if (nsjconf->pty == true && nsjconf->seccomp_learn != NULL
+	    && ptyRecvMaster(pid, pipefd, &master) == false) {
+		return false;
+	}
+	if (nsjconf->pty == true && nsjconf->seccomp_learn == NULL) {
+		setup_fd = fcntl(pipefd, F_DUPFD_CLOEXEC, 0);
+		if (setup_fd == -1) {
+			PLOG_E("fcntl(%d, F_DUPFD_CLOEXEC)", pipefd);
+			return false;
+		}
+	}
+
+	/* The session line goes first, before anything the jail writes */
+	char token[SESSION_TOKEN_LEN + 1] = "";
+	if (nsjconf->session_grace > 0 && (sessionNewToken(token, sizeof(token)) == false
+					   || sessionGreet(fd_out, token, 0, 0) == false)) {
+		ptyCloseFd(master);
+		ptyCloseFd(setup_fd);
+		return false;
+	}
+
+	struct ptyrelay_t *r = utilMalloc(sizeof(struct ptyrelay_t));
+	r->pid = pid;
+	r->master = master;
+	r->setup_fd = setup_fd;
+	r->master_sock = (relay_fd != -1);
+	/* The connection is closed by the caller, but stays open while the output is relayed */
+	r->conn_in = fcntl(fd_in, F_DUPFD_CLOEXEC, 0);
+	r->conn_out = fcntl(fd_out, F_DUPFD_CLOEXEC, 0);
+	r->hangup_on_eof = (nsjconf->mode == MODE_LISTEN_TCP && nsjconf->session_grace == 0);
+	r->in_eof = false;
+	r->master_eof = false;
+	r->master_shut = false;
+	r->conn_err = false;
+	r->eof_at = 0;
+	r->to_master.off = r->to_master.len = 0;
+	r->to_conn.off = r->to_conn.len = 0;
+	memcpy(r->token, token, sizeof(r->token));
+	r->grace = nsjconf->session_grace;
+	r->detached = false;
+	r->detached_at = 0;
+	r->in_cnt = r->out_cnt = r->replay_from = 0;
+	r->ring = (token[0] != '\0') ? utilMalloc(PTY_RING_SIZE) : NULL;
+	if (r->conn_in == -1 || r->conn_out == -1) {
+		PLOG_E("fcntl(F_DUPFD_CLOEXEC)");
+		if (r->conn_in != -1) {
+			close(r->conn_in);
+		}
+		if (r->conn_out != -1) {
+			close(r->conn_out);
+		}
+		ptyCloseFd(master);
+		ptyCloseFd(setup_fd);
+		free(r->ring);
+		free(r);
+		return false;
+	}
+
+	struct stat st;
+	r->conn_sock = (fstat(r->conn_out, &st) == 0 && S_ISSOCK(st.st_mode));
+	if (master != -1) {
+		ptySetNonBlock(master);
+	}
+	if (nsjconf->mode == MODE_LISTEN_TCP) {
+		ptySetConnSock(r);
+	} else {
+		ptySetRaw(r->conn_in);
+	}
+
+	TAILQ_INSERT_TAIL(&ptyRelays, r, pointers);
+	ptyRelaysCnt++;
+	LOG_D("Relaying the %s of PID %d (master fd: %d, setup fd: %d)",
+	      r->master_sock ? "stdio" : "pty", pid, master, setup_fd);
+	return true;
+}
+
+/* Reads as much as fits into the buffer, or just once if the fd is blocking */
+static ssize_t ptyFill(int fd, struct ptybuf_t *b, bool drain)
+{
+	if (b->off > 0) {
+		memmove(b->buf, &b->buf[b->off], b->len - b->off);
+		b->len -= b->off;
+		b->off = 0;
+	}
+	ssize_t total = 0;
+	while (b->len < sizeof(b->buf)) {
+		ssize_t sz = read(fd, &b->buf[b->len], sizeof(b->buf) - b->len);
+		if (sz == -1 && errno == EINTR) {
+			continue;
+		}
+		if (sz == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (sz <= 0) {
+			/* EIO from the master: the jail has closed all its ends of the pty */
+			return (total > 0) ? total : -1;
+		}
+		b->len += sz;
+		total += sz;
+		if (drain == false) {
+			break;
+		}
+	}
+	return total;
+}
+
+/* Output sent to a session's connection is kept in its ring */
+static void ptyRecord(struct ptyrelay_t *r, const char *data, size_t len)
+{
+	if (r == NULL || r->ring == NULL) {
+		return;
+	}
+	if (len > PTY_RING_SIZE) {
+		r->out_cnt += len - PTY_RING_SIZE;
+		data += len - PTY_RING_SIZE;
+		len = PTY_RING_SIZE;
+	}
+	while (len > 0) {
+		size_t pos = r->out_cnt % PTY_RING_SIZE;
+		size_t chunk = (len < PTY_RING_SIZE - pos) ? len : PTY_RING_SIZE - pos;
+		memcpy(&r->ring[pos], data, chunk);
+		r->out_cnt += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+	/* New output is only sent once the resent one has been */
+	r->replay_from = r->out_cnt;
+}
+
+static bool ptyFlush(int fd, struct ptybuf_t *b, bool sock, struct ptyrelay_t *rec)
+{
+	while (b->off < b->len) {
+		ssize_t sz = sock ? send(fd, &b->buf[b->off], b->len - b->off, MSG_NOSIGNAL)
+		    : write(fd, &b->buf[b->off], b->len - b->off);
+		if (sz == -1 && errno == EINTR) {
+			continue;
+		}
+		if (sz == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if (sz <= 0) {
+			return false;
+		}
+		ptyRecord(rec, &b->buf[b->off], sz);
+		b->off += sz;
+	}
+	b->off = b->len = 0;
+	return true;
+}
+
+static bool ptyReplaying(struct ptyrelay_t *r)
+{
+	return (r->ring != NULL && r->replay_from < r->out_cnt);
+}
+
+/* Sends the output which a resumed connection asked for again, from the ring */
+static bool ptyReplay(struct ptyrelay_t *r)
+{
+	while (ptyReplaying(r)) {
+		size_t pos = r->replay_from % PTY_RING_SIZE;
+		uint64_t left = r->out_cnt - r->replay_from;
+		size_t len = (left < PTY_RING_SIZE - pos) ? left : PTY_RING_SIZE - pos;
+		ssize_t sz = send(r->conn_out, &r->ring[pos], len, MSG_NOSIGNAL);
+		if (sz == -1 && errno == EINTR) {
+			continue;
+		}
+		if (sz == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if (sz <= 0) {
+			return false;
+		}
+		r->replay_from += sz;
+	}
+	return true;
+}
+
+static bool ptySendConn(struct ptyrelay_t *r)
+{
+	if (ptyReplay(r) == false) {
+		return false;
+	}
+	if (ptyReplaying(r)) {
+		return true;
+	}
+	return ptyFlush(r->conn_out, &r->to_conn, r->conn_sock, r);
+}
+
+/* The jail has sent its pty master (or has failed, or exited before it could) */
+static void ptyPumpSetup(struct ptyrelay_t *r, short setup_ev)
+{
+	if ((setup_ev & (POLLIN | POLLHUP | POLLERR)) == 0) {
+		return;
+	}
+	bool ret = ptyRecvMaster(r->pid, r->setup_fd, &r->master);
+	close(r->setup_fd);
+	r->setup_fd = -1;
+	if (ret == false) {
+		r->master_eof = true;
+		r->eof_at = time(NULL);
+		return;
+	}
+	ptySetNonBlock(r->master);
+	LOG_D("Received the pty master of PID %d (fd: %d)", r->pid, r->master);
+}
+
+static void ptyPump(struct ptyrelay_t *r, short in_ev, short out_ev, short master_ev)
+{
+	if (r->setup_fd != -1) {
+		ptyPumpSetup(r, master_ev);
+		master_ev = 0;
+	}
+	if (r->in_eof == false && (in_ev & (POLLIN | POLLHUP | POLLERR))) {
+		ssize_t sz = ptyFill(r->conn_in, &r->to_master, false);
+		if (sz == -1) {
+			r->in_eof = true;
+		} else {
+			r->in_cnt += sz;
+		}
+	}
+	if (r->master_eof == false && (master_ev & (POLLIN | POLLHUP | POLLERR))) {
+		if (ptyFill(r->master, &r->to_conn, true) == -1) {
+			r->master_eof = true;
+			r->eof_at = time(NULL);
+		}
+	}
+	if (r->master_eof == false && r->master != -1 && r->to_master.len > r->to_master.off) {
+		if (ptyFlush(r->master, &r->to_master, r->master_sock, NULL) == false) {
+			r->master_eof = true;
+			r->eof_at = time(NULL);
+		}
+	}
+	/* A socketpair gets the half-close once the input is flushed, a pty can't pass it on */
+	if (r->in_eof == true && r->master_sock == true && r->master_shut == false
+	    && r->master_eof == false && r->to_master.len == r->to_master.off) {
+		if (shutdown(r->master, SHUT_WR) == -1) {
+			PLOG_W("shutdown(%d, SHUT_WR)", r->master);
+		}
+		r->master_shut = true;
+	}
+	if (out_ev & (POLLOUT | POLLERR | POLLHUP)) {
+		/* POLLHUP: the connection is closed in both directions, not just half-closed */
+		if (ptySendConn(r) == false || (out_ev & (POLLERR | POLLHUP))) {
+			r->conn_err = true;
+		}
+	}
+}
+
+/* The jail keeps running, and its output is buffered (up to PTY_BUF_SIZE) meanwhile */
+static void ptyDetach(struct ptyrelay_t *r)
+{
+	close(r->conn_in);
+	close(r->conn_out);
+	r->conn_in = r->conn_out = -1;
+	/* A resumed connection can't undo the half-close of a previous one */
+	r->in_eof = r->master_shut;
+	r->conn_err = false;
+	r->detached = true;
+	r->detached_at = time(NULL);
+	LOG_I("Session of PID %d detached, it can be resumed for %u seconds", r->pid, r->grace);
+}
+
+/*
+ * A session whose connection is gone is detached, and is done once its grace period is over. A
+ * half-closed connection stays attached, it still gets the output
+ */
+static bool ptyDone(struct ptyrelay_t *r)
+{
+	if (r->token[0] != '\0') {
+		if (r->detached == false && r->conn_err == true) {
+			ptyDetach(r);
+		}
+		if (r->detached == true) {
+			return (time(NULL) - r->detached_at >= r->grace);
+		}
+	}
+	if (r->conn_err == true) {
+		return true;
+	}
+	if (r->in_eof == true && r->hangup_on_eof == true) {
+		return true;
+	}
+	if (r->master_eof == false) {
+		return false;
+	}
+	if (r->to_conn.len == r->to_conn.off && ptyReplaying(r) == false) {
+		return true;
+	}
+	return (time(NULL) - r->eof_at >= PTY_LINGER_SEC);
+}
+
+/* Closing the master hangs the jail's terminal up (SIGHUP) if it's still running */
+static void ptyRemove(struct ptyrelay_t *r)
+{
+	LOG_D("Closing the relay of PID %d", r->pid);
+	if (r->detached == true && r->master_eof == false) {
+		LOG_I("Session of PID %d expired, killing it", r->pid);
+		kill(r->pid, SIGKILL);
+	}
+	ptyCloseFd(r->master);
+	ptyCloseFd(r->setup_fd);
+	if (r->detached == false) {
+		close(r->conn_in);
+		close(r->conn_out);
+	}
+	TAILQ_REMOVE(&ptyRelays, r, pointers);
+	ptyRelaysCnt--;
+	free(r->ring);
+	free(r);
+}
+
+static int ptyPoll(struct nsjconf_t *nsjconf, int listenfd, int timeout_ms)
+{
+	size_t cnt = 1 + ptyRelaysCnt * 3 + connCount();
+	if (cnt > ptyPfdsCnt) {
+		ptyPfds = realloc(ptyPfds, cnt * sizeof(struct pollfd));
+		if (ptyPfds == NULL) {
+			PLOG_F("realloc(%zu)", cnt * sizeof(struct pollfd));
+		}
+		ptyPfdsCnt = cnt;
+	}
+
+	ptyPfds[0].fd = listenfd;
+	ptyPfds[0].events = POLLIN;
+	size_t i = 1;
+	struct ptyrelay_t *r;
+	TAILQ_FOREACH(r, &ptyRelays, pointers) {
+		/* Flow control: nothing is read while there's no space to buffer it */
+		bool in = (r->in_eof == false && r->master_eof == false
+			   && r->to_master.len < sizeof(r->to_master.buf));
+		bool mst = (r->master_eof == false && r->to_conn.len < sizeof(r->to_conn.buf));
+		ptyPfds[i].fd = in ? r->conn_in : -1;
+		ptyPfds[i++].events = POLLIN;
+		bool out = (r->to_conn.len > r->to_conn.off || ptyReplaying(r));
+		/* A session's half-closed connection is polled for POLLHUP, i.e. for being gone */
+		bool half = (r->token[0] != '\0' && r->in_eof == true && r->detached == false);
+		ptyPfds[i].fd = (out || half) ? r->conn_out : -1;
+		ptyPfds[i++].events = out ? POLLOUT : 0;
+		if (r->setup_fd != -1) {
+			ptyPfds[i].fd = r->setup_fd;
+			ptyPfds[i++].events = POLLIN;
+			continue;
+		}
+		/*
+		 * POLLHUP is reported even without any events (e.g. once the jail has exited), so a
+		 * master which can't be read from or written to now isn't polled at all
+		 */
+		short events = (mst ? POLLIN : 0) |
+		    ((r->to_master.len > r->to_master.off) ? POLLOUT : 0);
+		ptyPfds[i].fd = (r->master_eof || events == 0) ? -1 : r->master;
+		ptyPfds[i++].events = events;
+	}
+	/* The connections which haven't sent their session line yet */
+	size_t conn_i = i;
+	connPollFds(&ptyPfds[conn_i]);
+
+	int ret = poll(ptyPfds, cnt, connTimeout(timeout_ms));
+	if (ret == -1) {
+		if (errno != EINTR) {
+			PLOG_W("poll()");
+		}
+		/* Detached sessions expire without any I/O, the SIGALRM timer gets them here */
+		for (i = 0; i < cnt; i++) {
+			ptyPfds[i].revents = 0;
+		}
+	}
+
+	i = 1;
+	struct ptyrelay_t *next;
+	for (r = TAILQ_FIRST(&ptyRelays); r != NULL; r = next) {
+		next = TAILQ_NEXT(r, pointers);
+		ptyPump(r, ptyPfds[i].revents, ptyPfds[i + 1].revents, ptyPfds[i + 2].revents);
+		i += 3;
+		if (ptyDone(r)) {
+			ptyRemove(r);
+		}
+	}
+	/* After the relays, a connection can resume the session of one of them */
+	connPump(nsjconf, &ptyPfds[conn_i]);
+	return ret;
+}
+
+/*
+ * Attaches connfd to the session with this token. A session which is still attached (e.g. its
+ * previous connection has gone quiet, but isn't closed yet) is taken over
+ */
+bool ptyResume(const char *token, uint64_t received, int connfd)
+{
+	struct ptyrelay_t *r;
+	TAILQ_FOREACH(r, &ptyRelays, pointers) {
+		if (r->token[0] != '\0' && sessionTokenEq(r->token, token)) {
+			break;
+		}
+	}
+	if (r == NULL) {
+		return false;
+	}
+
+	int conn_in = fcntl(connfd, F_DUPFD_CLOEXEC, 0);
+	int conn_out = fcntl(connfd, F_DUPFD_CLOEXEC, 0);
+	if (conn_in == -1 || conn_out == -1) {
+		PLOG_E("fcntl(F_DUPFD_CLOEXEC)");
+		if (conn_in != -1) {
+			close(conn_in);
+		}
+		if (conn_out != -1) {
+			close(conn_out);
+		}
+		return true;
+	}
+	if (r->detached == false) {
+		LOG_I("Session of PID %d resumed while still attached", r->pid);
+		ptyDetach(r);
+	}
+
+	/* Output which is no longer in the ring is lost, the offset in the reply tells the client */
+	uint64_t oldest = (r->out_cnt > PTY_RING_SIZE) ? r->out_cnt - PTY_RING_SIZE : 0;
+	if (received > r->out_cnt) {
+		LOG_W("Session of PID %d: the client claims to have received %" PRIu64 " bytes, only "
+		      "%" PRIu64 " were sent", r->pid, received, r->out_cnt);
+		received = r->out_cnt;
+	}
+	if (received < oldest) {
+		LOG_W("Session of PID %d: %" PRIu64 " bytes of output can't be sent again", r->pid,
+		      oldest - received);
+		received = oldest;
+	}
+	if (sessionGreet(conn_out, r->token, r->in_cnt, received) == false) {
+		close(conn_in);
+		close(conn_out);
+		return true;
+	}
+
+	LOG_I("Session of PID %d resumed after %ld seconds, sending %" PRIu64 " bytes again",
+	      r->pid, (long)(time(NULL) - r->detached_at), r->out_cnt - received);
+	r->conn_in = conn_in;
+	r->conn_out = conn_out;
+	r->conn_sock = true;
+	r->replay_from = received;
+	r->detached = false;
+	ptySetConnSock(r);
+	return true;
+}
+
+/*
+ * Waits for a new connection on listenfd (or for a signal), relaying the ptys, and setting the
+ * accepted connections up (see conn.c) meanwhile. Returns whether listenfd can be accepted on without blocking
+ */
+bool ptyWait(struct nsjconf_t *nsjconf, int listenfd)
+{
+	if ((nsjconf->pty == false && nsjconf->session_grace == 0 && nsjconf->tls_ctx == NULL)
+	    || (listenfd == -1 && TAILQ_EMPTY(&ptyRelays))) {
+		if (listenfd == -1) {
+			pause();
+		}
+		return true;
+	}
+	if (ptyPoll(nsjconf, listenfd, -1) <= 0) {
+		return false;
+	}
+	return (listenfd != -1) && (ptyPfds[0].revents & POLLIN);
+}
+
+/* SIGWINCH: the supervisor's terminal has been resized */
+void ptyResize(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->pty == false) {
+		return;
+	}
+	struct ptyrelay_t *r;
+	TAILQ_FOREACH(r, &ptyRelays, pointers) {
+		struct winsize ws;
+		if (r->master == -1 || isatty(r->conn_in) == 0
+		    || ioctl(r->conn_in, TIOCGWINSZ, &ws) == -1) {
+			continue;
+		}
+		if (ioctl(r->master, TIOCSWINSZ, &ws) == -1) {
+			PLOG_W("ioctl(%d, TIOCSWINSZ)", r->master);
+		}
+	}
+}
+
+/* Flushes the output of the finished jails, and gives the terminal back */
+void ptyFinish(struct nsjconf_t *nsjconf)
+{
+	if (nsjconf->pty == false) {
+		return;
+	}
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (TAILQ_EMPTY(&ptyRelays) == false) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 +
+		    (now.tv_nsec - start.tv_nsec) / 1000000;
+		if (elapsed_ms >= PTY_FINISH_MS) {
+			break;
+		}
+		ptyPoll(nsjconf, -1, PTY_FINISH_MS - elapsed_ms);
+	}
+	while (TAILQ_EMPTY(&ptyRelays) == false) {
+		ptyRemove(TAILQ_FIRST(&ptyRelays));
+	}
+	ptyRestoreTerm();
+}
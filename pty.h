@@ -0,0 +1,38 @@
+/*
+
+   nsjail - pseudo-terminals for the jails
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_PTY_H
+#define NS_PTY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+bool ptyApply(struct nsjconf_t *nsjconf, int pipefd);
+bool ptyInitFromParent(struct nsjconf_t *nsjconf, pid_t pid, int pipefd, int relay_fd, int fd_in,
+		       int fd_out);
+bool ptyResume(const char *token, uint64_t received, int connfd);
+bool ptyWait(struct nsjconf_t *nsjconf, int listenfd);
+void ptyResize(struct nsjconf_t *nsjconf);
+void ptyFinish(struct nsjconf_t *nsjconf);
+
+#endif				/* NS_PTY_H */
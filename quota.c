@@ -0,0 +1,173 @@
+/*
+
+   nsjail - disk quotas for scratch directories
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "quota.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/quota.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#ifndef __NR_quotactl_fd
+#define __NR_quotactl_fd 443
+#endif				/* __NR_quotactl_fd */
+
+/* Number of project IDs used, counting from --scratch_quota_projid */
+#define QUOTA_PROJID_RANGE (1U << 20)
+
+static int quotaFsFd = -1;
+static unsigned int quotaCnt = 0;
+
+static bool quotaEnabled(struct nsjconf_t *nsjconf)
+{
+	return (nsjconf->scratch_quota_bytes != 0 || nsjconf->scratch_quota_inodes != 0);
+}
+
+static bool quotaSetLimits(unsigned int projid, uint64_t bytes, uint64_t inodes)
+{
+	struct dqblk dq = {
+		/* In QIF_DQBLKSIZE (1024 bytes) units */
+		.dqb_bhardlimit = (bytes + QIF_DQBLKSIZE - 1) / QIF_DQBLKSIZE,
+		.dqb_bsoftlimit = 0,
+		.dqb_ihardlimit = inodes,
+		.dqb_isoftlimit = 0,
+		.dqb_valid = QIF_LIMITS,
+	};
+	if (syscall(__NR_quotactl_fd, quotaFsFd, QCMD(Q_SETQUOTA, PRJQUOTA), projid, &dq) == -1) {
+		PLOG_E("quotactl_fd(Q_SETQUOTA, PRJQUOTA, id=%u, bytes=%" PRIu64 ", inodes=%"
+		       PRIu64 ")", projid, bytes, inodes);
+		return false;
+	}
+	return true;
+}
+
+bool quotaInit(struct nsjconf_t * nsjconf)
+{
+	if (quotaEnabled(nsjconf) == false) {
+		return true;
+	}
+	if (nsjconf->scratch_dir == NULL) {
+		LOG_E("Disk quotas can only be applied to --scratch_dir directories");
+		return false;
+	}
+	quotaFsFd = TEMP_FAILURE_RETRY(open(nsjconf->scratch_dir, O_DIRECTORY | O_CLOEXEC));
+	if (quotaFsFd == -1) {
+		PLOG_E("open('%s', O_DIRECTORY)", nsjconf->scratch_dir);
+		return false;
+	}
+	struct dqblk dq;
+	if (syscall(__NR_quotactl_fd, quotaFsFd, QCMD(Q_GETQUOTA, PRJQUOTA),
+		    nsjconf->scratch_quota_projid, &dq) == -1) {
+		PLOG_E("Project quotas are not usable on '%s'. Is the file-system mounted with "
+		       "'prjquota' (and is the kernel >= 5.14)?", nsjconf->scratch_dir);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Called before the new process is allowed to continue, i.e. before the scratch directory is
+ * mounted inside the jail. The directory comes from the pool, so it's empty, and setting
+ * the project ID (with inheritance) on the directory itself is enough
+ */
+bool quotaInitFromParent(struct nsjconf_t * nsjconf, struct pids_t * p)
+{
+	p->projid = 0;
+	p->quota_peak_bytes = 0;
+	p->quota_peak_inodes = 0;
+	if (quotaEnabled(nsjconf) == false) {
+		return true;
+	}
+
+	unsigned int projid = nsjconf->scratch_quota_projid + (quotaCnt++ % QUOTA_PROJID_RANGE);
+	if (quotaSetLimits(projid, nsjconf->scratch_quota_bytes, nsjconf->scratch_quota_inodes) ==
+	    false) {
+		return false;
+	}
+
+	int fd = TEMP_FAILURE_RETRY(open(nsjconf->scratch_cur, O_DIRECTORY | O_CLOEXEC));
+	if (fd == -1) {
+		PLOG_E("open('%s', O_DIRECTORY)", nsjconf->scratch_cur);
+		return false;
+	}
+	struct fsxattr fsx;
+	if (ioctl(fd, FS_IOC_FSGETXATTR, &fsx) == -1) {
+		PLOG_E("ioctl('%s', FS_IOC_FSGETXATTR)", nsjconf->scratch_cur);
+		close(fd);
+		return false;
+	}
+	fsx.fsx_projid = projid;
+	fsx.fsx_xflags |= FS_XFLAG_PROJINHERIT;
+	if (ioctl(fd, FS_IOC_FSSETXATTR, &fsx) == -1) {
+		PLOG_E("ioctl('%s', FS_IOC_FSSETXATTR, projid=%u)", nsjconf->scratch_cur, projid);
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	LOG_D("PID: %d uses project ID %u for '%s'", p->pid, projid, nsjconf->scratch_cur);
+	p->projid = projid;
+	return true;
+}
+
+void quotaSample(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	if (quotaEnabled(nsjconf) == false || p->projid == 0) {
+		return;
+	}
+	struct dqblk dq;
+	if (syscall(__NR_quotactl_fd, quotaFsFd, QCMD(Q_GETQUOTA, PRJQUOTA), p->projid, &dq) ==
+	    -1) {
+		PLOG_D("quotactl_fd(Q_GETQUOTA, PRJQUOTA, id=%u)", p->projid);
+		return;
+	}
+	if (dq.dqb_curspace > p->quota_peak_bytes) {
+		p->quota_peak_bytes = dq.dqb_curspace;
+	}
+	if (dq.dqb_curinodes > p->quota_peak_inodes) {
+		p->quota_peak_inodes = dq.dqb_curinodes;
+	}
+}
+
+/*
+ * Files of the finished jail keep the project ID until they're removed from the trash, but
+ * they don't count against anything once the limits are gone
+ */
+void quotaFinishFromParent(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	if (quotaEnabled(nsjconf) == false || p->projid == 0) {
+		return;
+	}
+	quotaSample(nsjconf, p);
+	LOG_I("PID: %d scratch directory usage peak: %" PRIu64 " bytes, %" PRIu64
+	      " inodes (project ID: %u)", p->pid, p->quota_peak_bytes, p->quota_peak_inodes,
+	      p->projid);
+	quotaSetLimits(p->projid, 0, 0);
+}
@@ -29,10 +29,27 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "landlock.h"
 #include "log.h"
 
 #include "seccomp/bpf-helper.h"
 
+static bool sandboxCommit(const struct sock_fprog *prog)
+{
+#ifndef PR_SET_NO_NEW_PRIVS
+#define PR_SET_NO_NEW_PRIVS 38
+#endif				/* PR_SET_NO_NEW_PRIVS */
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
+		PLOG_W("prctl(PR_SET_NO_NEW_PRIVS, 1) failed");
+		return false;
+	}
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, prog, 0, 0)) {
+		PLOG_W("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER) failed");
+		return false;
+	}
+	return true;
+}
+
 /*
  * A demo policy, it disallows syslog and ptrace syscalls, both in 32 and 64
  * modes
@@ -73,15 +90,7 @@ static bool sandboxPrepareAndCommit(void)
 		LOG_W("bpf_resolve_jumps() failed");
 		return false;
 	}
-#ifndef PR_SET_NO_NEW_PRIVS
-#define PR_SET_NO_NEW_PRIVS 38
-#endif				/* PR_SET_NO_NEW_PRIVS */
-	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
-		PLOG_W("prctl(PR_SET_NO_NEW_PRIVS, 1) failed");
-		return false;
-	}
-	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0)) {
-		PLOG_W("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER) failed");
+	if (sandboxCommit(&prog) == false) {
 		return false;
 	}
 #endif				/* defined(__x86_64__) || defined(__i386__) */
@@ -90,9 +99,20 @@ static bool sandboxPrepareAndCommit(void)
 
 bool sandboxApply(struct nsjconf_t * nsjconf)
 {
+	if (landlockApply(nsjconf) == false) {
+		return false;
+	}
 	if (nsjconf->apply_sandbox == false) {
 		return true;
 	}
+	/* With --seccomp_learn, learnApply() installs its own filter instead */
+	if (nsjconf->seccomp_learn != NULL) {
+		return true;
+	}
+	/* Compiled by policyInit() from --seccomp_policy */
+	if (nsjconf->seccomp_prog != NULL) {
+		return sandboxCommit(nsjconf->seccomp_prog);
+	}
 	if (sandboxPrepareAndCommit() == false) {
 		return false;
 	}
@@ -0,0 +1,345 @@
+/*
+
+   nsjail - per-jail scratch directories
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "scratch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/*
+ * Layout of --scratch_dir:
+ *  pool/  - pre-made, empty directories, ready to be handed out
+ *  jails/ - directories currently bind-mounted into running jails
+ *  trash/ - directories of finished jails, removed in the background
+ *
+ * The supervisor only ever does rename() here, so acquiring and releasing a scratch
+ * directory is O(1). The pool is refilled and the trash is emptied by a separate, low
+ * priority helper process.
+ */
+static DIR *scratchPoolDir = NULL;
+static int scratchJailsFd = -1;
+static int scratchTrashFd = -1;
+static int scratchWakeFd = -1;
+static unsigned int scratchCnt = 0;
+
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static void scratchWake(void)
+{
+	const char c = 'W';
+	/* Non-blocking, a full pipe means that the helper has already been woken up */
+	if (write(scratchWakeFd, &c, sizeof(c)) == -1 && errno != EAGAIN) {
+		PLOG_D("write(scratchWakeFd)");
+	}
+}
+
+static bool scratchMkdir(struct nsjconf_t *nsjconf, int dirfd, const char *name)
+{
+	if (mkdirat(dirfd, name, 0700) == -1) {
+		return false;
+	}
+	if (geteuid() == 0 && fchownat(dirfd, name, nsjconf->outside_uid, nsjconf->outside_gid, 0)
+	    == -1) {
+		PLOG_W("fchownat('%s', %u, %u)", name, nsjconf->outside_uid, nsjconf->outside_gid);
+	}
+	return true;
+}
+
+static unsigned int scratchCountEntries(DIR * dir)
+{
+	unsigned int cnt = 0;
+	rewinddir(dir);
+	for (;;) {
+		struct dirent *entry = readdir(dir);
+		if (entry == NULL) {
+			break;
+		}
+		if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) {
+			continue;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+static void scratchRefillPool(struct nsjconf_t *nsjconf, DIR * pool)
+{
+	static unsigned int cnt = 0;
+	for (unsigned int i = scratchCountEntries(pool); i < nsjconf->scratch_pool;) {
+		char name[64];
+		snprintf(name, sizeof(name), "p%d.%u", (int)getpid(), cnt++);
+		if (scratchMkdir(nsjconf, dirfd(pool), name) == true) {
+			i++;
+		} else if (errno != EEXIST) {
+			PLOG_W("mkdirat('%s/pool/%s')", nsjconf->scratch_dir, name);
+			return;
+		}
+	}
+}
+
+static struct timespec scratchRmDelay;
+
+static int scratchRemoveEntry(const char *fpath, const struct stat *sb, int typeflag,
+			      struct FTW *ftwbuf)
+{
+	(void)sb;
+	(void)ftwbuf;
+	if (typeflag == FTW_DP) {
+		if (rmdir(fpath) == -1) {
+			PLOG_W("rmdir('%s')", fpath);
+		}
+	} else {
+		if (unlink(fpath) == -1) {
+			PLOG_W("unlink('%s')", fpath);
+		}
+	}
+	if (scratchRmDelay.tv_sec || scratchRmDelay.tv_nsec) {
+		nanosleep(&scratchRmDelay, NULL);
+	}
+	return 0;
+}
+
+static void scratchEmptyTrash(struct nsjconf_t *nsjconf, DIR * pool, DIR * trash)
+{
+	rewinddir(trash);
+	for (;;) {
+		struct dirent *entry = readdir(trash);
+		if (entry == NULL) {
+			break;
+		}
+		if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) {
+			continue;
+		}
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/trash/%s", nsjconf->scratch_dir, entry->d_name);
+		LOG_D("Removing '%s'", path);
+		if (nftw(path, scratchRemoveEntry, 32, FTW_DEPTH | FTW_PHYS | FTW_MOUNT) == -1) {
+			PLOG_W("nftw('%s')", path);
+		}
+		/* New jails shouldn't wait for the trash to be emptied */
+		scratchRefillPool(nsjconf, pool);
+	}
+}
+
+static void scratchHelper(struct nsjconf_t *nsjconf, int wakefd)
+{
+	if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1) {
+		PLOG_W("prctl(PR_SET_PDEATHSIG, SIGKILL)");
+	}
+	if (syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1) {
+		PLOG_W("ioprio_set(IOPRIO_CLASS_IDLE)");
+	}
+	errno = 0;
+	if (setpriority(PRIO_PROCESS, 0, 19) == -1 && errno != 0) {
+		PLOG_W("setpriority(19)");
+	}
+	if (nsjconf->scratch_rm_rate > 0) {
+		long nsec = 1000000000L / nsjconf->scratch_rm_rate;
+		scratchRmDelay.tv_sec = nsec / 1000000000L;
+		scratchRmDelay.tv_nsec = nsec % 1000000000L;
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/pool", nsjconf->scratch_dir);
+	DIR *pool = opendir(path);
+	snprintf(path, sizeof(path), "%s/trash", nsjconf->scratch_dir);
+	DIR *trash = opendir(path);
+	if (pool == NULL || trash == NULL) {
+		PLOG_E("opendir('%s/{pool,trash}')", nsjconf->scratch_dir);
+		_exit(1);
+	}
+
+	for (;;) {
+		scratchRefillPool(nsjconf, pool);
+		scratchEmptyTrash(nsjconf, pool, trash);
+
+		struct pollfd pfd = {.fd = wakefd,.events = POLLIN,.revents = 0 };
+		if (poll(&pfd, 1, 1000) == -1 && errno != EINTR) {
+			PLOG_E("poll()");
+			_exit(1);
+		}
+		char buf[64];
+		if (pfd.revents & POLLIN) {
+			while (read(wakefd, buf, sizeof(buf)) > 0) ;
+		}
+		if (pfd.revents & POLLHUP) {
+			_exit(0);
+		}
+	}
+}
+
+bool scratchInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->scratch_dir == NULL) {
+		return true;
+	}
+
+	int basefd = TEMP_FAILURE_RETRY(open(nsjconf->scratch_dir, O_DIRECTORY | O_CLOEXEC));
+	if (basefd == -1) {
+		PLOG_E("open('%s', O_DIRECTORY)", nsjconf->scratch_dir);
+		return false;
+	}
+	const char *subdirs[] = { "pool", "jails", "trash" };
+	for (size_t i = 0; i < ARRAYSIZE(subdirs); i++) {
+		if (mkdirat(basefd, subdirs[i], 0700) == -1 && errno != EEXIST) {
+			PLOG_E("mkdirat('%s/%s')", nsjconf->scratch_dir, subdirs[i]);
+			close(basefd);
+			return false;
+		}
+	}
+	scratchJailsFd = openat(basefd, "jails", O_DIRECTORY | O_CLOEXEC);
+	scratchTrashFd = openat(basefd, "trash", O_DIRECTORY | O_CLOEXEC);
+	int poolfd = openat(basefd, "pool", O_DIRECTORY | O_CLOEXEC);
+	close(basefd);
+	if (scratchJailsFd == -1 || scratchTrashFd == -1 || poolfd == -1) {
+		PLOG_E("openat('%s/{pool,jails,trash}')", nsjconf->scratch_dir);
+		return false;
+	}
+	if ((scratchPoolDir = fdopendir(poolfd)) == NULL) {
+		PLOG_E("fdopendir('%s/pool')", nsjconf->scratch_dir);
+		return false;
+	}
+
+	/* Left-overs from a previous instance */
+	int jailsfd = dup(scratchJailsFd);
+	DIR *jails = (jailsfd == -1) ? NULL : fdopendir(jailsfd);
+	if (jails == NULL) {
+		PLOG_E("fdopendir('%s/jails')", nsjconf->scratch_dir);
+		return false;
+	}
+	for (;;) {
+		struct dirent *entry = readdir(jails);
+		if (entry == NULL) {
+			break;
+		}
+		if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) {
+			continue;
+		}
+		if (renameat(scratchJailsFd, entry->d_name, scratchTrashFd, entry->d_name) == -1) {
+			PLOG_W("renameat('%s/jails/%s')", nsjconf->scratch_dir, entry->d_name);
+		}
+	}
+	closedir(jails);
+
+	int pipefd[2];
+	if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) == -1) {
+		PLOG_E("pipe2()");
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		PLOG_E("fork()");
+		return false;
+	}
+	if (pid == 0) {
+		close(pipefd[1]);
+		scratchHelper(nsjconf, pipefd[0]);
+		_exit(0);
+	}
+	close(pipefd[0]);
+	scratchWakeFd = pipefd[1];
+
+	LOG_D("Scratch directories in '%s', helper PID: %d", nsjconf->scratch_dir, (int)pid);
+	return true;
+}
+
+/*
+ * Moves a directory from the pool (or creates a new one, if the pool is empty) to jails/,
+ * and makes nsjconf->scratch_cur point to it, so it gets bind-mounted into the next jail
+ */
+bool scratchAcquire(struct nsjconf_t * nsjconf, char *name, size_t len)
+{
+	if (nsjconf->scratch_dir == NULL) {
+		name[0] = '\0';
+		return true;
+	}
+
+	bool found = false;
+	rewinddir(scratchPoolDir);
+	for (;;) {
+		struct dirent *entry = readdir(scratchPoolDir);
+		if (entry == NULL) {
+			break;
+		}
+		if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) {
+			continue;
+		}
+		if (renameat(dirfd(scratchPoolDir), entry->d_name, scratchJailsFd, entry->d_name) ==
+		    0) {
+			snprintf(name, len, "%s", entry->d_name);
+			found = true;
+			break;
+		}
+	}
+	if (found == false) {
+		LOG_D("Pool of scratch directories is empty, creating a new one");
+		for (;;) {
+			snprintf(name, len, "%d.%u", (int)getpid(), scratchCnt++);
+			if (scratchMkdir(nsjconf, scratchJailsFd, name) == true) {
+				break;
+			}
+			if (errno != EEXIST) {
+				PLOG_E("mkdirat('%s/jails/%s')", nsjconf->scratch_dir, name);
+				return false;
+			}
+		}
+	}
+	scratchWake();
+
+	snprintf(nsjconf->scratch_cur, sizeof(nsjconf->scratch_cur), "%s/jails/%s",
+		 nsjconf->scratch_dir, name);
+	LOG_D("Using scratch directory '%s'", nsjconf->scratch_cur);
+	return true;
+}
+
+void scratchRelease(struct nsjconf_t *nsjconf, const char *name)
+{
+	if (nsjconf->scratch_dir == NULL || name[0] == '\0') {
+		return;
+	}
+	LOG_D("Moving '%s/jails/%s' to the trash", nsjconf->scratch_dir, name);
+	if (renameat(scratchJailsFd, name, scratchTrashFd, name) == -1) {
+		PLOG_W("renameat('%s/jails/%s', '%s/trash/%s')", nsjconf->scratch_dir, name,
+		       nsjconf->scratch_dir, name);
+		return;
+	}
+	scratchWake();
+}
@@ -0,0 +1,128 @@
+/*
+
+   nsjail - seccomp-bpf overhead microbenchmark
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * Run inside nsjail (see 'make seccomp-bench'). Prints the average cost of each tested
+ * syscall in nanoseconds, one 'name ns' pair per line. With 'x32' it calls getpid() with the
+ * x32 syscall number instead, which a policy must kill (it exits with 2 if there's no x32)
+ */
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t benchNowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int benchZeroFd = -1;
+static uint32_t benchFutex = 0;
+
+static void benchGetpid(void)
+{
+	syscall(__NR_getpid);
+}
+
+static void benchRead(void)
+{
+	char c;
+	if (read(benchZeroFd, &c, sizeof(c)) != sizeof(c)) {
+		abort();
+	}
+}
+
+static void benchFutexWake(void)
+{
+	syscall(__NR_futex, &benchFutex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Two syscalls per iteration */
+static void benchMmap(void)
+{
+	void *p = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		abort();
+	}
+	munmap(p, 4096);
+}
+
+static void benchRun(const char *name, void (*fn) (void), unsigned long iters,
+		     unsigned int syscalls)
+{
+	/* Warm up, and keep the best of a few runs, as the least disturbed one */
+	for (unsigned long i = 0; i < iters / 10; i++) {
+		fn();
+	}
+	double best = 0.0;
+	for (int run = 0; run < 5; run++) {
+		uint64_t start = benchNowNs();
+		for (unsigned long i = 0; i < iters; i++) {
+			fn();
+		}
+		double ns = (double)(benchNowNs() - start) / iters / syscalls;
+		if (run == 0 || ns < best) {
+			best = ns;
+		}
+	}
+	printf("%s %.1f\n", name, best);
+}
+
+/* Returns only if the syscall wasn't killed */
+static int benchX32(void)
+{
+#if defined(__x86_64__)
+	syscall(0x40000000 | __NR_getpid);
+	fprintf(stderr, "The x32 syscall wasn't killed\n");
+	return 1;
+#else
+	return 2;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "x32") == 0) {
+		return benchX32();
+	}
+	unsigned long iters = (argc > 1) ? strtoul(argv[1], NULL, 0) : 200000;
+
+	benchZeroFd = open("/dev/zero", O_RDONLY | O_CLOEXEC);
+	if (benchZeroFd == -1) {
+		perror("open('/dev/zero')");
+		return 1;
+	}
+
+	benchRun("getpid", benchGetpid, iters, 1);
+	benchRun("read", benchRead, iters, 1);
+	benchRun("futex", benchFutexWake, iters, 1);
+	benchRun("mmap", benchMmap, iters / 4, 2);
+	return 0;
+}
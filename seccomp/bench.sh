@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+#   nsjail - seccomp-bpf overhead microbenchmark
+#   -----------------------------------------
+#
+#   Copyright 2016 Google Inc. All Rights Reserved.
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+#
+# Usage: bench.sh NSJAIL BENCH [POLICY...]
+#
+# Runs BENCH inside the jail without a seccomp filter, with the built-in one, and with every
+# POLICY, and prints ns per syscall, and the slowdown relative to no filter. It fails if any
+# POLICY lets an x32 syscall through
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 NSJAIL BENCH [POLICY...]" >&2
+	exit 1
+fi
+NSJAIL="$1"
+BENCH="$2"
+shift 2
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+
+run() {
+	out="$1"
+	shift
+	if ! "$NSJAIL" -Mo --chroot / --disable_proc --log "$TMPDIR/log" "$@" -- "$BENCH" \
+		> "$TMPDIR/$out"; then
+		echo "Benchmark '$out' failed, see the nsjail log:" >&2
+		cat "$TMPDIR/log" >&2
+		exit 1
+	fi
+}
+
+run none --disable_sandbox
+run builtin
+COLS="none builtin"
+i=0
+for policy in "$@"; do
+	i=$((i + 1))
+	run "policy$i" --seccomp_policy "$policy"
+	echo "policy$i: $policy"
+	# Killed with SIGSYS (exit code 100 + 31), or 2 without x32
+	rc=0
+	"$NSJAIL" -Mo --chroot / --disable_proc --log "$TMPDIR/log" --seccomp_policy "$policy" \
+		-- "$BENCH" x32 || rc=$?
+	if [ "$rc" -ne 131 ] && [ "$rc" -ne 2 ]; then
+		echo "Policy '$policy' doesn't kill x32 syscalls (exit code: $rc)" >&2
+		exit 1
+	fi
+	COLS="$COLS policy$i"
+done
+
+cd "$TMPDIR"
+# shellcheck disable=SC2086
+awk -v cols="$COLS" '
+	BEGIN { n = split(cols, c, " ") }
+	{ ns[FILENAME, $1] = $2; if (FILENAME == "none") { tests[++t] = $1 } }
+	END {
+		printf "%-8s", "syscall"
+		for (i = 1; i <= n; i++) { printf " %18s", c[i] }
+		printf "\n"
+		for (j = 1; j <= t; j++) {
+			printf "%-8s", tests[j]
+			for (i = 1; i <= n; i++) {
+				v = ns[c[i], tests[j]]
+				printf " %8.1f ns (x%4.2f)", v, v / ns["none", tests[j]]
+			}
+			printf "\n"
+		}
+	}' $COLS
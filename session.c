@@ -0,0 +1,169 @@
+/*
+
+   nsjail - resumable sessions
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+/*
+ * With --session_grace, a jail's stdio is a socketpair (or its pty, with --pty) relayed by
+ * the supervisor (see pty.c), so the jail outlives its connection. The protocol, one line in
+ * each direction before the relayed stream:
+ *
+ *   client: 'SESSION\n' (new session) or 'SESSION <token> <bytes received so far>\n'
+ *   nsjail: 'SESSION <token> <bytes of input received so far> <offset of the output>\n'
+ *
+ * A resumed session gets its output again from the offset the client has asked for, as far
+ * as it's still buffered. If it isn't (or if the token is unknown, or expired, in which case
+ * a new session is started) the offset in the reply tells the client where the stream
+ * continues from.
+ *
+ * The session line is read from the supervisor's main loop (see conn.c), as it arrives.
+ */
+
+#include "session.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "pty.h"
+
+/*
+ * Reads what has arrived of the session line into buf (of which *off bytes have been read
+ * already), without blocking. Nothing after the '\n' is consumed, it belongs to the jail.
+ * Returns 1 once the whole line is in buf, 0 if more of it is needed, and -1 if the connection
+ * is gone, or if the line is too long
+ */
+int sessionReadLine(int fd, char *buf, size_t len, size_t *off)
+{
+	for (;;) {
+		size_t want = len - 1 - *off;
+		if (want == 0) {
+			LOG_W("The session line from fd %d is longer than %zu bytes", fd, len - 1);
+			return -1;
+		}
+		ssize_t sz =
+		    TEMP_FAILURE_RETRY(recv(fd, &buf[*off], want, MSG_PEEK | MSG_DONTWAIT));
+		if (sz == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if (sz <= 0) {
+			return -1;
+		}
+		char *nl = memchr(&buf[*off], '\n', sz);
+		size_t used = (nl != NULL) ? (size_t)(nl - &buf[*off]) + 1 : (size_t)sz;
+		if (TEMP_FAILURE_RETRY(recv(fd, &buf[*off], used, MSG_DONTWAIT)) != (ssize_t)used) {
+			PLOG_W("recv(%d, %zu)", fd, used);
+			return -1;
+		}
+		*off += used;
+		if (nl == NULL) {
+			continue;
+		}
+		size_t end = *off - 1;
+		if (end > 0 && buf[end - 1] == '\r') {
+			end--;
+		}
+		buf[end] = '\0';
+		return 1;
+	}
+}
+
+/* Returns whether connfd needs a new jail. If it doesn't, the caller still closes it */
+bool sessionAccept(int connfd, const char *line)
+{
+	if (strcmp(line, "SESSION") == 0) {
+		return true;
+	}
+
+	char token[SESSION_TOKEN_LEN + 1];
+	uint64_t received;
+	char extra;
+	/* %32s: SESSION_TOKEN_LEN */
+	if (sscanf(line, "SESSION %32s %" SCNu64 " %c", token, &received, &extra) != 2
+	    || strlen(token) != SESSION_TOKEN_LEN) {
+		LOG_W("Malformed session line from the connection");
+		return false;
+	}
+	if (ptyResume(token, received, connfd) == true) {
+		return false;
+	}
+	LOG_I("Unknown or expired session, starting a new one");
+	return true;
+}
+
+/* Without --pty, the jail gets one end of a socketpair as its stdio, and the relay the other */
+bool sessionPrepare(struct nsjconf_t *nsjconf, int *jail_fd, int *relay_fd)
+{
+	*jail_fd = *relay_fd = -1;
+	if (nsjconf->session_grace == 0 || nsjconf->pty == true) {
+		return true;
+	}
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		PLOG_E("socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC)");
+		return false;
+	}
+	*jail_fd = sv[0];
+	*relay_fd = sv[1];
+	return true;
+}
+
+bool sessionNewToken(char *token, size_t len)
+{
+	uint8_t rnd[SESSION_TOKEN_LEN / 2];
+	if (len < SESSION_TOKEN_LEN + 1) {
+		LOG_E("Session token buffer too small: %zu", len);
+		return false;
+	}
+	if (getrandom(rnd, sizeof(rnd), 0) != (ssize_t) sizeof(rnd)) {
+		PLOG_E("getrandom(%zu)", sizeof(rnd));
+		return false;
+	}
+	for (size_t i = 0; i < sizeof(rnd); i++) {
+		snprintf(&token[i * 2], 3, "%02x", rnd[i]);
+	}
+	return true;
+}
+
+/* In constant time, the tokens come from the network */
+bool sessionTokenEq(const char *a, const char *b)
+{
+	uint8_t diff = 0;
+	for (size_t i = 0; i < SESSION_TOKEN_LEN; i++) {
+		diff |= (uint8_t) a[i] ^ (uint8_t) b[i];
+	}
+	return (diff == 0);
+}
+
+bool sessionGreet(int fd, const char *token, uint64_t in_cnt, uint64_t out_cnt)
+{
+	char line[128];
+	int len = snprintf(line, sizeof(line), "SESSION %s %" PRIu64 " %" PRIu64 "\n", token,
+			   in_cnt, out_cnt);
+	if (TEMP_FAILURE_RETRY(send(fd, line, len, MSG_NOSIGNAL)) != len) {
+		PLOG_W("Couldn't send the session line to fd %d", fd);
+		return false;
+	}
+	return true;
+}
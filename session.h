@@ -0,0 +1,43 @@
+/*
+
+   nsjail - resumable sessions
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_SESSION_H
+#define NS_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Hex-encoded, 128 bits */
+#define SESSION_TOKEN_LEN 32
+/* How long a new connection can take to send its session line */
+#define SESSION_HELLO_TIMEOUT_SEC 5
+
+int sessionReadLine(int fd, char *buf, size_t len, size_t *off);
+bool sessionAccept(int connfd, const char *line);
+bool sessionPrepare(struct nsjconf_t *nsjconf, int *jail_fd, int *relay_fd);
+bool sessionNewToken(char *token, size_t len);
+bool sessionTokenEq(const char *a, const char *b);
+bool sessionGreet(int fd, const char *token, uint64_t in_cnt, uint64_t out_cnt);
+
+#endif				/* NS_SESSION_H */
@@ -24,6 +24,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <linux/sched.h>
 #include <netinet/in.h>
 #include <sched.h>
@@ -34,6 +35,7 @@
 #include <string.h>
 #include <sys/prctl.h>
 #include <sys/queue.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -43,14 +45,29 @@
 #include "common.h"
 #include "cgroup.h"
 #include "contain.h"
+#include "cpu.h"
+#include "criu.h"
+#include "env.h"
+#include "ksm.h"
+#include "learn.h"
 #include "log.h"
 #include "net.h"
+#include "perf.h"
+#include "pty.h"
+#include "quota.h"
 #include "sandbox.h"
+#include "scratch.h"
+#include "session.h"
 #include "user.h"
 #include "util.h"
 
 static const char subprocDoneChar = 'D';
 
+/* How often a jail whose processes are being killed is checked for being finished */
+#define SUBPROC_DRAIN_INTERVAL_MS 20
+/* Warn about processes which are still alive after that many seconds, e.g. stuck in the kernel */
+#define SUBPROC_DRAIN_WARN_SEC 10
+
 static int subprocNewProc(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err, int pipefd)
 {
 	if (containSetupFD(nsjconf, fd_in, fd_out, fd_err) == false) {
@@ -78,35 +95,50 @@ static int subprocNewProc(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int
 	if (containContain(nsjconf) == false) {
 		exit(1);
 	}
-	if (nsjconf->keep_env == false) {
-		clearenv();
-	}
-	struct charptr_t *p;
-	TAILQ_FOREACH(p, &nsjconf->envs, pointers) {
-		putenv(p->val);
-	}
+	char *const *envp = nsjconf->envp ? nsjconf->envp : nsjconf->env_prebuilt;
 
 	LOG_D("Trying to execve('%s')", nsjconf->argv[0]);
 	for (size_t i = 0; nsjconf->argv[i]; i++) {
 		LOG_D(" Arg[%zu]: '%s'", i, nsjconf->argv[i]);
 	}
 
-	/* Should be the last one in the sequence */
+	if (ptyApply(nsjconf, pipefd) == false) {
+		exit(1);
+	}
+
+	/* Should be the last ones in the sequence */
 	if (sandboxApply(nsjconf) == false) {
 		exit(1);
 	}
-	execv(nsjconf->argv[0], &nsjconf->argv[0]);
+	if (learnApply(nsjconf, pipefd) == false) {
+		exit(1);
+	}
+	logFlush();
+	execve(nsjconf->argv[0], &nsjconf->argv[0], envp);
 
 	PLOG_E("execve('%s') failed", nsjconf->argv[0]);
 
 	_exit(1);
 }
 
-static void subprocAdd(struct nsjconf_t *nsjconf, pid_t pid, int sock)
+static struct pids_t *subprocAdd(struct nsjconf_t *nsjconf, pid_t pid, int sock,
+				 const char *scratch)
 {
 	struct pids_t *p = utilMalloc(sizeof(struct pids_t));
 	p->pid = pid;
+	p->jail_id = 0;
 	p->start = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &p->start_mono);
+	snprintf(p->scratch, sizeof(p->scratch), "%s", scratch);
+	p->ksm_peak_pages = 0;
+	p->ksm_peak_profit = 0;
+	p->tenant = nsjconf->tenant_cur;
+	p->cpu_exceeded = false;
+	p->drain_since = 0;
+	p->drain_warned = false;
+	for (int i = 0; i < PERF_EVENTS; i++) {
+		p->perf_fds[i] = -1;
+	}
 	netConnToText(sock, true /* remote */ , p->remote_txt, sizeof(p->remote_txt),
 		      &p->remote_addr);
 
@@ -118,6 +150,7 @@ static void subprocAdd(struct nsjconf_t *nsjconf, pid_t pid, int sock)
 
 	LOG_D("Added pid '%d' with start time '%u' to the queue for IP: '%s'", pid,
 	      (unsigned int)p->start, p->remote_txt);
+	return p;
 }
 
 static void subprocRemove(struct nsjconf_t *nsjconf, pid_t pid)
@@ -128,6 +161,10 @@ static void subprocRemove(struct nsjconf_t *nsjconf, pid_t pid)
 			LOG_D("Removing pid '%d' from the queue (IP:'%s', start time:'%u')", p->pid,
 			      p->remote_txt, (unsigned int)p->start);
 			close(p->pid_syscall_fd);
+			ksmFinish(nsjconf, p);
+			quotaFinishFromParent(nsjconf, p);
+			perfFinishFromParent(p);
+			scratchRelease(nsjconf, p->scratch);
 			TAILQ_REMOVE(&nsjconf->pids, p, pointers);
 			free(p);
 			return;
@@ -157,6 +194,7 @@ void subprocDisplay(struct nsjconf_t *nsjconf)
 		LOG_I("PID: %d, Remote host: %s, Run time: %ld sec. (time left: %ld sec.)", p->pid,
 		      p->remote_txt, (long)diff, (long)left);
 	}
+	ksmDisplay(nsjconf);
 }
 
 static struct pids_t *subprocGetPidElem(struct nsjconf_t *nsjconf, pid_t pid)
@@ -170,6 +208,26 @@ static struct pids_t *subprocGetPidElem(struct nsjconf_t *nsjconf, pid_t pid)
 	return NULL;
 }
 
+static void subprocAccounting(struct nsjconf_t *nsjconf, pid_t pid, const struct rusage *ru,
+			      char *buf, size_t len)
+{
+	long wall_ms = 0;
+	struct pids_t *p = subprocGetPidElem(nsjconf, pid);
+	if (p != NULL) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wall_ms = (now.tv_sec - p->start_mono.tv_sec) * 1000L +
+		    (now.tv_nsec - p->start_mono.tv_nsec) / 1000000L;
+	}
+	snprintf(buf, len, "run time: %ld.%03ld s, user: %ld.%03ld s, sys: %ld.%03ld s, "
+		 "max RSS: %ld KiB", wall_ms / 1000, wall_ms % 1000, (long)ru->ru_utime.tv_sec,
+		 (long)ru->ru_utime.tv_usec / 1000, (long)ru->ru_stime.tv_sec,
+		 (long)ru->ru_stime.tv_usec / 1000, ru->ru_maxrss);
+	if (p != NULL) {
+		perfAccounting(p, buf, len);
+	}
+}
+
 static void subprocSeccompViolation(struct nsjconf_t *nsjconf, siginfo_t * si)
 {
 	LOG_W("PID: %d commited syscall/seccomp violation and exited with SIGSYS", si->si_pid);
@@ -199,47 +257,195 @@ static void subprocSeccompViolation(struct nsjconf_t *nsjconf, siginfo_t * si)
 	     (int)si->si_pid, sc, arg1, arg2, arg3, arg4, arg5, arg6, sp, pc);
 }
 
+/*
+ * Kills the whole jail: its cgroup with --cgroup_kill, otherwise its process group (the jail
+ * calls setsid()), which covers descendants that didn't leave it
+ */
+static void subprocKill(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	/* Probably a kernel bug - some processes cannot be killed with KILL if
+	 * they're namespaced, and in a stopped state */
+	kill(pid, SIGCONT);
+	PLOG_D("Sent SIGCONT to PID: %d", pid);
+	if (cgroupKill(nsjconf, pid) == true) {
+		return;
+	}
+	if (nsjconf->skip_setsid == false) {
+		kill(-pid, SIGKILL);
+	}
+	kill(pid, SIGKILL);
+	PLOG_D("Sent SIGKILL to PID: %d", pid);
+}
+
+/*
+ * The jail can't use more than one second of CPU time per second per CPU, so the next check
+ * is scheduled (via nsjconf->reap_interval_ms) before it could possibly get past the limit.
+ * Far from the limit that's the default of 1 s, and close to it, down to 10 ms
+ */
+static void subprocCheckCpu(struct nsjconf_t *nsjconf, struct pids_t *p)
+{
+	uint64_t usec;
+	if (p->cpu_exceeded == true || cgroupCpuUsage(nsjconf, p->pid, &usec) == false) {
+		return;
+	}
+	uint64_t max_usec = nsjconf->cgroup_cpu_ms_max * 1000ULL;
+	if (usec >= max_usec) {
+		LOG_I("PID: %d jail CPU time >= CPU time limit (%" PRIu64 " ms >= %" PRIu64
+		      " ms) (%s). Killing it", p->pid, usec / 1000, nsjconf->cgroup_cpu_ms_max,
+		      p->remote_txt);
+		p->cpu_exceeded = true;
+		subprocKill(nsjconf, p->pid);
+		return;
+	}
+
+	static long cpus = 0;
+	if (cpus == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		cpus = (cpus < 1) ? 1 : cpus;
+	}
+	uint64_t ms = (max_usec - usec) / 1000ULL / (uint64_t) cpus / 2ULL;
+	ms = (ms < 10ULL) ? 10ULL : ms;
+	if (ms < nsjconf->reap_interval_ms) {
+		nsjconf->reap_interval_ms = (unsigned int)ms;
+	}
+}
+
+/*
+ * Only the jails' processes are waited for, and not other children of the process (e.g. of
+ * a server using libnsjail)
+ */
+static bool subprocWaitid(struct nsjconf_t *nsjconf, siginfo_t * si)
+{
+	si->si_pid = 0;
+	if (waitid(P_ALL, 0, si, WNOHANG | WNOWAIT | WEXITED) == -1 || si->si_pid == 0) {
+		return false;
+	}
+	struct pids_t *p = subprocGetPidElem(nsjconf, si->si_pid);
+	if (p != NULL && p->drain_since == 0) {
+		return true;
+	}
+	/*
+	 * Another child (or a jail which is being drained) is finished, and it'd be returned every
+	 * time, so the jails are checked
+	 */
+	TAILQ_FOREACH(p, &nsjconf->pids, pointers) {
+		if (p->drain_since != 0) {
+			continue;
+		}
+		si->si_pid = 0;
+		if (waitid(P_PID, p->pid, si, WNOHANG | WNOWAIT | WEXITED) == 0 && si->si_pid != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * A jail is finished only once all of its processes are gone. Until then, its main process
+ * isn't reaped (so its PID, and the name of its cgroup, can't be reused), and what's left in its
+ * kill cgroup is killed again on every reap pass
+ */
+static bool subprocDrain(struct nsjconf_t *nsjconf, struct pids_t *p, time_t now)
+{
+	if (cgroupDrain(nsjconf, p->pid) == true) {
+		p->drain_since = 0;
+		return true;
+	}
+	if (p->drain_since == 0) {
+		LOG_I("PID: %d exited, but left processes behind. Killing them", p->pid);
+		p->drain_since = now;
+	}
+	if (p->drain_warned == false && now - p->drain_since >= SUBPROC_DRAIN_WARN_SEC) {
+		LOG_W("Processes of PID: %d are still alive after %d s", p->pid,
+		      SUBPROC_DRAIN_WARN_SEC);
+		p->drain_warned = true;
+	}
+	return false;
+}
+
 int subprocReap(struct nsjconf_t *nsjconf)
 {
 	int status;
 	int rv = 0;
 	siginfo_t si;
+	time_t now = time(NULL);
+
+	struct pids_t *p;
+	TAILQ_FOREACH(p, &nsjconf->pids, pointers) {
+		if (p->drain_since != 0) {
+			subprocDrain(nsjconf, p, now);
+		}
+	}
 
 	for (;;) {
-		si.si_pid = 0;
-		if (waitid(P_ALL, 0, &si, WNOHANG | WNOWAIT | WEXITED) == -1) {
+		if (subprocWaitid(nsjconf, &si) == false) {
 			break;
 		}
-		if (si.si_pid == 0) {
-			break;
+		p = subprocGetPidElem(nsjconf, si.si_pid);
+		if (p != NULL && subprocDrain(nsjconf, p, now) == false) {
+			continue;
 		}
 		if (si.si_code == CLD_KILLED && si.si_status == SIGSYS) {
 			subprocSeccompViolation(nsjconf, &si);
 		}
 
-		if (wait4(si.si_pid, &status, WNOHANG, NULL) == si.si_pid) {
+		struct rusage ru;
+		if (wait4(si.si_pid, &status, WNOHANG, &ru) == si.si_pid) {
+			bool cpu_exceeded = (p != NULL && p->cpu_exceeded);
+			if (p != NULL) {
+				logSetJail(p->jail_id, p->pid, p->remote_txt);
+				logSetPhase("exit");
+			}
+			char acct[512];
+			subprocAccounting(nsjconf, si.si_pid, &ru, acct, sizeof(acct));
 			cgroupFinishFromParent(nsjconf, si.si_pid);
+			learnFinishFromParent(nsjconf);
+			/* Exit records are used for accounting, they're never rate-limited */
+			logPauseRateLimit(true);
 			if (WIFEXITED(status)) {
 				subprocRemove(nsjconf, si.si_pid);
-				LOG_I("PID: %d exited with status: %d, (PIDs left: %d)", si.si_pid,
-				      WEXITSTATUS(status), subprocCount(nsjconf));
+				LOG_I("PID: %d exited with status: %d, %s (PIDs left: %d)", si.si_pid,
+				      WEXITSTATUS(status), acct, subprocCount(nsjconf));
 				rv = WEXITSTATUS(status) % 100;
 				if (rv == 0 && WEXITSTATUS(status) != 0) {
 					rv = 1;
 				}
 			}
-			if (WIFSIGNALED(status)) {
+			if (WIFSIGNALED(status) && cpu_exceeded) {
+				subprocRemove(nsjconf, si.si_pid);
+				LOG_I("PID: %d terminated: jail CPU time limit exceeded, %s (PIDs left: "
+				      "%d)", si.si_pid, acct, subprocCount(nsjconf));
+				rv = 100 + SIGXCPU;
+			} else if (WIFSIGNALED(status)) {
 				subprocRemove(nsjconf, si.si_pid);
-				LOG_I("PID: %d terminated with signal: %d, (PIDs left: %d)",
-				      si.si_pid, WTERMSIG(status), subprocCount(nsjconf));
+				LOG_I("PID: %d terminated with signal: %d, %s (PIDs left: %d)",
+				      si.si_pid, WTERMSIG(status), acct, subprocCount(nsjconf));
 				rv = 100 + WTERMSIG(status);
 			}
+			logPauseRateLimit(false);
+			if (nsjconf->exit_cb != NULL) {
+				nsjconf->exit_cb(si.si_pid, status, nsjconf->exit_cb_arg);
+			}
+			logClearJail();
 		}
 	}
 
-	time_t now = time(NULL);
-	struct pids_t *p;
+	nsjconf->reap_interval_ms = 1000;
 	TAILQ_FOREACH(p, &nsjconf->pids, pointers) {
+		if (p->drain_since != 0) {
+			/* Dying processes usually take a moment, stuck ones are checked once per second */
+			if (now - p->drain_since < 1
+			    && nsjconf->reap_interval_ms > SUBPROC_DRAIN_INTERVAL_MS) {
+				nsjconf->reap_interval_ms = SUBPROC_DRAIN_INTERVAL_MS;
+			}
+			continue;
+		}
+		logSetJail(p->jail_id, p->pid, p->remote_txt);
+		logSetPhase("run");
+		ksmSample(nsjconf, p);
+		quotaSample(nsjconf, p);
+		subprocCheckCpu(nsjconf, p);
+		perfSample(nsjconf, p);
 		if (nsjconf->tlimit == 0) {
 			continue;
 		}
@@ -248,14 +454,10 @@ int subprocReap(struct nsjconf_t *nsjconf)
 		if (diff >= nsjconf->tlimit) {
 			LOG_I("PID: %d run time >= time limit (%ld >= %ld) (%s). Killing it", pid,
 			      (long)diff, (long)nsjconf->tlimit, p->remote_txt);
-			/* Probably a kernel bug - some processes cannot be killed with KILL if
-			 * they're namespaced, and in a stopped state */
-			kill(pid, SIGCONT);
-			PLOG_D("Sent SIGCONT to PID: %d", pid);
-			kill(pid, SIGKILL);
-			PLOG_D("Sent SIGKILL to PID: %d", pid);
+			subprocKill(nsjconf, pid);
 		}
 	}
+	logClearJail();
 	return rv;
 }
 
@@ -263,20 +465,22 @@ void subprocKillAll(struct nsjconf_t *nsjconf)
 {
 	struct pids_t *p;
 	TAILQ_FOREACH(p, &nsjconf->pids, pointers) {
-		kill(p->pid, SIGKILL);
+		subprocKill(nsjconf, p->pid);
 	}
 }
 
-static bool subprocInitParent(struct nsjconf_t *nsjconf, pid_t pid, int pipefd)
+static bool subprocInitParent(struct nsjconf_t *nsjconf, struct pids_t *p, int pipefd)
 {
+	pid_t pid = p->pid;
 	if (netInitNsFromParent(nsjconf, pid) == false) {
 		LOG_E("Couldn't create and put MACVTAP interface into NS of PID '%d'", pid);
 		return false;
 	}
 	if (cgroupInitNsFromParent(nsjconf, pid) == false) {
-		LOG_E("Couldn't initialize cgroup user namespace");
-		exit(1);
+		LOG_E("Couldn't put PID %d into its cgroups", pid);
+		return false;
 	}
+	perfInitFromParent(nsjconf, p);
 	if (userInitNsFromParent(nsjconf, pid) == false) {
 		LOG_E("Couldn't initialize user namespaces for pid %d", pid);
 		return false;
@@ -289,10 +493,42 @@ static bool subprocInitParent(struct nsjconf_t *nsjconf, pid_t pid, int pipefd)
 	return true;
 }
 
-void subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err)
+static void subprocCloseFd(int fd)
+{
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+/*
+ * The jail couldn't be set up after it was added: it's killed (it's still waiting for
+ * subprocDoneChar, or about to execve()), and forgotten
+ */
+static void subprocAbort(struct nsjconf_t *nsjconf, pid_t pid)
+{
+	subprocKill(nsjconf, pid);
+	/* It might not have joined its kill cgroup yet, if that's what failed */
+	kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, __WALL) == -1 && errno == EINTR) ;
+	cgroupFinishFromParent(nsjconf, pid);
+	subprocRemove(nsjconf, pid);
+}
+
+static pid_t subprocSpawn(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err,
+			  const char *cs_addr)
 {
 	if (netLimitConns(nsjconf, fd_in) == false) {
-		return;
+		return -1;
+	}
+	/* From the checkpoint of a template jail (--criu_dir), if there's one */
+	pid_t restored = criuRestore(nsjconf, fd_in, fd_out, fd_err);
+	if (restored > 0) {
+		struct pids_t *p = subprocAdd(nsjconf, restored, fd_in, "");
+		logSetJail(0, restored, cs_addr);
+		quotaInitFromParent(nsjconf, p);
+		cpuInitFromParent(nsjconf, restored, fd_in);
+		perfInitFromParent(nsjconf, p);
+		return restored;
 	}
 #ifndef CLONE_NEWCGROUP
 #define CLONE_NEWCGROUP 0x02000000
@@ -306,6 +542,10 @@ void subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_er
 	flags |= (nsjconf->clone_newuts ? CLONE_NEWUTS : 0);
 	flags |= (nsjconf->clone_newcgroup ? CLONE_NEWCGROUP : 0);
 
+	envPrepare(nsjconf, fd_in);
+	unsigned int jail_id = envGetJailId();
+	logSetJail(jail_id, 0, cs_addr);
+
 	if (nsjconf->mode == MODE_STANDALONE_EXECVE) {
 		LOG_D("Entering namespace with flags: %#lx", flags);
 		if (unshare(flags) == -1) {
@@ -318,37 +558,95 @@ void subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_er
 	flags |= SIGCHLD;
 	LOG_D("Creating new process with clone flags: %#lx", flags);
 
+	char scratch[64];
+	if (scratchAcquire(nsjconf, scratch, sizeof(scratch)) == false) {
+		LOG_E("Couldn't prepare a scratch directory for the new process");
+		return -1;
+	}
+
+	/* With --session_grace, the jail talks to the relay, not to the connection */
+	int jail_fd, relay_fd;
+	if (sessionPrepare(nsjconf, &jail_fd, &relay_fd) == false) {
+		scratchRelease(nsjconf, scratch);
+		return -1;
+	}
+
 	int sv[2];
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
 		PLOG_E("socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC) failed");
-		return;
+		subprocCloseFd(jail_fd);
+		subprocCloseFd(relay_fd);
+		scratchRelease(nsjconf, scratch);
+		return -1;
 	}
 	int child_fd = sv[0];
 	int parent_fd = sv[1];
 
+	/* The batched log entries would be inherited by the new process */
+	logFlush();
 	pid_t pid = syscall(__NR_clone, (uintptr_t) flags, NULL, NULL, NULL, (uintptr_t) 0);
 	if (pid == 0) {
 		close(parent_fd);
+		logSetPhase("setup");
+		if (jail_fd != -1) {
+			close(relay_fd);
+			fd_in = fd_out = fd_err = jail_fd;
+		}
 		subprocNewProc(nsjconf, fd_in, fd_out, fd_err, child_fd);
 	}
 	close(child_fd);
+	subprocCloseFd(jail_fd);
 	if (pid == -1) {
 		PLOG_E("clone(flags=%#lx) failed. You probably need root privileges if your system "
 		       "doesn't support CLONE_NEWUSER. Alternatively, you might want to recompile your "
 		       "kernel with support for namespaces or check the setting of the "
 		       "kernel.unprivileged_userns_clone sysctl", flags);
 		close(parent_fd);
-		return;
+		subprocCloseFd(relay_fd);
+		scratchRelease(nsjconf, scratch);
+		return -1;
 	}
-	subprocAdd(nsjconf, pid, fd_in);
+	struct pids_t *p = subprocAdd(nsjconf, pid, fd_in, scratch);
+	p->jail_id = jail_id;
+	logSetJail(jail_id, pid, cs_addr);
 
-	if (subprocInitParent(nsjconf, pid, parent_fd) == false) {
+	if (quotaInitFromParent(nsjconf, p) == false) {
 		close(parent_fd);
-		return;
+		subprocCloseFd(relay_fd);
+		subprocAbort(nsjconf, pid);
+		return -1;
+	}
+	cpuInitFromParent(nsjconf, pid, fd_in);
+	if (subprocInitParent(nsjconf, p, parent_fd) == false) {
+		close(parent_fd);
+		subprocCloseFd(relay_fd);
+		subprocAbort(nsjconf, pid);
+		return -1;
+	}
+	if (ptyInitFromParent(nsjconf, pid, parent_fd, relay_fd, fd_in, fd_out) == false) {
+		close(parent_fd);
+		subprocAbort(nsjconf, pid);
+		return -1;
+	}
+	if (learnInitFromParent(nsjconf, pid, parent_fd) == false) {
+		close(parent_fd);
+		subprocAbort(nsjconf, pid);
+		return -1;
 	}
 
 	close(parent_fd);
+	LOG_I("PID: %d about to execute '%s' for %s", pid, nsjconf->argv[0], cs_addr);
+	return pid;
+}
+
+/* Messages logged while the jail is set up are tagged with it */
+pid_t subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err)
+{
 	char cs_addr[64];
 	netConnToText(fd_in, true /* remote */ , cs_addr, sizeof(cs_addr), NULL);
-	LOG_I("PID: %d about to execute '%s' for %s", pid, nsjconf->argv[0], cs_addr);
+	logSetJail(0, 0, cs_addr);
+	logSetPhase("spawn");
+	pid_t pid = subprocSpawn(nsjconf, fd_in, fd_out, fd_err, cs_addr);
+	logClearJail();
+	return pid;
 }
@@ -24,7 +24,8 @@
 
 #include "common.h"
 
-void subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err);
+/* Returns the PID of the new process, or -1 if it couldn't be created */
+pid_t subprocRunChild(struct nsjconf_t *nsjconf, int fd_in, int fd_out, int fd_err);
 int subprocCount(struct nsjconf_t *nsjconf);
 void subprocDisplay(struct nsjconf_t *nsjconf);
 void subprocKillAll(struct nsjconf_t *nsjconf);
@@ -0,0 +1,132 @@
+/*
+
+   nsjail - namespaced sysctls
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "sysctl.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+/*
+ * /proc/sys is opened once by the supervisor, and the paths are computed once. Entries under
+ * /proc/sys/net and the ipc ones are resolved against the namespaces of the process doing the
+ * lookup, so the jail reaches its own sysctls through this fd with a single openat() each,
+ * and doesn't need a /proc of its own.
+ */
+static int sysctlDirFd = -1;
+
+static const struct {
+	const char *prefix;
+	bool newnet;
+} sysctlNamespaced[] = {
+	{"net/", true},
+	{"kernel/shm", false},
+	{"kernel/msg", false},
+	{"kernel/sem", false},
+	{"fs/mqueue/", false},
+};
+
+bool sysctlInit(struct nsjconf_t * nsjconf)
+{
+	if (TAILQ_EMPTY(&nsjconf->sysctls)) {
+		return true;
+	}
+
+	struct sysctl_t *p;
+	TAILQ_FOREACH(p, &nsjconf->sysctls, pointers) {
+		/* The 'net/ipv4/conf/eth0.1/forwarding' form is needed for names with dots */
+		char *path = utilMalloc(strlen(p->name) + 1);
+		strcpy(path, p->name);
+		if (strchr(path, '/') == NULL) {
+			for (char *c = path; *c; c++) {
+				if (*c == '.') {
+					*c = '/';
+				}
+			}
+		}
+		if (path[0] == '/' || strstr(path, "..") != NULL) {
+			LOG_E("Invalid sysctl name: '%s'", p->name);
+			return false;
+		}
+
+		size_t i;
+		for (i = 0; i < ARRAYSIZE(sysctlNamespaced); i++) {
+			if (strncmp(path, sysctlNamespaced[i].prefix,
+				    strlen(sysctlNamespaced[i].prefix)) == 0) {
+				break;
+			}
+		}
+		if (i == ARRAYSIZE(sysctlNamespaced)) {
+			LOG_E("sysctl '%s' isn't namespaced, only net.*, kernel.shm*, kernel.msg*, "
+			      "kernel.sem and fs.mqueue.* are supported", p->name);
+			return false;
+		}
+		if (sysctlNamespaced[i].newnet && nsjconf->clone_newnet == false) {
+			LOG_E("sysctl '%s' requires CLONE_NEWNET", p->name);
+			return false;
+		}
+		if (sysctlNamespaced[i].newnet == false && nsjconf->clone_newipc == false) {
+			LOG_E("sysctl '%s' requires CLONE_NEWIPC", p->name);
+			return false;
+		}
+		p->path = path;
+	}
+
+	sysctlDirFd = TEMP_FAILURE_RETRY(open("/proc/sys", O_PATH | O_DIRECTORY | O_CLOEXEC));
+	if (sysctlDirFd == -1) {
+		PLOG_E("open('/proc/sys')");
+		return false;
+	}
+	return true;
+}
+
+bool sysctlInitNs(struct nsjconf_t * nsjconf)
+{
+	struct sysctl_t *p;
+	TAILQ_FOREACH(p, &nsjconf->sysctls, pointers) {
+		LOG_D("Setting sysctl '%s' to '%s'", p->name, p->value);
+		int fd = TEMP_FAILURE_RETRY(openat(sysctlDirFd, p->path, O_WRONLY | O_CLOEXEC));
+		if (fd == -1 && errno == ENOENT) {
+			PLOG_E("openat('/proc/sys/%s'), sysctl '%s' doesn't exist in new namespaces",
+			       p->path, p->name);
+			return false;
+		}
+		if (fd == -1) {
+			PLOG_E("openat('/proc/sys/%s'), sysctl '%s' is read-only in new namespaces, "
+			       "or requires the jail's user to be root in its user namespace "
+			       "(e.g. --user 0)", p->path, p->name);
+			return false;
+		}
+		size_t len = strlen(p->value);
+		/* sysctls have to be written with a single write() */
+		if (TEMP_FAILURE_RETRY(write(fd, p->value, len)) != (ssize_t) len) {
+			PLOG_E("Couldn't set sysctl '%s' to '%s'", p->name, p->value);
+			close(fd);
+			return false;
+		}
+		close(fd);
+	}
+	return true;
+}
@@ -0,0 +1,221 @@
+/*
+
+   nsjail - TLS termination with kernel TLS offload
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "tls.h"
+
+#include "log.h"
+
+#if defined(NSJAIL_WITH_OPENSSL)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void tlsLogErrors(const char *what)
+{
+	unsigned long err;
+	while ((err = ERR_get_error()) != 0) {
+		char buf[256];
+		ERR_error_string_n(err, buf, sizeof(buf));
+		LOG_W("%s: %s", what, buf);
+	}
+}
+
+bool tlsInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->tls_cert == NULL) {
+		return true;
+	}
+
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL) {
+		tlsLogErrors("SSL_CTX_new()");
+		return false;
+	}
+	/*
+	 * The connection is handed over to the jail as a plain socket, so nothing but application
+	 * data can be sent once the handshake is done: no session tickets, no renegotiation
+	 */
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_TICKET);
+	SSL_CTX_set_num_tickets(ctx, 0);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+	if (SSL_CTX_use_certificate_chain_file(ctx, nsjconf->tls_cert) != 1) {
+		tlsLogErrors("SSL_CTX_use_certificate_chain_file()");
+		LOG_E("Couldn't load the certificate chain from '%s'", nsjconf->tls_cert);
+		SSL_CTX_free(ctx);
+		return false;
+	}
+	if (SSL_CTX_use_PrivateKey_file(ctx, nsjconf->tls_key, SSL_FILETYPE_PEM) != 1) {
+		tlsLogErrors("SSL_CTX_use_PrivateKey_file()");
+		LOG_E("Couldn't load the private key from '%s'", nsjconf->tls_key);
+		SSL_CTX_free(ctx);
+		return false;
+	}
+	if (SSL_CTX_check_private_key(ctx) != 1) {
+		LOG_E("The private key '%s' doesn't match the certificate '%s'", nsjconf->tls_key,
+		      nsjconf->tls_cert);
+		SSL_CTX_free(ctx);
+		return false;
+	}
+
+	if (access("/proc/net/tls_stat", F_OK) == -1) {
+		LOG_W("Kernel TLS doesn't seem to be available (no /proc/net/tls_stat, is the 'tls' "
+		      "module loaded?). TLS connections will be rejected");
+	}
+	nsjconf->tls_ctx = ctx;
+	return true;
+}
+
+static void tlsSetCork(int fd, int val)
+{
+	if (setsockopt(fd, SOL_TCP, TCP_CORK, &val, sizeof(val)) == -1) {
+		PLOG_W("setsockopt(%d, TCP_CORK, %d)", fd, val);
+	}
+}
+
+/*
+ * The handshake is done in the supervisor, so its CPU cost isn't accounted to the jail, on the
+ * non-blocking connfd, and driven by tlsContinue() from the main loop (see conn.c). *ssl stays
+ * NULL without --tls_cert
+ */
+bool tlsStart(struct nsjconf_t * nsjconf, int connfd, void **ssl)
+{
+	*ssl = NULL;
+	if (nsjconf->tls_ctx == NULL) {
+		return true;
+	}
+
+	SSL *s = SSL_new((SSL_CTX *) nsjconf->tls_ctx);
+	if (s == NULL) {
+		tlsLogErrors("SSL_new()");
+		return false;
+	}
+	/* The socket BIO is created with BIO_NOCLOSE, so SSL_free() won't close connfd */
+	if (SSL_set_fd(s, connfd) != 1) {
+		tlsLogErrors("SSL_set_fd()");
+		SSL_free(s);
+		return false;
+	}
+	/* Don't delay the handshake flights, netAcceptConn() corks the socket */
+	tlsSetCork(connfd, 0);
+	*ssl = s;
+	return true;
+}
+
+/* The jail owns the socket once the handshake is done, don't send close_notify */
+void tlsAbort(void *ssl)
+{
+	if (ssl == NULL) {
+		return;
+	}
+	SSL_set_quiet_shutdown((SSL *) ssl, 1);
+	SSL_free((SSL *) ssl);
+}
+
+/*
+ * Once the handshake is done, the keys are installed in the kernel (TCP_ULP "tls"), and the
+ * jail gets the very same socket, on which it reads and writes plaintext, with the bulk
+ * encryption done by the kernel. If the kernel (or the negotiated cipher) doesn't allow
+ * offloading both directions, the connection is rejected, as there's no way to pass the TLS
+ * session state to the jail.
+ *
+ * Returns 1 when the handshake is done, 0 if it's still in progress (*events is what connfd
+ * should be polled for), and -1 if it has failed. ssl is freed unless 0 is returned
+ */
+int tlsContinue(void *ssl, int connfd, short *events)
+{
+	SSL *s = (SSL *) ssl;
+	int ret = SSL_accept(s);
+	int err = SSL_get_error(s, ret);
+	if (ret != 1 && err == SSL_ERROR_WANT_READ) {
+		*events = POLLIN;
+		return 0;
+	}
+	if (ret != 1 && err == SSL_ERROR_WANT_WRITE) {
+		*events = POLLOUT;
+		return 0;
+	}
+	tlsSetCork(connfd, 1);
+	if (ret != 1) {
+		tlsLogErrors("SSL_accept()");
+		LOG_W("TLS handshake failed (SSL_get_error: %d)", err);
+		tlsAbort(s);
+		return -1;
+	}
+
+	bool ktls_send = (BIO_get_ktls_send(SSL_get_wbio(s)) == 1);
+	bool ktls_recv = (BIO_get_ktls_recv(SSL_get_rbio(s)) == 1);
+	bool pending = (SSL_has_pending(s) == 1);
+	LOG_D("TLS handshake done, version: %s, cipher: %s, kTLS send: %s, kTLS recv: %s",
+	      SSL_get_version(s), SSL_get_cipher_name(s), ktls_send ? "yes" : "no",
+	      ktls_recv ? "yes" : "no");
+
+	if (ktls_send == false || ktls_recv == false) {
+		LOG_W("Rejecting TLS connection (%s, %s): kernel TLS offload is not available "
+		      "(send: %s, recv: %s)", SSL_get_version(s), SSL_get_cipher_name(s),
+		      ktls_send ? "yes" : "no", ktls_recv ? "yes" : "no");
+		tlsAbort(s);
+		return -1;
+	}
+	if (pending) {
+		LOG_W("Rejecting TLS connection: application data was buffered during the handshake");
+		tlsAbort(s);
+		return -1;
+	}
+	tlsAbort(s);
+	return 1;
+}
+
+#else				/* defined(NSJAIL_WITH_OPENSSL) */
+
+bool tlsInit(struct nsjconf_t * nsjconf)
+{
+	if (nsjconf->tls_cert == NULL) {
+		return true;
+	}
+	LOG_E("nsjail was compiled without TLS support (OpenSSL headers were not found)");
+	return false;
+}
+
+bool tlsStart(struct nsjconf_t * nsjconf, int connfd __attribute__ ((unused)), void **ssl)
+{
+	*ssl = NULL;
+	return (nsjconf->tls_cert == NULL);
+}
+
+int tlsContinue(void *ssl __attribute__ ((unused)), int connfd __attribute__ ((unused)),
+		short *events __attribute__ ((unused)))
+{
+	return -1;
+}
+
+void tlsAbort(void *ssl __attribute__ ((unused)))
+{
+}
+
+#endif				/* defined(NSJAIL_WITH_OPENSSL) */
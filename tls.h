@@ -0,0 +1,34 @@
+/*
+
+   nsjail - TLS termination with kernel TLS offload
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef NS_TLS_H
+#define NS_TLS_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+bool tlsInit(struct nsjconf_t *nsjconf);
+bool tlsStart(struct nsjconf_t *nsjconf, int connfd, void **ssl);
+int tlsContinue(void *ssl, int connfd, short *events);
+void tlsAbort(void *ssl);
+
+#endif				/* NS_TLS_H */
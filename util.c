@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -157,3 +158,49 @@ bool utilCreateDirRecursively(const char *dir)
 		curr = next + 1;
 	}
 }
+
+/* Sends one byte, and the fd (if it's not -1) with SCM_RIGHTS */
+bool utilSendFd(int sock, char cmd, int fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	memset(cbuf, '\0', sizeof(cbuf));
+	struct iovec iov = {.iov_base = &cmd,.iov_len = sizeof(cmd) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = (fd == -1) ? NULL : cbuf,
+		.msg_controllen = (fd == -1) ? 0 : sizeof(cbuf),
+	};
+	if (fd != -1) {
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	if (TEMP_FAILURE_RETRY(sendmsg(sock, &msg, MSG_NOSIGNAL)) != sizeof(cmd)) {
+		PLOG_W("sendmsg(cmd='%c')", cmd);
+		return false;
+	}
+	return true;
+}
+
+/* Receives one byte, and the fd sent with it (or -1) */
+ssize_t utilRecvFd(int sock, char *cmd, int *fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {.iov_base = cmd,.iov_len = sizeof(*cmd) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	*fd = -1;
+	ssize_t sz = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC));
+	struct cmsghdr *cmsg = (sz > 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	return sz;
+}
@@ -33,5 +33,7 @@ ssize_t utilReadFromFile(const char *fname, void *buf, size_t len);
 ssize_t utilWriteToFd(int fd, const void *buf, size_t len);
 bool utilWriteBufToFile(const char *filename, const void *buf, size_t len, int open_flags);
 bool utilCreateDirRecursively(const char *dir);
+bool utilSendFd(int sock, char cmd, int fd);
+ssize_t utilRecvFd(int sock, char *cmd, int *fd);
 
 #endif				/* NS_UTIL_H */
@@ -0,0 +1,251 @@
+/*
+
+   nsjail - page-cache warmup of the jails' file-system
+   -----------------------------------------
+
+   Copyright 2016 Google Inc. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "warmup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/*
+ * The files are read by a helper process, so the supervisor can start accepting (or queueing)
+ * connections right away. Mappings locked with --warmup_mlock stay in the helper, which then
+ * sleeps until the supervisor exits, or until the warmup is restarted (SIGHUP).
+ */
+static pid_t warmupPid = -1;
+static int warmupFd = -1;
+static bool warmupDone = true;
+static struct timespec warmupStart;
+
+static uint64_t warmupTotalFiles;
+static uint64_t warmupTotalBytes;
+static uint64_t warmupFiles;
+static uint64_t warmupBytes;
+static uint64_t warmupLockedBytes;
+static time_t warmupLastReport;
+static bool warmupCounting;
+static bool warmupLocking;
+
+static void warmupReport(bool final)
+{
+	time_t now = time(NULL);
+	if (final == false && now == warmupLastReport) {
+		return;
+	}
+	warmupLastReport = now;
+	LOG_I("Warmup%s: %" PRIu64 "/%" PRIu64 " files, %" PRIu64 "/%" PRIu64 " MiB (%u%%)",
+	      final ? " finished" : "", warmupFiles, warmupTotalFiles, warmupBytes >> 20,
+	      warmupTotalBytes >> 20,
+	      warmupTotalBytes ? (unsigned int)(warmupBytes * 100 / warmupTotalBytes) : 100);
+}
+
+static int warmupFile(const char *fpath, const struct stat *sb, int typeflag,
+		      struct FTW *ftwbuf __attribute__ ((unused)))
+{
+	if (typeflag != FTW_F || S_ISREG(sb->st_mode) == false || sb->st_size == 0) {
+		return FTW_CONTINUE;
+	}
+	if (warmupCounting) {
+		warmupTotalFiles++;
+		warmupTotalBytes += sb->st_size;
+		return FTW_CONTINUE;
+	}
+
+	int fd = TEMP_FAILURE_RETRY(open(fpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+	if (fd == -1) {
+		PLOG_D("open('%s')", fpath);
+		return FTW_CONTINUE;
+	}
+	if (warmupLocking) {
+		/* The mapping is never unmapped, the pages stay locked while the helper is alive */
+		void *addr = mmap(NULL, sb->st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			PLOG_W("mmap('%s', %zu)", fpath, (size_t) sb->st_size);
+		} else if (mlock(addr, sb->st_size) == -1) {
+			PLOG_W("mlock('%s', %zu)", fpath, (size_t) sb->st_size);
+			munmap(addr, sb->st_size);
+		} else {
+			warmupLockedBytes += sb->st_size;
+		}
+	} else {
+		if (readahead(fd, 0, sb->st_size) == -1) {
+			PLOG_D("readahead('%s')", fpath);
+		}
+		warmupFiles++;
+		warmupBytes += sb->st_size;
+		warmupReport(false);
+	}
+	close(fd);
+	return FTW_CONTINUE;
+}
+
+static void warmupWalk(struct nsjconf_t *nsjconf, bool mlocked)
+{
+	struct warmup_t *p;
+	TAILQ_FOREACH(p, &nsjconf->warmup, pointers) {
+		if (p->mlock != mlocked) {
+			continue;
+		}
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s%s", nsjconf->chroot ? nsjconf->chroot : "", p->path);
+		if (nftw(path, warmupFile, 32, FTW_PHYS | FTW_MOUNT | FTW_ACTIONRETVAL) == -1) {
+			PLOG_W("nftw('%s')", path);
+		}
+	}
+}
+
+static void warmupHelper(struct nsjconf_t *nsjconf, int donefd)
+{
+	if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) == -1) {
+		PLOG_W("prctl(PR_SET_PDEATHSIG, SIGKILL)");
+	}
+
+	warmupCounting = true;
+	warmupWalk(nsjconf, false);
+	warmupWalk(nsjconf, true);
+	warmupCounting = false;
+
+	warmupWalk(nsjconf, false);
+	warmupWalk(nsjconf, true);
+	warmupReport(true);
+
+	if (nsjconf->warmup_mlock_cnt > 0) {
+		warmupLocking = true;
+		warmupWalk(nsjconf, true);
+		LOG_I("Warmup: %" PRIu64 " MiB locked in memory", warmupLockedBytes >> 20);
+	}
+
+	char c = 'D';
+	if (TEMP_FAILURE_RETRY(write(donefd, &c, sizeof(c))) != sizeof(c)) {
+		PLOG_W("write(donefd)");
+	}
+	close(donefd);
+	if (warmupLocking == false) {
+		_exit(0);
+	}
+	for (;;) {
+		pause();
+	}
+}
+
+static void warmupStop(void)
+{
+	if (warmupPid == -1) {
+		return;
+	}
+	kill(warmupPid, SIGKILL);
+	while (waitpid(warmupPid, NULL, 0) == -1 && errno == EINTR) ;
+	warmupPid = -1;
+	close(warmupFd);
+	warmupFd = -1;
+}
+
+/* Called at startup, and again (which restarts the helper) on SIGHUP */
+bool warmupInit(struct nsjconf_t *nsjconf)
+{
+	if (TAILQ_EMPTY(&nsjconf->warmup)) {
+		return true;
+	}
+	warmupStop();
+
+	int pipefd[2];
+	if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) == -1) {
+		PLOG_E("pipe2()");
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		PLOG_E("fork()");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(pipefd[0]);
+		warmupHelper(nsjconf, pipefd[1]);
+		_exit(0);
+	}
+	close(pipefd[1]);
+	warmupPid = pid;
+	warmupFd = pipefd[0];
+	warmupDone = false;
+	clock_gettime(CLOCK_MONOTONIC, &warmupStart);
+	LOG_I("Warmup started, helper PID: %d%s", (int)pid,
+	      nsjconf->warmup_wait ? ", new jails will wait for it" : "");
+	return true;
+}
+
+static void warmupFinished(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (now.tv_sec - warmupStart.tv_sec) * 1000L +
+	    (now.tv_nsec - warmupStart.tv_nsec) / 1000000L;
+	LOG_I("Warmup done in %ld.%03ld s", ms / 1000, ms % 1000);
+	warmupDone = true;
+	close(warmupFd);
+	warmupFd = -1;
+}
+
+/* Returns false if new jails must still wait for the warmup (--warmup_wait) */
+bool warmupReady(struct nsjconf_t *nsjconf)
+{
+	if (warmupDone == false) {
+		char c;
+		ssize_t sz = read(warmupFd, &c, sizeof(c));
+		if (sz == 1 || sz == 0) {
+			/* EOF: the helper is gone without reporting, don't block jails forever */
+			warmupFinished();
+		}
+	}
+	if (warmupDone == true && warmupPid != -1
+	    && nsjconf->warmup_mlock_cnt == 0) {
+		while (waitpid(warmupPid, NULL, 0) == -1 && errno == EINTR) ;
+		warmupPid = -1;
+	}
+	return (warmupDone == true || nsjconf->warmup_wait == false);
+}
+
+void warmupWait(struct nsjconf_t *nsjconf)
+{
+	while (warmupReady(nsjconf) == false) {
+		struct pollfd pfd = {.fd = warmupFd,.events = POLLIN,.revents = 0 };
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			PLOG_E("poll()");
+			return;
+		}
+	}
+}